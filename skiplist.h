@@ -55,89 +55,332 @@ static inline int list_empty(struct sk_link *link)
 #define skiplist_foreach_safe(pos, n, end) \
         for (n = pos->next; pos != end; pos = n, n = pos->next)
 
+/* With SKIPLIST_PREFETCH defined, the lookups prefetch the next node on the
+ * current level and the first node on the level below while comparing the
+ * current key. */
+#ifdef SKIPLIST_PREFETCH
+#define skiplist_prefetch(ptr, i) do { \
+                __builtin_prefetch(ptr); \
+                __builtin_prefetch(list_entry(ptr, struct skipnode, link[i])); \
+        } while (0)
+#define skiplist_prefetch_hop(pos, i) do { \
+                skiplist_prefetch((pos)->next, i); \
+                if ((i) > 0) { \
+                        skiplist_prefetch(((pos) - 1)->next, (i) - 1); \
+                } \
+        } while (0)
+#else
+#define skiplist_prefetch_hop(pos, i) do { } while (0)
+#endif
+
+#ifndef SKIPLIST_GROUP
+#define SKIPLIST_GROUP 16  /* descents interleaved by skiplist_search_many() */
+#endif
+
+#ifndef MAX_LEVEL
 #define MAX_LEVEL 32  /* Should be enough for 2^32 elements */
+#endif
+
+/* The key and value types can be chosen by defining these macros before
+ * including this header. SKIPLIST_KEY_CMP(a, b) returns a negative, zero or
+ * positive value like memcmp(), and is expanded in place so the compare is
+ * inlined into every descent. SKIPLIST_KEY_FMT/SKIPLIST_KEY_ARG (and the
+ * value counterparts) are only used by skiplist_dump(), which is left out
+ * when a custom type comes without a format. */
+#ifndef SKIPLIST_KEY_TYPE
+#define SKIPLIST_KEY_TYPE int
+#define SKIPLIST_KEY_FMT "0x%08x"
+#endif
+
+#ifndef SKIPLIST_VALUE_TYPE
+#define SKIPLIST_VALUE_TYPE int
+#define SKIPLIST_VALUE_FMT "0x%08x"
+#endif
+
+#ifndef SKIPLIST_KEY_CMP
+#define SKIPLIST_KEY_CMP(a, b) (((a) > (b)) - ((a) < (b)))
+#endif
+
+#ifndef SKIPLIST_KEY_ARG
+#define SKIPLIST_KEY_ARG(key) (key)
+#endif
+
+#ifndef SKIPLIST_VALUE_ARG
+#define SKIPLIST_VALUE_ARG(value) (value)
+#endif
+
+typedef SKIPLIST_KEY_TYPE sk_key_t;
+typedef SKIPLIST_VALUE_TYPE sk_value_t;
+
+#ifndef SKIPLIST_P_SHIFT
+#define SKIPLIST_P_SHIFT 2  /* promotion probability p = 1/2^SKIPLIST_P_SHIFT: 1, 2 or 3 */
+#endif
+
+/* Nodes are carved out of slabs of SKIPLIST_SLAB_SIZE bytes, one size class
+ * per level. Slabs are aligned to their size so that the level of a node can
+ * be found from its address, and so that the whole list can be released slab
+ * by slab. SKIPLIST_SLAB_SIZE must be a power of two large enough to hold a
+ * node of MAX_LEVEL. */
+#ifndef SKIPLIST_SLAB_SIZE
+#define SKIPLIST_SLAB_SIZE 4096
+#endif
+
+#ifndef SKIPLIST_SLAB_ALLOC
+#define SKIPLIST_SLAB_ALLOC(size) slab_alloc(size)
+#define SKIPLIST_SLAB_FREE(ptr) free(ptr)
+
+static inline void *slab_alloc(size_t size)
+{
+        void *ptr;
+        return posix_memalign(&ptr, size, size) ? NULL : ptr;
+}
+#endif
+
+/* With SKIPLIST_STATS defined the list counts, for each of search, insert and
+ * remove, the calls, the key compares and the nodes visited on every level,
+ * and keeps a histogram of the tower heights. skiplist_stats() takes a
+ * snapshot in O(levels). The counters are plain increments, so lists read by
+ * several threads at once must be built without them. Left undefined, the
+ * counting compiles to nothing. */
+#ifdef SKIPLIST_STATS
+enum { SK_STAT_SEARCH, SK_STAT_INSERT, SK_STAT_REMOVE, SK_STAT_OPS };
+
+struct sk_op_stats {
+        unsigned long long calls;
+        unsigned long long compares;
+        unsigned long long hops[MAX_LEVEL];     /* nodes visited on level i + 1 */
+};
+
+#define skiplist_stat_call(list, op) ((list)->stats[op].calls++)
+#define skiplist_stat_hop(list, op, i) do { \
+                (list)->stats[op].hops[i]++; \
+                (list)->stats[op].compares++; \
+        } while (0)
+#define skiplist_stat_cmp(list, op) ((list)->stats[op].compares++)
+#define skiplist_stat_height(list, level, n) ((list)->height[(level) - 1] += (n))
+#else
+#define skiplist_stat_call(list, op) do { } while (0)
+#define skiplist_stat_hop(list, op, i) do { } while (0)
+#define skiplist_stat_cmp(list, op) do { } while (0)
+#define skiplist_stat_height(list, level, n) do { } while (0)
+#endif
+
+struct sk_slab {
+        struct sk_slab *next;
+        int level;
+};
+
+#define slab_of(node) \
+        ((struct sk_slab *)((size_t)(node) & ~((size_t)SKIPLIST_SLAB_SIZE - 1)))
 
 struct skiplist {
         int level;
         int count;
+        unsigned long long rand;              /* level generator state */
         struct sk_link head[MAX_LEVEL];
+        struct sk_link *free_list[MAX_LEVEL];  /* free nodes chained by link[0] */
+        struct sk_slab *slabs;
+#ifdef SKIPLIST_STATS
+        struct sk_op_stats stats[SK_STAT_OPS];
+        int height[MAX_LEVEL];            /* nodes whose tower is i + 1 high */
+#endif
 };
 
 struct skipnode {
-        int key;
-        int value;
+        sk_key_t key;
+        sk_value_t value;
         struct sk_link link[0];
 };
 
-static struct skipnode *skipnode_new(int level, int key, int value)
+struct sk_pair {
+        sk_key_t key;
+        sk_value_t value;
+};
+
+static inline size_t skipnode_size(int level)
+{
+        return sizeof(struct skipnode) + level * sizeof(struct sk_link);
+}
+
+/* Carve a new slab into nodes of the given level and put them on the free
+ * list of that level. */
+static int slab_grow(struct skiplist *list, int level)
+{
+        char *pos, *end;
+        size_t size = skipnode_size(level);
+        struct sk_slab *slab = (struct sk_slab *)SKIPLIST_SLAB_ALLOC(SKIPLIST_SLAB_SIZE);
+        if (slab == NULL) {
+                return -1;
+        }
+
+        slab->level = level;
+        slab->next = list->slabs;
+        list->slabs = slab;
+
+        pos = (char *)slab + ((sizeof(*slab) + sizeof(void *) - 1) & ~(sizeof(void *) - 1));
+        end = (char *)slab + SKIPLIST_SLAB_SIZE;
+        for (; pos + size <= end; pos += size) {
+                struct skipnode *node = (struct skipnode *)pos;
+                node->link[0].next = list->free_list[level - 1];
+                list->free_list[level - 1] = &node->link[0];
+        }
+        return 0;
+}
+
+static struct skipnode *
+skipnode_new(struct skiplist *list, int level, sk_key_t key, sk_value_t value)
 {
         struct skipnode *node;
-        node = malloc(sizeof(*node) + level * sizeof(struct sk_link));
-        if (node != NULL) {
-                node->key = key;
-                node->value = value;
+        struct sk_link *link = list->free_list[level - 1];
+        if (link == NULL) {
+                if (slab_grow(list, level) < 0) {
+                        return NULL;
+                }
+                link = list->free_list[level - 1];
         }
+
+        list->free_list[level - 1] = link->next;
+        skiplist_stat_height(list, level, 1);
+        node = list_entry(link, struct skipnode, link[0]);
+        node->key = key;
+        node->value = value;
         return node;
 }
 
-static void skipnode_delete(struct skipnode *node)
+static void skipnode_delete(struct skiplist *list, struct skipnode *node)
+{
+        int level = slab_of(node)->level;
+        skiplist_stat_height(list, level, -1);
+        node->link[0].next = list->free_list[level - 1];
+        list->free_list[level - 1] = &node->link[0];
+}
+
+#ifdef SKIPLIST_STATS
+struct skiplist_stats {
+        int level;                              /* levels in use */
+        int count;
+        int height[MAX_LEVEL];                /* nodes whose tower is i + 1 high */
+        struct sk_op_stats op[SK_STAT_OPS];
+};
+
+/* Zero the operation counters, the height histogram follows the nodes. */
+static void skiplist_stats_reset(struct skiplist *list)
+{
+        int i, j;
+        for (i = 0; i < SK_STAT_OPS; i++) {
+                list->stats[i].calls = 0;
+                list->stats[i].compares = 0;
+                for (j = 0; j < MAX_LEVEL; j++) {
+                        list->stats[i].hops[j] = 0;
+                }
+        }
+}
+
+/* Snapshot of the counters and the tower heights, O(levels) whatever the
+ * size of the list. */
+static void skiplist_stats(struct skiplist *list, struct skiplist_stats *stats)
 {
-        free(node);
+        int i;
+        stats->level = list->level;
+        stats->count = list->count;
+        for (i = 0; i < MAX_LEVEL; i++) {
+                stats->height[i] = list->height[i];
+        }
+        for (i = 0; i < SK_STAT_OPS; i++) {
+                stats->op[i] = list->stats[i];
+        }
+}
+#else
+#define skiplist_stats_reset(list) do { } while (0)
+#endif
+
+/* Seed the level generator of the list, the same seed and the same
+ * operations build the same towers. */
+static void skiplist_seed(struct skiplist *list, unsigned long long seed)
+{
+        /* splitmix64 spreads small seeds over the whole state */
+        seed += 0x9e3779b97f4a7c15ULL;
+        seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebULL;
+        seed ^= seed >> 31;
+        list->rand = seed != 0 ? seed : 1;
 }
 
 static struct skiplist *skiplist_new(void)
 {
         int i;
-        struct skiplist *list = malloc(sizeof(*list));
+        struct skiplist *list = (struct skiplist *)malloc(sizeof(*list));
         if (list != NULL) {
                 list->level = 1;
                 list->count = 0;
-                for (i = 0; i < sizeof(list->head) / sizeof(list->head[0]); i++) {
+                skiplist_seed(list, 0);
+                list->slabs = NULL;
+                skiplist_stats_reset(list);
+                for (i = 0; i < MAX_LEVEL; i++) {
                         list_init(&list->head[i]);
+                        list->free_list[i] = NULL;
+#ifdef SKIPLIST_STATS
+                        list->height[i] = 0;
+#endif
                 }
         }
         return list;
 }
 
+/* All nodes live in slabs owned by the list, so there is no need to walk them. */
 static void skiplist_delete(struct skiplist *list)
 {
-        struct sk_link *n;
-        struct sk_link *pos = list->head[0].next;
-        skiplist_foreach_safe(pos, n, &list->head[0]) {
-                struct skipnode *node = list_entry(pos, struct skipnode, link[0]);
-                skipnode_delete(node);
+        struct sk_slab *slab, *n;
+        for (slab = list->slabs; slab != NULL; slab = n) {
+                n = slab->next;
+                SKIPLIST_SLAB_FREE(slab);
         }
         free(list);
 }
 
-static int random_level(void)
+/* One xorshift64 draw per node; each SKIPLIST_P_SHIFT trailing zero bits
+ * add a level, up to log_1/p(count) + 1. */
+static int random_level(struct skiplist *list)
 {
-        int level = 1;
-        const double p = 0.25;
-        while ((random() & 0xffff) < 0xffff * p) {
-                level++;
+        int level, cap;
+        unsigned long long x = list->rand;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        list->rand = x;
+
+        level = __builtin_ctzll(x) / SKIPLIST_P_SHIFT + 1;
+        cap = (64 - __builtin_clzll((unsigned long long)list->count + 1)) / SKIPLIST_P_SHIFT + 1;
+        if (cap > MAX_LEVEL) {
+                cap = MAX_LEVEL;
         }
-        return level > MAX_LEVEL ? MAX_LEVEL : level;
+        return level < cap ? level : cap;
 }
 
-static struct skipnode *skiplist_search(struct skiplist *list, int key)
+static struct skipnode *skiplist_search(struct skiplist *list, sk_key_t key)
 {
-        struct skipnode *node;
+        struct skipnode *node = NULL;
         int i = list->level - 1;
         struct sk_link *pos = &list->head[i];
         struct sk_link *end = &list->head[i];
 
+        skiplist_stat_call(list, SK_STAT_SEARCH);
         for (; i >= 0; i--) {
                 pos = pos->next;
                 skiplist_foreach(pos, end) {
+                        skiplist_prefetch_hop(pos, i);
+                        skiplist_stat_hop(list, SK_STAT_SEARCH, i);
                         node = list_entry(pos, struct skipnode, link[i]);
-                        if (node->key >= key) {
+                        if (SKIPLIST_KEY_CMP(node->key, key) >= 0) {
                                 end = &node->link[i];
                                 break;
                         }
                 }
-                if (node->key == key) {
-                        return node;
+                if (node != NULL) {
+                        skiplist_stat_cmp(list, SK_STAT_SEARCH);
+                        if (SKIPLIST_KEY_CMP(node->key, key) == 0) {
+                                return node;
+                        }
                 }
                 pos = end->prev;
                 pos--;
@@ -147,25 +390,95 @@ static struct skipnode *skiplist_search(struct skiplist *list, int key)
         return NULL;
 }
 
+/* Look up n keys at once and store the node or NULL for each in nodes[].
+ * Up to SKIPLIST_GROUP descents are interleaved one hop at a time, and each
+ * hop prefetches the node the same descent will look at next, so that the
+ * memory latency of one lookup overlaps with the work on the others. */
+static void
+skiplist_search_many(struct skiplist *list, const sk_key_t *keys, int n,
+                     struct skipnode **nodes)
+{
+        struct {
+                struct sk_link *pos, *next;
+                int level, index;
+        } group[SKIPLIST_GROUP], *st;
+        struct skipnode *node;
+        int j = 0, active = 0, issued = 0;
+
+        for (; active < SKIPLIST_GROUP && issued < n; active++, issued++) {
+                st = &group[active];
+                st->index = issued;
+                st->level = list->level - 1;
+                st->pos = &list->head[st->level];
+                st->next = st->pos->next;
+                __builtin_prefetch(list_entry(st->next, struct skipnode, link[st->level]));
+        }
+
+        while (active > 0) {
+                st = &group[j];
+                if (st->next != &list->head[st->level]) {
+                        int cmp;
+                        node = list_entry(st->next, struct skipnode, link[st->level]);
+                        cmp = SKIPLIST_KEY_CMP(node->key, keys[st->index]);
+                        if (cmp < 0) {
+                                st->pos = st->next;
+                                st->next = st->pos->next;
+                                goto PREFETCH;
+                        } else if (cmp == 0) {
+                                goto DONE;
+                        }
+                }
+                if (st->level > 0) {
+                        st->pos--;
+                        st->level--;
+                        st->next = st->pos->next;
+                        goto PREFETCH;
+                }
+                node = NULL;
+DONE:
+                nodes[st->index] = node;
+                if (issued < n) {
+                        st->index = issued++;
+                        st->level = list->level - 1;
+                        st->pos = &list->head[st->level];
+                        st->next = st->pos->next;
+                } else {
+                        *st = group[--active];
+                        if (j >= active) {
+                                j = 0;
+                        }
+                        continue;
+                }
+PREFETCH:
+                __builtin_prefetch(st->next);
+                __builtin_prefetch(list_entry(st->next, struct skipnode, link[st->level]));
+                if (++j >= active) {
+                        j = 0;
+                }
+        }
+}
+
 static struct skipnode *
-skiplist_insert(struct skiplist *list, int key, int value)
+skiplist_insert(struct skiplist *list, sk_key_t key, sk_value_t value)
 {
-        int level = random_level();
+        int level = random_level(list);
         if (level > list->level) {
                 list->level = level;
         }
 
-        struct skipnode *node = skipnode_new(level, key, value);
+        struct skipnode *node = skipnode_new(list, level, key, value);
         if (node != NULL) {
                 int i = list->level - 1;
                 struct sk_link *pos = &list->head[i];
                 struct sk_link *end = &list->head[i];
 
+                skiplist_stat_call(list, SK_STAT_INSERT);
                 for (; i >= 0; i--) {
                         pos = pos->next;
                         skiplist_foreach(pos, end) {
                                 struct skipnode *nd = list_entry(pos, struct skipnode, link[i]);
-                                if (nd->key >= key) {
+                                skiplist_stat_hop(list, SK_STAT_INSERT, i);
+                                if (SKIPLIST_KEY_CMP(nd->key, key) >= 0) {
                                         end = &nd->link[i];
                                         break;
                                 }
@@ -183,45 +496,181 @@ skiplist_insert(struct skiplist *list, int key, int value)
         return node;
 }
 
+/* Append pairs already sorted by key behind the tail of the list in one left
+ * to right pass, the last node of every level being head[i].prev. Returns the
+ * number of nodes added, or -1 if the pairs are not sorted or do not go after
+ * the current tail. */
+static int
+skiplist_bulk_load(struct skiplist *list, const struct sk_pair *pairs, int n)
+{
+        int i, j, level;
+        struct skipnode *node;
+
+        if (n > 0 && !list_empty(&list->head[0])) {
+                node = list_entry(list->head[0].prev, struct skipnode, link[0]);
+                if (SKIPLIST_KEY_CMP(node->key, pairs[0].key) > 0) {
+                        return -1;
+                }
+        }
+        for (i = 1; i < n; i++) {
+                if (SKIPLIST_KEY_CMP(pairs[i - 1].key, pairs[i].key) > 0) {
+                        return -1;
+                }
+        }
+
+        for (i = 0; i < n; i++) {
+                level = random_level(list);
+                node = skipnode_new(list, level, pairs[i].key, pairs[i].value);
+                if (node == NULL) {
+                        break;
+                }
+                if (level > list->level) {
+                        list->level = level;
+                }
+                for (j = 0; j < level; j++) {
+                        list_add(&node->link[j], list->head[j].prev);
+                }
+                list->count++;
+        }
+
+        return i;
+}
+
+static int sk_pair_cmp(const void *a, const void *b)
+{
+        return SKIPLIST_KEY_CMP(((const struct sk_pair *)a)->key,
+                                ((const struct sk_pair *)b)->key);
+}
+
+/* Insert an unsorted batch. The pairs are sorted in place and then merged
+ * into the list: the predecessors found for one key are the starting points
+ * for the next, so no level is walked twice. Returns the number of nodes
+ * inserted. */
+static int skiplist_insert_batch(struct skiplist *list, struct sk_pair *pairs, int n)
+{
+        int i, j, level;
+        struct skipnode *node, *nd;
+        struct sk_link *pos, *down, *pred[MAX_LEVEL];
+
+        qsort(pairs, n, sizeof(*pairs), sk_pair_cmp);
+        for (i = 0; i < MAX_LEVEL; i++) {
+                pred[i] = &list->head[i];
+        }
+
+        for (j = 0; j < n; j++) {
+                level = random_level(list);
+                node = skipnode_new(list, level, pairs[j].key, pairs[j].value);
+                if (node == NULL) {
+                        break;
+                }
+                if (level > list->level) {
+                        list->level = level;
+                }
+
+                for (i = list->level - 1; i >= 0; i--) {
+                        /* resume from whichever of the last predecessor on
+                         * this level and the one just found above is further */
+                        pos = pred[i];
+                        if (i < list->level - 1 && pred[i + 1] != &list->head[i + 1]) {
+                                down = pred[i + 1] - 1;
+                                if (pos == &list->head[i] ||
+                                    SKIPLIST_KEY_CMP(list_entry(down, struct skipnode, link[i])->key,
+                                                     list_entry(pos, struct skipnode, link[i])->key) > 0) {
+                                        pos = down;
+                                }
+                        }
+                        for (; pos->next != &list->head[i]; pos = pos->next) {
+                                nd = list_entry(pos->next, struct skipnode, link[i]);
+                                if (SKIPLIST_KEY_CMP(nd->key, pairs[j].key) >= 0) {
+                                        break;
+                                }
+                        }
+                        pred[i] = pos;
+                        if (i < level) {
+                                list_add(&node->link[i], pos);
+                        }
+                }
+                list->count++;
+        }
+
+        return j;
+}
+
+/* Unlink a whole tower. Each level is doubly linked, so the links of the node
+ * itself are all it takes. */
 static void __remove(struct skiplist *list, struct skipnode *node, int level)
 {
         int i;
         for (i = 0; i < level; i++) {
-                list_del(&node->link[i]);
-                if (list_empty(&list->head[i])) {
-                        list->level--;
-                }
+                __list_del(node->link[i].prev, node->link[i].next);
         }
-        skipnode_delete(node);
+        skipnode_delete(list, node);
         list->count--;
 }
 
-static void skiplist_remove(struct skiplist *list, int key)
+/* Remove the nodes with the key, all of them or just the first one met, in
+ * a single descent. The nodes with the key follow each other on every level
+ * and each is met first at the top of its tower, where it goes as a whole,
+ * so none is seen twice. The levels left empty at the top are dropped after.
+ * Returns how many nodes were removed. */
+static int __remove_key(struct skiplist *list, sk_key_t key, int all)
 {
-        struct sk_link *n;
+        int cmp, removed = 0;
         struct skipnode *node;
         int i = list->level - 1;
-        struct sk_link *pos = &list->head[i];
+        struct sk_link *n, *pos = &list->head[i];
         struct sk_link *end = &list->head[i];
 
+        skiplist_stat_call(list, SK_STAT_REMOVE);
         for (; i >= 0; i--) {
                 pos = pos->next;
                 skiplist_foreach_safe(pos, n, end) {
+                        skiplist_stat_hop(list, SK_STAT_REMOVE, i);
                         node = list_entry(pos, struct skipnode, link[i]);
-                        if (node->key > key) {
+                        cmp = SKIPLIST_KEY_CMP(node->key, key);
+                        if (cmp > 0) {
                                 end = &node->link[i];
                                 break;
-                        } else if (node->key == key) {
-                                /* we allow nodes with same key. */
+                        } else if (cmp == 0) {
                                 __remove(list, node, i + 1);
+                                removed++;
+                                if (!all) {
+                                        goto OUT;
+                                }
                         }
                 }
                 pos = end->prev;
                 pos--;
                 end--;
         }
+
+OUT:
+        while (list->level > 1 && list_empty(&list->head[list->level - 1])) {
+                list->level--;
+        }
+        return removed;
+}
+
+/* Remove one node with the key, the tallest one. Returns 1 if there was one,
+ * 0 otherwise. */
+static int skiplist_remove_one(struct skiplist *list, sk_key_t key)
+{
+        return __remove_key(list, key, 0);
+}
+
+/* Remove every node with the key, returns how many there were. */
+static int skiplist_remove_all(struct skiplist *list, sk_key_t key)
+{
+        return __remove_key(list, key, 1);
+}
+
+/* We allow nodes with the same key, and all of them go. */
+static int skiplist_remove(struct skiplist *list, sk_key_t key)
+{
+        return __remove_key(list, key, 1);
 }
 
+#if defined(SKIPLIST_KEY_FMT) && defined(SKIPLIST_VALUE_FMT)
 static void skiplist_dump(struct skiplist *list)
 {
         struct skipnode *node;
@@ -235,12 +684,46 @@ static void skiplist_dump(struct skiplist *list)
                 printf("level %d:\n", i + 1);
                 skiplist_foreach(pos, end) {
                         node = list_entry(pos, struct skipnode, link[i]);
-                        printf("key:0x%08x value:0x%08x\n", node->key, node->value);
+                        printf("key:" SKIPLIST_KEY_FMT " value:" SKIPLIST_VALUE_FMT "\n",
+                                SKIPLIST_KEY_ARG(node->key), SKIPLIST_VALUE_ARG(node->value));
                 }
                 pos = &list->head[i];
                 pos--;
                 end--;
         }
 }
+#endif
+
+#ifdef SKIPLIST_STATS
+/* Print a snapshot: the tower heights next to the counts the promotion
+ * probability leads to expect, then per operation the compares and the nodes
+ * visited on each level, top down, per call. */
+static void skiplist_stats_dump(const struct skiplist_stats *stats)
+{
+        static const char *name[SK_STAT_OPS] = { "search", "insert", "remove" };
+        int i, j;
+        const struct sk_op_stats *op;
+        double expect = stats->count * (1.0 - 1.0 / (1 << SKIPLIST_P_SHIFT));
+
+        printf("\nTotal %d nodes, %d levels\n", stats->count, stats->level);
+        printf("height    nodes  expected\n");
+        for (i = 0; i < stats->level; i++) {
+                printf("%6d %8lld %9.0f\n", i + 1, (long long)stats->height[i], expect);
+                expect /= 1 << SKIPLIST_P_SHIFT;
+        }
+        for (j = 0; j < SK_STAT_OPS; j++) {
+                op = &stats->op[j];
+                if (op->calls == 0) {
+                        continue;
+                }
+                printf("%s: %llu calls, %.1f compares per call, hops per call:",
+                       name[j], op->calls, (double)op->compares / op->calls);
+                for (i = stats->level - 1; i >= 0; i--) {
+                        printf(" %.2f", (double)op->hops[i] / op->calls);
+                }
+                printf("\n");
+        }
+}
+#endif
 
 #endif  /* _SKIPLIST_H */
@@ -0,0 +1,530 @@
+/*
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ */
+
+#ifndef _SKIPLIST_ARENA_H
+#define _SKIPLIST_ARENA_H
+
+/*
+ * Index-linked skiplist with ranks, all nodes in one contiguous arena.
+ *
+ * A node is named by its offset in the arena counted in 4 byte words, its
+ * ref, so next, prev and span are all 32 bits and a link takes 12 bytes
+ * instead of the 24 of skiplist_with_rank.h. An arena holds up to 2^32 words,
+ * that is 16GiB, and 2^32 - 1 nodes.
+ *
+ *      header | head tower | node | node | ...
+ *
+ * The arena starts with the list header and the head tower, whose ref is
+ * AR_HEAD, and holds no pointers, so it is its own on-disk image:
+ * ar_skiplist_save() writes the used words out as they are and
+ * ar_skiplist_load() reads them back in one go, with nothing to relink.
+ *
+ * The arena grows by realloc() and may move on an insert, so the lookups
+ * copy keys and values out rather than handing nodes back, and a pointer
+ * from ar_node() is only good until the next insert.
+ * The names do not clash with skiplist.h or skiplist_with_rank.h, so both
+ * can be used side by side.
+ */
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#ifndef MAX_LEVEL
+#define MAX_LEVEL 32  /* Should be enough for 2^32 elements */
+#endif
+
+#ifndef SKIPLIST_KEY_TYPE
+#define SKIPLIST_KEY_TYPE int
+#endif
+
+#ifndef SKIPLIST_VALUE_TYPE
+#define SKIPLIST_VALUE_TYPE int
+#endif
+
+#ifndef SKIPLIST_KEY_CMP
+#define SKIPLIST_KEY_CMP(a, b) (((a) > (b)) - ((a) < (b)))
+#endif
+
+#ifndef SKIPLIST_P_SHIFT
+#define SKIPLIST_P_SHIFT 2  /* promotion probability p = 1/2^SKIPLIST_P_SHIFT: 1, 2 or 3 */
+#endif
+
+#ifndef AR_ARENA_MIN
+#define AR_ARENA_MIN 4096  /* words of a new arena */
+#endif
+
+#define AR_FILE_MAGIC "SKIPARNA"
+#define AR_FILE_VERSION 1
+#define AR_FILE_ORDER 0x01020304U
+
+typedef SKIPLIST_KEY_TYPE ar_key_t;
+typedef SKIPLIST_VALUE_TYPE ar_value_t;
+typedef unsigned int ar_ref_t;  /* 0 is no node, the header lives there */
+
+struct ar_link {
+        ar_ref_t next;
+        ar_ref_t prev;
+        unsigned int span;              /* level 0 steps from prev, not kept on the head */
+};
+
+struct ar_node {
+        unsigned int level;             /* first, where it packs with a small key */
+        ar_key_t key;
+        ar_value_t value;
+        struct ar_link link[0];
+};
+
+/* The first bytes of the arena, and of the image */
+struct ar_header {
+        char magic[8];
+        unsigned long long rand;        /* level generator state */
+        unsigned int version;
+        unsigned int order;             /* AR_FILE_ORDER as written */
+        unsigned int key_size;
+        unsigned int value_size;
+        unsigned int max_level;         /* links of the head tower */
+        unsigned int level;
+        unsigned int count;
+        unsigned int used;              /* words in use, free nodes included */
+        ar_ref_t free_list[MAX_LEVEL];
+};
+
+struct ar_skiplist {
+        struct ar_header *arena;
+        unsigned long long cap;         /* words allocated */
+};
+
+/* Nodes start at multiples of their alignment, which is at least a word. */
+#define AR_ALIGN __alignof__(struct ar_node)
+#define AR_WORDS(size) (((size) + AR_ALIGN - 1) / AR_ALIGN * AR_ALIGN / sizeof(ar_ref_t))
+#define AR_HEAD ((ar_ref_t)AR_WORDS(sizeof(struct ar_header)))
+
+#define ar_node(list, ref) ((struct ar_node *)((ar_ref_t *)(list)->arena + (ref)))
+#define ar_link(list, ref, i) (&ar_node(list, ref)->link[i])
+
+static inline ar_ref_t ar_node_words(int level)
+{
+        return AR_WORDS(sizeof(struct ar_node) + level * sizeof(struct ar_link));
+}
+
+/* Make room for words more, doubling the arena. The refs stay valid, the
+ * pointers into it do not. */
+static int ar_arena_grow(struct ar_skiplist *list, ar_ref_t words)
+{
+        void *arena;
+        unsigned long long cap = list->cap;
+        unsigned long long need = (unsigned long long)list->arena->used + words;
+
+        if (need > 0xffffffffULL) {
+                return -1;
+        }
+        while (cap < need) {
+                cap *= 2;
+        }
+        if (cap > 0xffffffffULL) {
+                cap = 0xffffffffULL;
+        }
+        arena = realloc(list->arena, cap * sizeof(ar_ref_t));
+        if (arena == NULL) {
+                return -1;
+        }
+        list->arena = (struct ar_header *)arena;
+        list->cap = cap;
+        return 0;
+}
+
+/* A node of the given level from the free list of that level, or from the
+ * end of the arena. Returns its ref, or 0 if the arena can not grow. */
+static ar_ref_t
+ar_node_new(struct ar_skiplist *list, int level, ar_key_t key, ar_value_t value)
+{
+        struct ar_node *node;
+        ar_ref_t ref = list->arena->free_list[level - 1];
+        ar_ref_t words = ar_node_words(level);
+
+        if (ref != 0) {
+                list->arena->free_list[level - 1] = ar_link(list, ref, 0)->next;
+        } else {
+                if (list->arena->used + (unsigned long long)words > list->cap &&
+                    ar_arena_grow(list, words) < 0) {
+                        return 0;
+                }
+                ref = list->arena->used;
+                list->arena->used += words;
+        }
+        node = ar_node(list, ref);
+        node->key = key;
+        node->value = value;
+        node->level = level;
+        return ref;
+}
+
+static void ar_node_delete(struct ar_skiplist *list, ar_ref_t ref)
+{
+        struct ar_node *node = ar_node(list, ref);
+        node->link[0].next = list->arena->free_list[node->level - 1];
+        list->arena->free_list[node->level - 1] = ref;
+}
+
+/* Seed the level generator of the list, the same seed and the same
+ * operations build the same towers. */
+static void ar_skiplist_seed(struct ar_skiplist *list, unsigned long long seed)
+{
+        /* splitmix64 spreads small seeds over the whole state */
+        seed += 0x9e3779b97f4a7c15ULL;
+        seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebULL;
+        seed ^= seed >> 31;
+        list->arena->rand = seed != 0 ? seed : 1;
+}
+
+static struct ar_skiplist *ar_skiplist_new(void)
+{
+        int i;
+        struct ar_node *head;
+        struct ar_header *hdr;
+        struct ar_skiplist *list = (struct ar_skiplist *)malloc(sizeof(*list));
+        if (list == NULL) {
+                return NULL;
+        }
+
+        list->cap = AR_ARENA_MIN;
+        while (list->cap < AR_HEAD + ar_node_words(MAX_LEVEL)) {
+                list->cap *= 2;
+        }
+        list->arena = (struct ar_header *)malloc(list->cap * sizeof(ar_ref_t));
+        if (list->arena == NULL) {
+                free(list);
+                return NULL;
+        }
+
+        /* zeroed as a whole, so the image has no stray bytes in the padding */
+        hdr = list->arena;
+        memset(hdr, 0, (AR_HEAD + ar_node_words(MAX_LEVEL)) * sizeof(ar_ref_t));
+        memcpy(hdr->magic, AR_FILE_MAGIC, sizeof(hdr->magic));
+        hdr->version = AR_FILE_VERSION;
+        hdr->order = AR_FILE_ORDER;
+        hdr->key_size = sizeof(ar_key_t);
+        hdr->value_size = sizeof(ar_value_t);
+        hdr->max_level = MAX_LEVEL;
+        hdr->level = 1;
+        hdr->count = 0;
+        hdr->used = AR_HEAD + ar_node_words(MAX_LEVEL);
+        ar_skiplist_seed(list, 0);
+
+        head = ar_node(list, AR_HEAD);
+        head->level = MAX_LEVEL;
+        for (i = 0; i < MAX_LEVEL; i++) {
+                head->link[i].next = AR_HEAD;
+                head->link[i].prev = AR_HEAD;
+        }
+        return list;
+}
+
+static void ar_skiplist_delete(struct ar_skiplist *list)
+{
+        free(list->arena);
+        free(list);
+}
+
+/* Bytes of the arena in use, header and free nodes included. */
+static inline size_t ar_skiplist_memory(struct ar_skiplist *list)
+{
+        return (size_t)list->arena->used * sizeof(ar_ref_t);
+}
+
+/* random_level() of skiplist_with_rank.h, on the state kept in the arena. */
+static int ar_random_level(struct ar_skiplist *list)
+{
+        int level, cap;
+        unsigned long long x = list->arena->rand;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        list->arena->rand = x;
+
+        level = __builtin_ctzll(x) / SKIPLIST_P_SHIFT + 1;
+        cap = (64 - __builtin_clzll((unsigned long long)list->arena->count + 1)) / SKIPLIST_P_SHIFT + 1;
+        if (cap > MAX_LEVEL) {
+                cap = MAX_LEVEL;
+        }
+        return level < cap ? level : cap;
+}
+
+/* Returns 0, or -1 if the list is full or the arena can not grow. */
+static int ar_skiplist_insert(struct ar_skiplist *list, ar_key_t key, ar_value_t value)
+{
+        int i, level;
+        unsigned int span, rank[MAX_LEVEL];
+        ar_ref_t ref, pos, end, next, update[MAX_LEVEL];
+        struct ar_node *node, *nd;
+
+        if (list->arena->count == 0xffffffffU) {
+                return -1;
+        }
+        /* allocate before the descent, the arena may move */
+        level = ar_random_level(list);
+        ref = ar_node_new(list, level, key, value);
+        if (ref == 0) {
+                return -1;
+        }
+        if (level > (int)list->arena->level) {
+                list->arena->level = level;
+        }
+
+        pos = end = AR_HEAD;
+        for (i = list->arena->level - 1; i >= 0; i--) {
+                rank[i] = i == (int)list->arena->level - 1 ? 0 : rank[i + 1];
+                for (; (next = ar_link(list, pos, i)->next) != end; pos = next) {
+                        nd = ar_node(list, next);
+                        if (SKIPLIST_KEY_CMP(nd->key, key) >= 0) {
+                                end = next;
+                                break;
+                        }
+                        rank[i] += nd->link[i].span;
+                }
+                update[i] = pos;
+        }
+
+        node = ar_node(list, ref);
+        for (i = 0; i < (int)list->arena->level; i++) {
+                next = ar_link(list, update[i], i)->next;
+                if (i < level) {
+                        span = rank[0] - rank[i] + 1;
+                        node->link[i].next = next;
+                        node->link[i].prev = update[i];
+                        node->link[i].span = span;
+                        ar_link(list, next, i)->prev = ref;
+                        ar_link(list, next, i)->span -= span - 1;
+                        ar_link(list, update[i], i)->next = ref;
+                } else {
+                        ar_link(list, next, i)->span++;
+                }
+        }
+
+        list->arena->count++;
+        return 0;
+}
+
+/* Remove the first node with key, returns 0, or -1 if there is none. */
+static int ar_skiplist_remove(struct ar_skiplist *list, ar_key_t key)
+{
+        int i;
+        ar_ref_t ref, pos = AR_HEAD, end = AR_HEAD, next, update[MAX_LEVEL];
+        struct ar_header *hdr = list->arena;
+        struct ar_node *node;
+
+        for (i = hdr->level - 1; i >= 0; i--) {
+                for (; (next = ar_link(list, pos, i)->next) != end; pos = next) {
+                        if (SKIPLIST_KEY_CMP(ar_node(list, next)->key, key) >= 0) {
+                                end = next;
+                                break;
+                        }
+                }
+                update[i] = pos;
+        }
+
+        ref = ar_link(list, pos, 0)->next;
+        node = ar_node(list, ref);
+        if (ref == AR_HEAD || SKIPLIST_KEY_CMP(node->key, key) != 0) {
+                return -1;
+        }
+
+        for (i = 0; i < (int)hdr->level; i++) {
+                next = ar_link(list, update[i], i)->next;
+                if (next == ref) {
+                        next = node->link[i].next;
+                        ar_link(list, update[i], i)->next = next;
+                        ar_link(list, next, i)->prev = update[i];
+                        ar_link(list, next, i)->span += node->link[i].span - 1;
+                } else {
+                        ar_link(list, next, i)->span--;
+                }
+        }
+        while (hdr->level > 1 && ar_link(list, AR_HEAD, hdr->level - 1)->next == AR_HEAD) {
+                hdr->level--;
+        }
+
+        ar_node_delete(list, ref);
+        hdr->count--;
+        return 0;
+}
+
+/* Copy the value of key into value, returns 0, or -1 if it is not there. */
+static int ar_skiplist_search(struct ar_skiplist *list, ar_key_t key, ar_value_t *value)
+{
+        int i, cmp;
+        ar_ref_t pos = AR_HEAD, end = AR_HEAD, next;
+        struct ar_node *node;
+
+        for (i = list->arena->level - 1; i >= 0; i--) {
+                for (; (next = ar_link(list, pos, i)->next) != end; pos = next) {
+                        node = ar_node(list, next);
+                        cmp = SKIPLIST_KEY_CMP(node->key, key);
+                        if (cmp == 0) {
+                                *value = node->value;
+                                return 0;
+                        }
+                        if (cmp > 0) {
+                                end = next;
+                                break;
+                        }
+                }
+        }
+        return -1;
+}
+
+/* Rank of the first node with key counted from 1, or 0 if there is none. */
+static unsigned int ar_skiplist_key_rank(struct ar_skiplist *list, ar_key_t key)
+{
+        int i;
+        unsigned int rank = 0;
+        ar_ref_t pos = AR_HEAD, end = AR_HEAD, next;
+        struct ar_node *node;
+
+        for (i = list->arena->level - 1; i >= 0; i--) {
+                for (; (next = ar_link(list, pos, i)->next) != end; pos = next) {
+                        node = ar_node(list, next);
+                        if (SKIPLIST_KEY_CMP(node->key, key) >= 0) {
+                                end = next;
+                                break;
+                        }
+                        rank += node->link[i].span;
+                }
+        }
+        if (end == AR_HEAD || SKIPLIST_KEY_CMP(ar_node(list, end)->key, key) != 0) {
+                return 0;
+        }
+        return rank + 1;
+}
+
+/* Copy the pair of rank (from 1) out, returns 0, or -1 if it is out of range. */
+static int
+ar_skiplist_search_by_rank(struct ar_skiplist *list, unsigned int rank, ar_key_t *key, ar_value_t *value)
+{
+        int i;
+        unsigned int traversed = 0;
+        ar_ref_t pos = AR_HEAD, end = AR_HEAD, next;
+        struct ar_node *node;
+
+        if (rank == 0 || rank > list->arena->count) {
+                return -1;
+        }
+        for (i = list->arena->level - 1; i >= 0; i--) {
+                for (; (next = ar_link(list, pos, i)->next) != end; pos = next) {
+                        node = ar_node(list, next);
+                        if (traversed + node->link[i].span > rank) {
+                                end = next;
+                                break;
+                        }
+                        traversed += node->link[i].span;
+                        if (traversed == rank) {
+                                *key = node->key;
+                                *value = node->value;
+                                return 0;
+                        }
+                }
+        }
+        return -1;
+}
+
+/* Sync the directory holding path, so a rename into it survives a crash.
+ * Mirrors sk_file_sync_dir() of skiplist_file.h. */
+static int ar_sync_dir(const char *path)
+{
+        int fd, ret;
+        char dir[4096];
+        const char *slash = strrchr(path, '/');
+        size_t len = slash == NULL ? 1 : slash == path ? 1 : (size_t)(slash - path);
+
+        if (len >= sizeof(dir)) {
+                return -1;
+        }
+        memcpy(dir, slash == NULL ? "." : path, len);
+        dir[len] = '\0';
+        fd = open(dir, O_RDONLY | O_DIRECTORY);
+        if (fd < 0) {
+                return -1;
+        }
+        ret = fsync(fd);
+        close(fd);
+        return ret;
+}
+
+/* Write the arena to path as it is. Like skiplist_save() of skiplist_file.h
+ * the image goes under a temporary name, is renamed over path once synced,
+ * and the directory is synced after the rename. Returns 0, or -1 on an I/O
+ * error. */
+static int ar_skiplist_save(struct ar_skiplist *list, const char *path)
+{
+        int ret = -1;
+        char tmp[4096];
+        FILE *fp;
+
+        if ((size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= sizeof(tmp)) {
+                return -1;
+        }
+        fp = fopen(tmp, "wb");
+        if (fp == NULL) {
+                return -1;
+        }
+        if (fwrite(list->arena, sizeof(ar_ref_t), list->arena->used, fp) == list->arena->used &&
+            fflush(fp) == 0 && fsync(fileno(fp)) == 0) {
+                ret = 0;
+        }
+        if (fclose(fp) != 0) {
+                ret = -1;
+        }
+        if (ret == 0 && (rename(tmp, path) < 0 || ar_sync_dir(path) < 0)) {
+                ret = -1;
+        }
+        if (ret < 0) {
+                unlink(tmp);
+        }
+        return ret;
+}
+
+/* Read an image written by ar_skiplist_save() back as the arena of a new
+ * list. The header is checked against this build and the file size; the
+ * links are trusted, there is no checksum. Returns NULL if the file can not
+ * be read or is not a valid image. */
+static struct ar_skiplist *ar_skiplist_load(const char *path)
+{
+        struct stat st;
+        struct ar_header hdr;
+        struct ar_skiplist *list = NULL;
+        FILE *fp = fopen(path, "rb");
+        if (fp == NULL) {
+                return NULL;
+        }
+
+        if (fread(&hdr, sizeof(hdr), 1, fp) != 1 || fstat(fileno(fp), &st) < 0 ||
+            memcmp(hdr.magic, AR_FILE_MAGIC, sizeof(hdr.magic)) != 0 ||
+            hdr.version != AR_FILE_VERSION || hdr.order != AR_FILE_ORDER ||
+            hdr.key_size != sizeof(ar_key_t) || hdr.value_size != sizeof(ar_value_t) ||
+            hdr.max_level != MAX_LEVEL || hdr.level < 1 || hdr.level > MAX_LEVEL ||
+            hdr.used < AR_HEAD + ar_node_words(MAX_LEVEL) ||
+            (unsigned long long)st.st_size != (unsigned long long)hdr.used * sizeof(ar_ref_t)) {
+                goto out;
+        }
+
+        list = (struct ar_skiplist *)malloc(sizeof(*list));
+        if (list == NULL) {
+                goto out;
+        }
+        list->cap = hdr.used;
+        list->arena = (struct ar_header *)malloc(list->cap * sizeof(ar_ref_t));
+        if (list->arena == NULL || fseek(fp, 0, SEEK_SET) < 0 ||
+            fread(list->arena, sizeof(ar_ref_t), hdr.used, fp) != hdr.used) {
+                free(list->arena);
+                free(list);
+                list = NULL;
+        }
+out:
+        fclose(fp);
+        return list;
+}
+
+#endif  /* _SKIPLIST_ARENA_H */
@@ -0,0 +1,222 @@
+/*
+* Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "skiplist_with_rank.h"
+#include "skiplist_arena.h"
+
+#define N 1024 * 1024
+#define IMAGE "skiplist_arena_test.img"
+
+/* Every link must be the prev of its next, every span must equal the rank
+ * distance to the previous node on its level, and no level above the list
+ * level may hold nodes. */
+static int check_links(struct ar_skiplist *list)
+{
+    int i;
+    unsigned int rank = 0, last[MAX_LEVEL];
+    ar_ref_t ref, pred[MAX_LEVEL];
+    struct ar_node *node;
+
+    for (i = 0; i < MAX_LEVEL; i++) {
+        pred[i] = AR_HEAD;
+        last[i] = 0;
+    }
+    for (ref = ar_link(list, AR_HEAD, 0)->next; ref != AR_HEAD; ref = node->link[0].next) {
+        node = ar_node(list, ref);
+        rank++;
+        for (i = 0; i < (int)node->level; i++) {
+            if (node->link[i].span != rank - last[i] || node->link[i].prev != pred[i] ||
+                ar_link(list, pred[i], i)->next != ref) {
+                printf("Bad link at rank %u level %d\n", rank, i);
+                return 0;
+            }
+            pred[i] = ref;
+            last[i] = rank;
+        }
+    }
+    if (rank != list->arena->count) {
+        printf("Count %u but %u nodes\n", list->arena->count, rank);
+        return 0;
+    }
+    for (i = 0; i < MAX_LEVEL; i++) {
+        if (ar_link(list, AR_HEAD, i)->prev != pred[i] ||
+            (i >= (int)list->arena->level && pred[i] != AR_HEAD)) {
+            printf("Bad head link at level %d\n", i);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static size_t skiplist_memory(struct skiplist *list)
+{
+    size_t bytes = sizeof(*list);
+    struct sk_slab *slab;
+    for (slab = list->slabs; slab != NULL; slab = slab->next) {
+        bytes += SKIPLIST_SLAB_SIZE;
+    }
+    return bytes;
+}
+
+static long ms(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec)*1000 + (end->tv_nsec - start->tv_nsec)/1000000;
+}
+
+int
+main(void)
+{
+    int i;
+    unsigned int r;
+    ar_key_t k, last;
+    ar_value_t v;
+    struct timespec start, end;
+
+    int *key = (int *)malloc(N * sizeof(int));
+    if (key == NULL) {
+        exit(-1);
+    }
+
+    struct skiplist *ptr = skiplist_new();
+    struct ar_skiplist *list = ar_skiplist_new();
+    if (ptr == NULL || list == NULL) {
+        exit(-1);
+    }
+
+    unsigned int seed = getenv("SKIPLIST_SEED") ? (unsigned int)strtoul(getenv("SKIPLIST_SEED"), NULL, 0)
+                                              : (unsigned int)time(NULL);
+    srandom(seed);
+    skiplist_seed(ptr, seed);
+    ar_skiplist_seed(list, seed);
+    for (i = 0; i < N; i++) {
+        key[i] = (int)random();
+    }
+
+    printf("Test start! seed:%u\n", seed);
+    printf("Add %d nodes...\n", N);
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i++) {
+        skiplist_insert(ptr, key[i], key[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("pointers: %ldms, %d-byte links, %.1f bytes per node\n", ms(&start, &end),
+           (int)sizeof(struct sk_link), (double)skiplist_memory(ptr) / (N));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i++) {
+        if (ar_skiplist_insert(list, key[i], key[i]) < 0) {
+            printf("Insert failed at %d\n", i);
+            exit(-1);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("arena:    %ldms, %d-byte links, %.1f bytes per node, %u levels\n", ms(&start, &end),
+           (int)sizeof(struct ar_link), (double)ar_skiplist_memory(list) / (N), list->arena->level);
+    if (!check_links(list)) {
+        printf("Links broken by insert\n");
+    }
+
+    printf("Now search each node by key...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i++) {
+        if (skiplist_search_by_key(ptr, key[i]) == NULL) {
+            printf("Not found:0x%08x\n", key[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("pointers: %ldms\n", ms(&start, &end));
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i++) {
+        if (ar_skiplist_search(list, key[i], &v) < 0 || v != key[i]) {
+            printf("Not found:0x%08x\n", key[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("arena:    %ldms\n", ms(&start, &end));
+
+    printf("Now search each node by rank...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (r = 1, last = 0; r <= N; r++) {
+        if (ar_skiplist_search_by_rank(list, r, &k, &v) < 0 || (r > 1 && k < last) ||
+            ((r == 1 || k != last) && ar_skiplist_key_rank(list, k) != r)) {
+            printf("Bad rank %u\n", r);
+            break;
+        }
+        last = k;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", ms(&start, &end));
+    if (ar_skiplist_search_by_rank(list, 0, &k, &v) == 0 ||
+        ar_skiplist_search_by_rank(list, N + 1, &k, &v) == 0) {
+        printf("Rank out of range found\n");
+    }
+
+    /* The arena is the image, the loaded list must match it word for word */
+    printf("Now save the arena and load it back...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (ar_skiplist_save(list, IMAGE) < 0) {
+        printf("Save failed\n");
+        exit(-1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("save: %ldms, ", ms(&start, &end));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct ar_skiplist *copy = ar_skiplist_load(IMAGE);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("load: %ldms\n", ms(&start, &end));
+    unlink(IMAGE);
+    if (copy == NULL || memcmp(copy->arena, list->arena, ar_skiplist_memory(list)) != 0) {
+        printf("Loaded arena differs\n");
+        exit(-1);
+    }
+    for (i = 0; i < N; i++) {
+        if (ar_skiplist_search(copy, key[i], &v) < 0 || v != key[i]) {
+            printf("Not found in the copy:0x%08x\n", key[i]);
+        }
+    }
+    /* the copy goes on growing from where the saved list stopped */
+    ar_skiplist_insert(copy, -1, -1);
+    if (ar_skiplist_key_rank(copy, -1) != 1 || !check_links(copy)) {
+        printf("Copy broken by insert\n");
+    }
+    ar_skiplist_delete(copy);
+
+    printf("Now remove all nodes...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i++) {
+        if (ar_skiplist_remove(list, key[i]) < 0) {
+            printf("Not removed:0x%08x\n", key[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", ms(&start, &end));
+    if (list->arena->count != 0 || list->arena->level != 1 || !check_links(list)) {
+        printf("%u nodes and %u levels left\n", list->arena->count, list->arena->level);
+    }
+
+    /* the same seed draws the same towers again, all from the free lists */
+    size_t size = ar_skiplist_memory(list);
+    ar_skiplist_seed(list, seed);
+    for (i = 0; i < N / 2; i++) {
+        ar_skiplist_insert(list, key[i], key[i]);
+    }
+    if (ar_skiplist_memory(list) > size || !check_links(list)) {
+        printf("Arena grew from %zu to %zu bytes on reinsert\n", size, ar_skiplist_memory(list));
+    }
+
+    printf("End of Test.\n");
+    ar_skiplist_delete(list);
+    skiplist_delete(ptr);
+
+    free(key);
+
+    return 0;
+}
@@ -0,0 +1,504 @@
+/*
+* Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+*/
+
+/*
+ * Benchmark driver for skiplist_with_rank.h, with std::map as the baseline.
+ *
+ *   g++ -O2 -std=c++11 -o skiplist_bench skiplist_bench.cc
+ *   ./skiplist_bench [-n size] [-o ops] [-w workload,...] [-f text|csv|json] [-s seed] [-m]
+ *
+ * The keys are size distinct even ints, so odd keys are never present. Each
+ * workload is run once untimed on a tenth of its operations as a warmup,
+ * then timed: ns/op is the wall time over all operations, and one operation
+ * in LATENCY_SAMPLE is also timed on its own for the percentiles. RSS is the
+ * growth of the resident set while the random order insert builds the
+ * structure that the read workloads then run against. -m leaves the
+ * std::map baseline out.
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "skiplist_with_rank.h"
+
+#define DEFAULT_SIZE 1000000
+#define LATENCY_SAMPLE 8
+#define SCAN_LENGTH 100
+#define REMOVE_BLOCK 1000
+#define ZIPF_THETA 0.99
+
+static const char *all_workloads[] = {
+    "insert_seq", "insert_rev", "insert_rand", "search_uniform", "search_zipf",
+    "mixed_90_10", "mixed_50_50", "range_scan", "rank", "remove_range",
+};
+
+struct result {
+    std::string structure, workload;
+    long size, ops;
+    double ns_per_op, p50, p99, p999, rss_mb;
+};
+
+static volatile long sink;  /* keeps the lookups from being optimized out */
+
+static long long now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/* Cost of the two now_ns() calls around a sampled operation, measured once
+ * and taken out of the total so the sampling does not inflate ns/op. */
+static double clock_pair_ns(void)
+{
+    static double cost = -1;
+    if (cost < 0) {
+        const int calls = 10000;
+        long long start = now_ns();
+        for (int i = 0; i < calls; i++) {
+            now_ns();
+        }
+        cost = 2.0 * (now_ns() - start) / calls;
+    }
+    return cost;
+}
+
+/* Resident set in MB, from /proc on Linux, 0 elsewhere. */
+static double rss_mb(void)
+{
+    long pages = 0;
+    FILE *fp = fopen("/proc/self/statm", "r");
+    if (fp != NULL) {
+        if (fscanf(fp, "%*s %ld", &pages) != 1) {
+            pages = 0;
+        }
+        fclose(fp);
+    }
+    return pages * (double)sysconf(_SC_PAGESIZE) / (1024 * 1024);
+}
+
+static unsigned long long next_rand(unsigned long long *x)
+{
+    *x ^= *x << 13;
+    *x ^= *x >> 7;
+    *x ^= *x << 17;
+    return *x;
+}
+
+/* Zipfian ranks over [0, n) after Gray et al., "Quickly generating
+ * billion-record synthetic databases", as YCSB does it. */
+struct zipf {
+    long n;
+    double theta, alpha, zetan, eta;
+};
+
+static void zipf_init(struct zipf *z, long n, double theta)
+{
+    long i;
+    double zeta2 = 1 + 1 / pow(2, theta);
+    z->n = n;
+    z->theta = theta;
+    z->zetan = 0;
+    for (i = 1; i <= n; i++) {
+        z->zetan += 1 / pow((double)i, theta);
+    }
+    z->alpha = 1 / (1 - theta);
+    z->eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / z->zetan);
+}
+
+static long zipf_next(struct zipf *z, unsigned long long *x)
+{
+    double u = (next_rand(x) >> 11) * (1.0 / 9007199254740992.0);
+    double uz = u * z->zetan;
+    long r;
+    if (uz < 1) {
+        return 0;
+    }
+    if (uz < 1 + pow(0.5, z->theta)) {
+        return 1;
+    }
+    r = (long)(z->n * pow(z->eta * u - z->eta + 1, z->alpha));
+    return r < z->n ? r : z->n - 1;
+}
+
+/* The structures under test behind one interface. */
+struct skiplist_adapter {
+    struct skiplist *list;
+
+    static const char *name() { return "skiplist"; }
+    static bool has_rank() { return true; }
+    skiplist_adapter() : list(skiplist_new()) { }
+    ~skiplist_adapter() { skiplist_delete(list); }
+    void insert(int key) { skiplist_insert(list, key, key); }
+    void erase(int key) { skiplist_remove(list, key); }
+    long find(int key)
+    {
+        struct skipnode *node = skiplist_search_by_key(list, key);
+        return node != NULL ? node->value : 0;
+    }
+    long scan(int key, int n)
+    {
+        long sum = 0;
+        struct sk_pair page[SCAN_LENGTH];
+        struct range_iter it;
+        struct range_spec range;
+        range.min = key;
+        range.max = 0x7fffffff;
+        range.minex = range.maxex = 0;
+        range_iter_init(&it, list, &range, 0, n, 0);
+        for (int i = range_iter_next(&it, page, n); i > 0; i--) {
+            sum += page[i - 1].value;
+        }
+        return sum;
+    }
+    long rank(int key, long r)
+    {
+        struct skipnode *node = skiplist_search_by_rank(list, r);
+        return skiplist_key_rank(list, key) + (node != NULL ? node->value : 0);
+    }
+    long remove_range(int min, int max)
+    {
+        struct range_spec range;
+        range.min = min;
+        range.max = max;
+        range.minex = range.maxex = 0;
+        return remove_in_range(list, &range);
+    }
+};
+
+struct map_adapter {
+    std::map<int, int> map;
+
+    static const char *name() { return "std::map"; }
+    static bool has_rank() { return false; }
+    void insert(int key) { map.insert(std::make_pair(key, key)); }
+    void erase(int key) { map.erase(key); }
+    long find(int key)
+    {
+        std::map<int, int>::iterator it = map.find(key);
+        return it != map.end() ? it->second : 0;
+    }
+    long scan(int key, int n)
+    {
+        long sum = 0;
+        std::map<int, int>::iterator it = map.lower_bound(key);
+        for (; n > 0 && it != map.end(); n--, ++it) {
+            sum += it->second;
+        }
+        return sum;
+    }
+    long rank(int, long) { return 0; }
+    long remove_range(int min, int max)
+    {
+        std::map<int, int>::iterator lo = map.lower_bound(min), hi = map.upper_bound(max);
+        long n = std::distance(lo, hi);
+        map.erase(lo, hi);
+        return n;
+    }
+};
+
+struct bench {
+    long size, ops;
+    std::vector<int> sorted;    /* the keys in order */
+    std::vector<int> shuffled;  /* the same keys in random order */
+    std::vector<long> zipf_idx; /* zipfian draws, into shuffled so hot keys are spread */
+    std::vector<long> uniform;  /* uniform draws over [0, size) */
+    std::vector<result> results;
+};
+
+/* Time ops calls of op(i), one in LATENCY_SAMPLE of them on its own too,
+ * less the clock calls of those samples. */
+template <typename Op>
+static void measure(bench &b, const char *structure, const char *workload, long ops,
+                    double rss, Op op)
+{
+    std::vector<long long> lat;
+    long long start, t;
+    double total;
+    long i;
+
+    lat.reserve(ops / LATENCY_SAMPLE + 1);
+    start = now_ns();
+    for (i = 0; i < ops; i++) {
+        if (i % LATENCY_SAMPLE == 0) {
+            t = now_ns();
+            op(i);
+            lat.push_back(now_ns() - t);
+        } else {
+            op(i);
+        }
+    }
+    t = now_ns() - start;
+    total = t - lat.size() * clock_pair_ns();
+
+    result r;
+    r.structure = structure;
+    r.workload = workload;
+    r.size = b.size;
+    r.ops = ops;
+    r.ns_per_op = ops > 0 && total > 0 ? total / ops : 0;
+    std::sort(lat.begin(), lat.end());
+    r.p50 = lat.empty() ? 0 : lat[lat.size() * 50 / 100];
+    r.p99 = lat.empty() ? 0 : lat[lat.size() * 99 / 100];
+    r.p999 = lat.empty() ? 0 : lat[lat.size() * 999 / 1000];
+    r.rss_mb = rss;
+    b.results.push_back(r);
+}
+
+static bool wanted(const std::vector<std::string> &list, const char *name)
+{
+    return std::find(list.begin(), list.end(), name) != list.end();
+}
+
+template <typename S>
+static void run_workloads(bench &b, const std::vector<std::string> &workloads)
+{
+    const char *name = S::name();
+    long n = b.size;
+
+    /* building from ascending and descending keys, thrown away after */
+    if (wanted(workloads, "insert_seq")) {
+        S s;
+        measure(b, name, "insert_seq", n, 0, [&](long i) { s.insert(b.sorted[i]); });
+    }
+    if (wanted(workloads, "insert_rev")) {
+        S s;
+        measure(b, name, "insert_rev", n, 0, [&](long i) { s.insert(b.sorted[n - 1 - i]); });
+    }
+
+    /* the random order build is kept for everything that follows, and what
+     * earlier builds left in the allocator is handed back first so that it
+     * does not hide the growth */
+#ifdef __GLIBC__
+    malloc_trim(0);
+#endif
+    double rss = rss_mb();
+    S *s = new S;
+    measure(b, name, "insert_rand", n, 0, [&](long i) { s->insert(b.shuffled[i]); });
+    rss = rss_mb() - rss;
+    if (wanted(workloads, "insert_rand")) {
+        b.results.back().rss_mb = rss;
+    } else {
+        b.results.pop_back();
+    }
+
+    long warm = b.ops / 10;
+    if (wanted(workloads, "search_uniform")) {
+        auto op = [&](long i) { sink += s->find(b.shuffled[b.uniform[i]]); };
+        for (long i = 0; i < warm; i++) {
+            op(i);
+        }
+        measure(b, name, "search_uniform", b.ops, rss, op);
+    }
+    if (wanted(workloads, "search_zipf")) {
+        auto op = [&](long i) { sink += s->find(b.shuffled[b.zipf_idx[i]]); };
+        for (long i = 0; i < warm; i++) {
+            op(i);
+        }
+        measure(b, name, "search_zipf", b.ops, rss, op);
+    }
+
+    /* writes add an absent odd key and take it out again, reads hit */
+    static const struct { const char *name; int write_percent; } mixes[] = {
+        { "mixed_90_10", 10 }, { "mixed_50_50", 50 },
+    };
+    for (size_t m = 0; m < sizeof(mixes) / sizeof(mixes[0]); m++) {
+        if (!wanted(workloads, mixes[m].name)) {
+            continue;
+        }
+        int pct = mixes[m].write_percent;
+        auto op = [&](long i) {
+            long r = b.uniform[i];
+            if (r % 100 < pct) {
+                int key = b.shuffled[r] | 1;
+                s->insert(key);
+                s->erase(key);
+            } else {
+                sink += s->find(b.shuffled[r]);
+            }
+        };
+        for (long i = 0; i < warm; i++) {
+            op(i);
+        }
+        measure(b, name, mixes[m].name, b.ops, rss, op);
+    }
+
+    if (wanted(workloads, "range_scan")) {
+        long ops = b.ops / 10 > 0 ? b.ops / 10 : 1;
+        auto op = [&](long i) { sink += s->scan(b.shuffled[b.uniform[i]], SCAN_LENGTH); };
+        for (long i = 0; i < ops / 10; i++) {
+            op(i);
+        }
+        measure(b, name, "range_scan", ops, rss, op);
+    }
+    if (wanted(workloads, "rank") && S::has_rank()) {
+        auto op = [&](long i) { sink += s->rank(b.shuffled[b.uniform[i]], b.uniform[i] + 1); };
+        for (long i = 0; i < warm; i++) {
+            op(i);
+        }
+        measure(b, name, "rank", b.ops, rss, op);
+    }
+
+    /* blocks of REMOVE_BLOCK keys from random places until half are gone */
+    if (wanted(workloads, "remove_range")) {
+        long blocks = n / 2 / REMOVE_BLOCK;
+        measure(b, name, "remove_range", blocks > 0 ? blocks : 1, rss, [&](long i) {
+            long first = b.uniform[i] % (n - REMOVE_BLOCK + 1 > 0 ? n - REMOVE_BLOCK + 1 : 1);
+            long last = first + REMOVE_BLOCK - 1 < n ? first + REMOVE_BLOCK - 1 : n - 1;
+            sink += s->remove_range(b.sorted[first], b.sorted[last]);
+        });
+    }
+    delete s;
+}
+
+static void print_results(const bench &b, const char *format)
+{
+    size_t i;
+    const char *sep = "";
+
+    if (strcmp(format, "csv") == 0) {
+        printf("structure,workload,size,ops,ns_per_op,p50_ns,p99_ns,p999_ns,rss_mb\n");
+        for (i = 0; i < b.results.size(); i++) {
+            const result &r = b.results[i];
+            printf("%s,%s,%ld,%ld,%.1f,%.0f,%.0f,%.0f,%.1f\n", r.structure.c_str(), r.workload.c_str(),
+                   r.size, r.ops, r.ns_per_op, r.p50, r.p99, r.p999, r.rss_mb);
+        }
+    } else if (strcmp(format, "json") == 0) {
+        printf("[\n");
+        for (i = 0; i < b.results.size(); i++, sep = ",\n") {
+            const result &r = b.results[i];
+            printf("%s  {\"structure\": \"%s\", \"workload\": \"%s\", \"size\": %ld, \"ops\": %ld, "
+                   "\"ns_per_op\": %.1f, \"p50_ns\": %.0f, \"p99_ns\": %.0f, \"p999_ns\": %.0f, "
+                   "\"rss_mb\": %.1f}", sep, r.structure.c_str(), r.workload.c_str(), r.size, r.ops,
+                   r.ns_per_op, r.p50, r.p99, r.p999, r.rss_mb);
+        }
+        printf("\n]\n");
+    } else {
+        printf("%-10s %-15s %10s %10s %8s %8s %8s %8s\n", "structure", "workload", "ops",
+               "ns/op", "p50", "p99", "p999", "rss MB");
+        for (i = 0; i < b.results.size(); i++) {
+            const result &r = b.results[i];
+            printf("%-10s %-15s %10ld %10.1f %8.0f %8.0f %8.0f %8.1f\n", r.structure.c_str(),
+                   r.workload.c_str(), r.ops, r.ns_per_op, r.p50, r.p99, r.p999, r.rss_mb);
+        }
+    }
+}
+
+static void usage(const char *prog)
+{
+    size_t i;
+    fprintf(stderr, "usage: %s [-n size] [-o ops] [-w workload,...] [-f text|csv|json] [-s seed] [-m]\n",
+            prog);
+    fprintf(stderr, "workloads:");
+    for (i = 0; i < sizeof(all_workloads) / sizeof(all_workloads[0]); i++) {
+        fprintf(stderr, " %s", all_workloads[i]);
+    }
+    fprintf(stderr, "\n");
+    exit(1);
+}
+
+int
+main(int argc, char **argv)
+{
+    int c;
+    long i;
+    bool with_map = true;
+    const char *format = "text";
+    unsigned long long seed = time(NULL), x;
+    std::vector<std::string> workloads(all_workloads,
+                                       all_workloads + sizeof(all_workloads) / sizeof(all_workloads[0]));
+    bench b;
+
+    b.size = DEFAULT_SIZE;
+    b.ops = 0;
+    while ((c = getopt(argc, argv, "n:o:w:f:s:m")) != -1) {
+        switch (c) {
+        case 'n':
+            b.size = atol(optarg);
+            break;
+        case 'o':
+            b.ops = atol(optarg);
+            break;
+        case 'w': {
+            std::string list = optarg;
+            size_t pos = 0, comma;
+            workloads.clear();
+            do {
+                comma = list.find(',', pos);
+                workloads.push_back(list.substr(pos, comma == std::string::npos ? comma : comma - pos));
+                if (!wanted(std::vector<std::string>(all_workloads, all_workloads +
+                                sizeof(all_workloads) / sizeof(all_workloads[0])),
+                            workloads.back().c_str())) {
+                    usage(argv[0]);
+                }
+                pos = comma + 1;
+            } while (comma != std::string::npos);
+            break;
+        }
+        case 'f':
+            format = optarg;
+            break;
+        case 's':
+            seed = strtoull(optarg, NULL, 0);
+            break;
+        case 'm':
+            with_map = false;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (b.size < 1 || b.size > 0x3fffffff) {
+        usage(argv[0]);
+    }
+    if (b.ops <= 0) {
+        b.ops = b.size;
+    }
+
+    /* distinct even keys, shuffled with the seed */
+    x = seed * 0x9e3779b97f4a7c15ULL + 1;
+    b.sorted.resize(b.size);
+    for (i = 0; i < b.size; i++) {
+        b.sorted[i] = (int)(i * 2);
+    }
+    b.shuffled = b.sorted;
+    for (i = b.size - 1; i > 0; i--) {
+        std::swap(b.shuffled[i], b.shuffled[next_rand(&x) % (i + 1)]);
+    }
+    /* remove_range draws one block start per REMOVE_BLOCK keys it removes,
+     * which may be more than ops */
+    b.uniform.resize(std::max(b.ops, b.size / 2 / REMOVE_BLOCK + 1));
+    for (i = 0; i < (long)b.uniform.size(); i++) {
+        b.uniform[i] = next_rand(&x) % b.size;
+    }
+    if (wanted(workloads, "search_zipf")) {
+        struct zipf z;
+        zipf_init(&z, b.size, ZIPF_THETA);
+        b.zipf_idx.resize(b.ops);
+        for (i = 0; i < b.ops; i++) {
+            b.zipf_idx[i] = zipf_next(&z, &x);
+        }
+    }
+
+    fprintf(stderr, "size %ld, ops %ld, seed %llu\n", b.size, b.ops, seed);
+    run_workloads<skiplist_adapter>(b, workloads);
+    if (with_map) {
+        run_workloads<map_adapter>(b, workloads);
+    }
+    print_results(b, format);
+
+    return 0;
+}
@@ -0,0 +1,530 @@
+/*
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ */
+
+#ifndef _SKIPLIST_FILE_H
+#define _SKIPLIST_FILE_H
+
+/*
+ * On-disk image of a skiplist, for a fast restart.
+ *
+ * Include it after skiplist.h or skiplist_with_rank.h. The image holds the
+ * level 0 keys and values as two sorted arrays and, optionally, the towers:
+ * one section per level above 0 listing the nodes that reach it, each entry
+ * giving the node's index in level 0 and its index in the section below.
+ *
+ *      header | keys[count] | values[count] | level 1 | level 2 | ...
+ *
+ * Sections start at 16 byte boundaries and everything after the header is
+ * covered by a CRC-32. Keys and values are copied as they are in memory, so
+ * they must be plain data, and the image is only read back on a machine
+ * with the same byte order and type sizes, which the header records.
+ *
+ * skiplist_load() rebuilds a list in one pass, keeping the saved towers if
+ * there are any. skiplist_image_open() maps the file read-only instead and
+ * answers lookups and rank queries straight from the mapping: the tower
+ * sections are walked like the levels of the list, or the keys are binary
+ * searched when the image has no towers.
+ */
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SKIPLIST_FILE_MAGIC "SKIPLIST"
+#define SKIPLIST_FILE_VERSION 1
+#define SKIPLIST_FILE_ORDER 0x01020304U
+#define SKIPLIST_FILE_LEVELS 64        /* level slots in the header */
+#define SKIPLIST_FILE_ALIGN 16
+
+/* Flags of skiplist_save() */
+#define SKIPLIST_FILE_TOWERS 0x1       /* save the tower sections */
+
+#ifndef SKIPLIST_FILE_BUF
+#define SKIPLIST_FILE_BUF 65536        /* write buffer */
+#endif
+
+struct sk_file_header {
+        char magic[8];
+        unsigned int version;
+        unsigned int order;             /* SKIPLIST_FILE_ORDER as written */
+        unsigned int flags;
+        unsigned int key_size;
+        unsigned int value_size;
+        unsigned int levels;            /* sections, level 0 included */
+        unsigned long long count;
+        unsigned long long size;        /* bytes of the whole file */
+        unsigned int crc;               /* CRC-32 of everything after the header */
+        unsigned int reserved[3];
+        unsigned long long level_size[SKIPLIST_FILE_LEVELS];  /* entries of each section */
+};
+
+struct sk_file_entry {
+        unsigned int node;              /* index in level 0 */
+        unsigned int down;              /* index in the section below */
+};
+
+struct sk_image {
+        void *map;
+        size_t size;
+        int levels;
+        unsigned long long count;
+        const sk_key_t *keys;
+        const sk_value_t *values;
+        const struct sk_file_entry *level[SKIPLIST_FILE_LEVELS];  /* level[0] unused */
+        unsigned long long level_size[SKIPLIST_FILE_LEVELS];
+};
+
+static unsigned int sk_crc_table[256];
+
+static unsigned int sk_crc32(unsigned int crc, const void *buf, size_t len)
+{
+        const unsigned char *p = (const unsigned char *)buf;
+        if (sk_crc_table[1] == 0) {
+                unsigned int i, j, c;
+                for (i = 0; i < 256; i++) {
+                        for (c = i, j = 0; j < 8; j++) {
+                                c = c & 1 ? 0xedb88320U ^ (c >> 1) : c >> 1;
+                        }
+                        sk_crc_table[i] = c;
+                }
+        }
+        crc = ~crc;
+        while (len-- > 0) {
+                crc = sk_crc_table[(crc ^ *p++) & 0xff] ^ (crc >> 8);
+        }
+        return ~crc;
+}
+
+static inline unsigned long long sk_file_align(unsigned long long off)
+{
+        return (off + SKIPLIST_FILE_ALIGN - 1) & ~(unsigned long long)(SKIPLIST_FILE_ALIGN - 1);
+}
+
+/* Byte offsets of the sections, the end of the file last. */
+static void
+sk_file_layout(const struct sk_file_header *hdr, unsigned long long *off)
+{
+        unsigned int i;
+        off[0] = sk_file_align(sizeof(*hdr));
+        off[1] = sk_file_align(off[0] + hdr->count * hdr->key_size);
+        off[2] = sk_file_align(off[1] + hdr->count * hdr->value_size);
+        for (i = 1; i < hdr->levels; i++) {
+                off[i + 2] = sk_file_align(off[i + 1] + hdr->level_size[i] * sizeof(struct sk_file_entry));
+        }
+}
+
+/* Sync the directory holding path, so that a rename into it is on disk. */
+static int sk_file_sync_dir(const char *path)
+{
+        int fd, ret;
+        char dir[4096];
+        const char *slash = strrchr(path, '/');
+        size_t len = slash == NULL ? 1 : slash == path ? 1 : (size_t)(slash - path);
+
+        if (len >= sizeof(dir)) {
+                return -1;
+        }
+        memcpy(dir, slash == NULL ? "." : path, len);
+        dir[len] = '\0';
+        fd = open(dir, O_RDONLY | O_DIRECTORY);
+        if (fd < 0) {
+                return -1;
+        }
+        ret = fsync(fd);
+        close(fd);
+        return ret;
+}
+
+struct sk_file_writer {
+        FILE *fp;
+        unsigned int crc;
+        unsigned long long off;
+        size_t len;
+        char buf[SKIPLIST_FILE_BUF];
+};
+
+static int sk_file_flush(struct sk_file_writer *w)
+{
+        w->crc = sk_crc32(w->crc, w->buf, w->len);
+        if (fwrite(w->buf, 1, w->len, w->fp) != w->len) {
+                return -1;
+        }
+        w->len = 0;
+        return 0;
+}
+
+static int sk_file_put(struct sk_file_writer *w, const void *ptr, size_t size)
+{
+        if (w->len + size > sizeof(w->buf)) {
+                if (sk_file_flush(w) < 0) {
+                        return -1;
+                }
+                if (size > sizeof(w->buf)) {
+                        w->crc = sk_crc32(w->crc, ptr, size);
+                        w->off += size;
+                        return fwrite(ptr, 1, size, w->fp) == size ? 0 : -1;
+                }
+        }
+        memcpy(w->buf + w->len, ptr, size);
+        w->len += size;
+        w->off += size;
+        return 0;
+}
+
+static int sk_file_pad(struct sk_file_writer *w)
+{
+        static const char zero[SKIPLIST_FILE_ALIGN];
+        return sk_file_put(w, zero, sk_file_align(w->off) - w->off);
+}
+
+/* Write the tower sections. They are filled side by side in one pass over
+ * level 0: the n-th node reaching level i takes entry n of that section and
+ * points down to its own entry in the section below. */
+static int sk_file_put_towers(struct sk_file_writer *w, struct skiplist *list,
+                              const struct sk_file_header *hdr)
+{
+        int i, h, ret = 0;
+        unsigned long long n, down, total = 0;
+        unsigned long long base[SKIPLIST_FILE_LEVELS], pos[SKIPLIST_FILE_LEVELS];
+        struct sk_file_entry *entries;
+        struct sk_link *link;
+
+        for (i = 1; i < (int)hdr->levels; i++) {
+                base[i] = pos[i] = total;
+                total += hdr->level_size[i];
+        }
+        entries = (struct sk_file_entry *)malloc(total * sizeof(*entries) + 1);
+        if (entries == NULL) {
+                return -1;
+        }
+
+        n = 0;
+        for (link = list->head[0].next; link != &list->head[0]; link = link->next, n++) {
+                h = slab_of(list_entry(link, struct skipnode, link[0]))->level;
+                for (i = 1, down = n; i < h; i++) {
+                        entries[pos[i]].node = n;
+                        entries[pos[i]].down = down;
+                        down = pos[i]++ - base[i];
+                }
+        }
+
+        for (i = 1; i < (int)hdr->levels && ret == 0; i++) {
+                ret = sk_file_put(w, entries + base[i], hdr->level_size[i] * sizeof(*entries));
+                if (ret == 0) {
+                        ret = sk_file_pad(w);
+                }
+        }
+        free(entries);
+        return ret;
+}
+
+/* Write the list to path, with its towers if flags has SKIPLIST_FILE_TOWERS.
+ * The image is written under a temporary name and renamed over path once
+ * synced, and the directory is synced after, so a crash never leaves a torn
+ * file behind and a successful save survives one. Returns 0, or -1 on an
+ * I/O error or a list too long for the 32-bit section entries. */
+static int skiplist_save(struct skiplist *list, const char *path, unsigned int flags)
+{
+        int i, h, ret = -1;
+        char tmp[4096];
+        struct sk_file_header hdr;
+        struct sk_file_writer *w;
+        struct sk_link *link;
+
+        if ((unsigned long long)list->count > 0xffffffffULL || list->level > SKIPLIST_FILE_LEVELS ||
+            (size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", path) >= sizeof(tmp)) {
+                return -1;
+        }
+        w = (struct sk_file_writer *)malloc(sizeof(*w));
+        if (w == NULL) {
+                return -1;
+        }
+        w->fp = fopen(tmp, "wb");
+        if (w->fp == NULL) {
+                free(w);
+                return -1;
+        }
+
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, SKIPLIST_FILE_MAGIC, sizeof(hdr.magic));
+        hdr.version = SKIPLIST_FILE_VERSION;
+        hdr.order = SKIPLIST_FILE_ORDER;
+        hdr.flags = flags & SKIPLIST_FILE_TOWERS;
+        hdr.key_size = sizeof(sk_key_t);
+        hdr.value_size = sizeof(sk_value_t);
+        hdr.levels = hdr.flags & SKIPLIST_FILE_TOWERS ? list->level : 1;
+        hdr.count = list->count;
+
+        /* the header goes in last, once the section sizes and the CRC are known */
+        w->crc = 0;
+        w->len = 0;
+        w->off = sk_file_align(sizeof(hdr));
+        if (fseek(w->fp, w->off, SEEK_SET) < 0) {
+                goto out;
+        }
+
+        for (link = list->head[0].next; link != &list->head[0]; link = link->next) {
+                struct skipnode *node = list_entry(link, struct skipnode, link[0]);
+                h = hdr.levels > 1 ? slab_of(node)->level : 1;
+                for (i = 0; i < h; i++) {
+                        hdr.level_size[i]++;
+                }
+                if (sk_file_put(w, &node->key, sizeof(node->key)) < 0) {
+                        goto out;
+                }
+        }
+        if (sk_file_pad(w) < 0) {
+                goto out;
+        }
+        for (link = list->head[0].next; link != &list->head[0]; link = link->next) {
+                struct skipnode *node = list_entry(link, struct skipnode, link[0]);
+                if (sk_file_put(w, &node->value, sizeof(node->value)) < 0) {
+                        goto out;
+                }
+        }
+        if (sk_file_pad(w) < 0 || (hdr.levels > 1 && sk_file_put_towers(w, list, &hdr) < 0) ||
+            sk_file_flush(w) < 0) {
+                goto out;
+        }
+
+        hdr.size = w->off;
+        hdr.crc = w->crc;
+        if (fseek(w->fp, 0, SEEK_SET) == 0 && fwrite(&hdr, sizeof(hdr), 1, w->fp) == 1 &&
+            fflush(w->fp) == 0 && fsync(fileno(w->fp)) == 0) {
+                ret = 0;
+        }
+out:
+        if (fclose(w->fp) != 0) {
+                ret = -1;
+        }
+        free(w);
+        if (ret == 0 && (rename(tmp, path) < 0 || sk_file_sync_dir(path) < 0)) {
+                ret = -1;
+        }
+        if (ret < 0) {
+                unlink(tmp);
+        }
+        return ret;
+}
+
+/* Map the image at path read-only. The header is always checked against
+ * this build and the file size; with verify set the CRC is checked too,
+ * which reads the whole file, while without it opening is O(1) and the
+ * pages are faulted in by the queries that need them. Returns NULL if the
+ * file cannot be mapped or is not a valid image. */
+static struct sk_image *skiplist_image_open(const char *path, int verify)
+{
+        int fd, i;
+        struct stat st;
+        struct sk_image *img;
+        const struct sk_file_header *hdr;
+        unsigned long long off[SKIPLIST_FILE_LEVELS + 2];
+
+        fd = open(path, O_RDONLY);
+        if (fd < 0) {
+                return NULL;
+        }
+        img = (struct sk_image *)malloc(sizeof(*img));
+        if (img == NULL || fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(*hdr)) {
+                goto fail;
+        }
+        img->size = st.st_size;
+        img->map = mmap(NULL, img->size, PROT_READ, MAP_SHARED, fd, 0);
+        if (img->map == MAP_FAILED) {
+                goto fail;
+        }
+        close(fd);
+        fd = -1;
+
+        hdr = (const struct sk_file_header *)img->map;
+        if (memcmp(hdr->magic, SKIPLIST_FILE_MAGIC, sizeof(hdr->magic)) != 0 ||
+            hdr->version != SKIPLIST_FILE_VERSION || hdr->order != SKIPLIST_FILE_ORDER ||
+            hdr->key_size != sizeof(sk_key_t) || hdr->value_size != sizeof(sk_value_t) ||
+            hdr->levels < 1 || hdr->levels > SKIPLIST_FILE_LEVELS || hdr->levels > MAX_LEVEL ||
+            hdr->level_size[0] != hdr->count || hdr->count > 0xffffffffULL || hdr->size != img->size) {
+                goto unmap;
+        }
+        for (i = 1; i < (int)hdr->levels; i++) {
+                if (hdr->level_size[i] > hdr->level_size[i - 1]) {
+                        goto unmap;
+                }
+        }
+        sk_file_layout(hdr, off);
+        if (off[hdr->levels + 1] != hdr->size) {
+                goto unmap;
+        }
+        if (verify && sk_crc32(0, (const char *)img->map + off[0], hdr->size - off[0]) != hdr->crc) {
+                goto unmap;
+        }
+
+        img->levels = hdr->levels;
+        img->count = hdr->count;
+        img->keys = (const sk_key_t *)((const char *)img->map + off[0]);
+        img->values = (const sk_value_t *)((const char *)img->map + off[1]);
+        img->level[0] = NULL;
+        img->level_size[0] = hdr->count;
+        for (i = 1; i < img->levels; i++) {
+                img->level[i] = (const struct sk_file_entry *)((const char *)img->map + off[i + 1]);
+                img->level_size[i] = hdr->level_size[i];
+        }
+        return img;
+
+unmap:
+        munmap(img->map, img->size);
+fail:
+        if (fd >= 0) {
+                close(fd);
+        }
+        free(img);
+        return NULL;
+}
+
+static void skiplist_image_close(struct sk_image *img)
+{
+        munmap(img->map, img->size);
+        free(img);
+}
+
+/* Index of the first key not less than key, count if there is none. */
+static unsigned long long __image_find(const struct sk_image *img, sk_key_t key)
+{
+        int i;
+        long long cur = -1;  /* last entry before key on the current level, -1 for the head */
+
+        if (img->levels == 1) {
+                unsigned long long lo = 0, hi = img->count;
+                while (lo < hi) {
+                        unsigned long long mid = lo + (hi - lo) / 2;
+                        if (SKIPLIST_KEY_CMP(img->keys[mid], key) < 0) {
+                                lo = mid + 1;
+                        } else {
+                                hi = mid;
+                        }
+                }
+                return lo;
+        }
+
+        for (i = img->levels - 1; i > 0; i--) {
+                const struct sk_file_entry *e = img->level[i];
+                while ((unsigned long long)(cur + 1) < img->level_size[i] &&
+                       SKIPLIST_KEY_CMP(img->keys[e[cur + 1].node], key) < 0) {
+                        cur++;
+                }
+                cur = cur < 0 ? -1 : (long long)e[cur].down;
+        }
+        while ((unsigned long long)(cur + 1) < img->count &&
+               SKIPLIST_KEY_CMP(img->keys[cur + 1], key) < 0) {
+                cur++;
+        }
+        return cur + 1;
+}
+
+/* Value of key in the mapping, NULL if it is not there. */
+static const sk_value_t *skiplist_image_search(const struct sk_image *img, sk_key_t key)
+{
+        unsigned long long i = __image_find(img, key);
+        return i < img->count && SKIPLIST_KEY_CMP(img->keys[i], key) == 0 ? &img->values[i] : NULL;
+}
+
+/* Rank of the first node with key, 1 based, 0 if there is none. */
+static unsigned long long skiplist_image_key_rank(const struct sk_image *img, sk_key_t key)
+{
+        unsigned long long i = __image_find(img, key);
+        return i < img->count && SKIPLIST_KEY_CMP(img->keys[i], key) == 0 ? i + 1 : 0;
+}
+
+/* Node of the given 1 based rank, -1 if it is out of range. */
+static int
+skiplist_image_search_by_rank(const struct sk_image *img, unsigned long long rank, struct sk_pair *out)
+{
+        if (rank == 0 || rank > img->count) {
+                return -1;
+        }
+        out->key = img->keys[rank - 1];
+        out->value = img->values[rank - 1];
+        return 0;
+}
+
+/* Rebuild a list from the image at path in one pass over its nodes, with the
+ * saved towers if it has them and fresh random levels otherwise. The CRC is
+ * always checked. Returns the new list, or NULL if the file is not a valid
+ * image, holds more nodes than the list can count, or memory runs out. */
+static struct skiplist *skiplist_load(const char *path)
+{
+        int i, level;
+        unsigned long long n, cur[SKIPLIST_FILE_LEVELS];
+#ifdef SKIPLIST_WITH_RANK
+        sk_rank_t rank[MAX_LEVEL];
+        struct sk_link *tail[MAX_LEVEL];
+#endif
+        struct skiplist *list;
+        struct skipnode *node;
+        struct sk_image *img = skiplist_image_open(path, 1);
+        if (img == NULL) {
+                return NULL;
+        }
+        list = skiplist_new();
+        if (list == NULL || (unsigned long long)(__typeof__(list->count))img->count != img->count ||
+            (__typeof__(list->count))img->count < 0) {
+                goto fail;
+        }
+
+        for (i = 0; i < img->levels; i++) {
+                cur[i] = 0;
+        }
+#ifdef SKIPLIST_WITH_RANK
+        for (i = 0; i < MAX_LEVEL; i++) {
+                tail[i] = &list->head[i];
+                rank[i] = 0;
+        }
+#endif
+        for (n = 0; n < img->count; n++) {
+                if (img->levels > 1) {
+                        /* towers nest, so the node reaches every level whose
+                         * next entry is this node */
+                        for (level = 1; level < img->levels && cur[level] < img->level_size[level] &&
+                             img->level[level][cur[level]].node == n; level++) {
+                                cur[level]++;
+                        }
+                } else {
+                        level = random_level(list);
+                }
+                node = skipnode_new(list, level, img->keys[n], img->values[n]);
+                if (node == NULL) {
+                        goto fail;
+                }
+                if (level > list->level) {
+                        list->level = level;
+                }
+                list->count++;
+                for (i = 0; i < level; i++) {
+#ifdef SKIPLIST_WITH_RANK
+                        sum_add(node, tail, i, level);
+                        __list_add(&node->link[i], tail[i], &list->head[i], i);
+                        link_span_set(&node->link[i], i, list->count - rank[i]);
+                        rank[i] = list->count;
+#else
+                        list_add(&node->link[i], list->head[i].prev);
+#endif
+                }
+#ifdef SKIPLIST_WITH_RANK
+                for (i = 0; i < level; i++) {
+                        tail[i] = &node->link[i];
+                }
+#endif
+        }
+
+        skiplist_image_close(img);
+        return list;
+
+fail:
+        if (list != NULL) {
+                skiplist_delete(list);
+        }
+        skiplist_image_close(img);
+        return NULL;
+}
+
+#endif  /* _SKIPLIST_FILE_H */
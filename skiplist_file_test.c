@@ -0,0 +1,179 @@
+/*
+* Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "skiplist_with_rank.h"
+#include "skiplist_file.h"
+
+#define N 2 * 1024 * 1024
+#define IMAGE "skiplist_test.img"
+
+static long elapsed_ms(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000 + (end->tv_nsec - start->tv_nsec) / 1000000;
+}
+
+/* Same nodes, same towers and the right ranks. */
+static int same_list(struct skiplist *a, struct skiplist *b)
+{
+    sk_rank_t rank = 0;
+    struct sk_link *p, *q;
+
+    if (a->count != b->count || a->level != b->level) {
+        printf("Count or level differs\n");
+        return 0;
+    }
+    for (p = a->head[0].next, q = b->head[0].next; p != &a->head[0]; p = p->next, q = q->next) {
+        struct skipnode *x = list_entry(p, struct skipnode, link[0]);
+        struct skipnode *y = list_entry(q, struct skipnode, link[0]);
+        rank++;
+        if (x->key != y->key || x->value != y->value || slab_of(x)->level != slab_of(y)->level) {
+            printf("Node differs at rank " SKIPLIST_RANK_FMT "\n", rank);
+            return 0;
+        }
+        if (skiplist_search_by_rank(b, rank) != y) {
+            printf("Bad rank " SKIPLIST_RANK_FMT "\n", rank);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+static int check_image(struct sk_image *img, const int *key, int n)
+{
+    int i;
+    struct sk_pair pair;
+
+    for (i = 0; i < n; i++) {
+        const sk_value_t *value = skiplist_image_search(img, key[i]);
+        unsigned long long rank = skiplist_image_key_rank(img, key[i]);
+        if (value == NULL || *value != ~key[i] || rank == 0 ||
+            skiplist_image_search_by_rank(img, rank, &pair) < 0 || pair.key != key[i]) {
+            printf("Not found in image:0x%08x\n", key[i]);
+            return 0;
+        }
+        if (skiplist_image_search(img, -key[i] - 1) != NULL) {
+            printf("Found a key never added:0x%08x\n", -key[i] - 1);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+int
+main(void)
+{
+    int i, j, tmp;
+    FILE *fp;
+    struct timespec start, end;
+
+    int *key = malloc(N * sizeof(int));
+    if (key == NULL) {
+        exit(-1);
+    }
+
+    /* distinct non-negative keys in random order */
+    srandom(time(NULL));
+    for (i = 0; i < N; i++) {
+        key[i] = i;
+    }
+    for (i = N - 1; i > 0; i--) {
+        j = random() % (i + 1);
+        tmp = key[i];
+        key[i] = key[j];
+        key[j] = tmp;
+    }
+
+    struct skiplist *list = skiplist_new();
+    if (list == NULL) {
+        exit(-1);
+    }
+
+    printf("Test start!\n");
+    printf("Add %d nodes...\n", N);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i++) {
+        skiplist_insert(list, key[i], ~key[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", elapsed_ms(&start, &end));
+
+    printf("Now save the list with its towers...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (skiplist_save(list, IMAGE, SKIPLIST_FILE_TOWERS) < 0) {
+        printf("Save failed\n");
+        exit(-1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", elapsed_ms(&start, &end));
+
+    printf("Now load it back...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct skiplist *copy = skiplist_load(IMAGE);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", elapsed_ms(&start, &end));
+    if (copy == NULL || !same_list(list, copy)) {
+        printf("Load failed\n");
+        exit(-1);
+    }
+    skiplist_delete(copy);
+
+    printf("Now map the image and search all keys in it...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    struct sk_image *img = skiplist_image_open(IMAGE, 0);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    if (img == NULL) {
+        printf("Map failed\n");
+        exit(-1);
+    }
+    printf("open: %ldms, %d levels\n", elapsed_ms(&start, &end), img->levels);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    check_image(img, key, N);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", elapsed_ms(&start, &end));
+    skiplist_image_close(img);
+
+    printf("Now save without towers, map and load it...\n");
+    if (skiplist_save(list, IMAGE, 0) < 0) {
+        printf("Save failed\n");
+        exit(-1);
+    }
+    img = skiplist_image_open(IMAGE, 1);
+    if (img == NULL || img->levels != 1) {
+        printf("Map failed\n");
+        exit(-1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    check_image(img, key, N);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("binary search time span: %ldms\n", elapsed_ms(&start, &end));
+    skiplist_image_close(img);
+    copy = skiplist_load(IMAGE);
+    if (copy == NULL || copy->count != list->count ||
+        skiplist_search_by_key(copy, key[0]) == NULL || skiplist_key_rank(copy, key[0]) != key[0] + 1) {
+        printf("Load failed\n");
+        exit(-1);
+    }
+    skiplist_delete(copy);
+
+    /* A flipped bit must be caught by the CRC */
+    fp = fopen(IMAGE, "r+b");
+    if (fp == NULL || fseek(fp, -1, SEEK_END) < 0 || fputc(0x5a, fp) == EOF || fclose(fp) != 0) {
+        exit(-1);
+    }
+    if (skiplist_load(IMAGE) != NULL) {
+        printf("Corrupted image loaded\n");
+    }
+    unlink(IMAGE);
+
+    printf("End of Test.\n");
+    skiplist_delete(list);
+
+    free(key);
+
+    return 0;
+}
@@ -0,0 +1,325 @@
+/*
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ */
+
+#ifndef _SKIPLIST_HOTCOLD_H
+#define _SKIPLIST_HOTCOLD_H
+
+/*
+ * Skiplist with a search-friendly node layout.
+ *
+ * Each forward link carries a copy of the key of the node it points to, so a
+ * descent decides whether to move on by reading the link it is standing on,
+ * and touches exactly one link per hop instead of the link plus the header of
+ * the next node. The backward pointers, only needed to walk the list in
+ * reverse, are kept in a cold array behind the forward links:
+ *
+ *   | key | value | link[0] ... link[level-1] | prev[0] ... prev[level-1] |
+ *                   {next, next key}           cold
+ *
+ * The names do not clash with skiplist.h, so both can be used side by side.
+ */
+
+#ifndef MAX_LEVEL
+#define MAX_LEVEL 32  /* Should be enough for 2^32 elements */
+#endif
+
+#ifndef SKIPLIST_KEY_TYPE
+#define SKIPLIST_KEY_TYPE int
+#endif
+
+#ifndef SKIPLIST_VALUE_TYPE
+#define SKIPLIST_VALUE_TYPE int
+#endif
+
+#ifndef SKIPLIST_KEY_CMP
+#define SKIPLIST_KEY_CMP(a, b) (((a) > (b)) - ((a) < (b)))
+#endif
+
+#ifndef SKIPLIST_P_SHIFT
+#define SKIPLIST_P_SHIFT 2  /* promotion probability p = 1/2^SKIPLIST_P_SHIFT: 1, 2 or 3 */
+#endif
+
+#ifndef SKIPLIST_SLAB_SIZE
+#define SKIPLIST_SLAB_SIZE 4096
+#endif
+
+/* Slabs come from the same hooks as in skiplist.h, aligned to their size */
+#ifndef SKIPLIST_SLAB_ALLOC
+#define SKIPLIST_SLAB_ALLOC(size) hc_slab_alloc(size)
+#define SKIPLIST_SLAB_FREE(ptr) free(ptr)
+
+static inline void *hc_slab_alloc(size_t size)
+{
+        void *ptr;
+        return posix_memalign(&ptr, size, size) ? NULL : ptr;
+}
+#endif
+
+typedef SKIPLIST_KEY_TYPE hc_key_t;
+typedef SKIPLIST_VALUE_TYPE hc_value_t;
+
+struct hc_link {
+        struct hc_link *next;
+        hc_key_t key;                   /* key of the node next points to */
+};
+
+struct hc_slab {
+        struct hc_slab *next;
+        int level;
+};
+
+struct hc_skiplist {
+        int level;
+        int count;
+        unsigned long long rand;  /* level generator state */
+        struct hc_link head[MAX_LEVEL];
+        struct hc_link *head_prev[MAX_LEVEL];
+        struct hc_link *free_list[MAX_LEVEL];
+        struct hc_slab *slabs;
+};
+
+struct hc_node {
+        hc_key_t key;
+        hc_value_t value;
+        struct hc_link link[0];
+};
+
+#define hc_entry(ptr, i) \
+        ((struct hc_node *)((char *)(ptr) - (size_t)(&((struct hc_node *)0)->link[i])))
+
+#define hc_slab_of(node) \
+        ((struct hc_slab *)((size_t)(node) & ~((size_t)SKIPLIST_SLAB_SIZE - 1)))
+
+static inline size_t hc_node_size(int level)
+{
+        return sizeof(struct hc_node) + level * (sizeof(struct hc_link) + sizeof(struct hc_link *));
+}
+
+/* The backward pointer of level i of a node, or of the head. */
+static inline struct hc_link **
+hc_prev(struct hc_skiplist *list, struct hc_link *link, int i)
+{
+        struct hc_node *node;
+        if (link == &list->head[i]) {
+                return &list->head_prev[i];
+        }
+        node = hc_entry(link, i);
+        return (struct hc_link **)&node->link[hc_slab_of(node)->level] + i;
+}
+
+static int hc_slab_grow(struct hc_skiplist *list, int level)
+{
+        char *pos, *end;
+        size_t size = hc_node_size(level);
+        struct hc_slab *slab = (struct hc_slab *)SKIPLIST_SLAB_ALLOC(SKIPLIST_SLAB_SIZE);
+
+        if (slab == NULL) {
+                return -1;
+        }
+        slab->level = level;
+        slab->next = list->slabs;
+        list->slabs = slab;
+
+        pos = (char *)slab + ((sizeof(*slab) + sizeof(void *) - 1) & ~(sizeof(void *) - 1));
+        end = (char *)slab + SKIPLIST_SLAB_SIZE;
+        for (; pos + size <= end; pos += size) {
+                struct hc_node *node = (struct hc_node *)pos;
+                node->link[0].next = list->free_list[level - 1];
+                list->free_list[level - 1] = &node->link[0];
+        }
+        return 0;
+}
+
+static struct hc_node *
+hc_node_new(struct hc_skiplist *list, int level, hc_key_t key, hc_value_t value)
+{
+        struct hc_node *node;
+        struct hc_link *link = list->free_list[level - 1];
+        if (link == NULL) {
+                if (hc_slab_grow(list, level) < 0) {
+                        return NULL;
+                }
+                link = list->free_list[level - 1];
+        }
+
+        list->free_list[level - 1] = link->next;
+        node = hc_entry(link, 0);
+        node->key = key;
+        node->value = value;
+        return node;
+}
+
+static void hc_node_delete(struct hc_skiplist *list, struct hc_node *node)
+{
+        int level = hc_slab_of(node)->level;
+        node->link[0].next = list->free_list[level - 1];
+        list->free_list[level - 1] = &node->link[0];
+}
+
+/* Seed the level generator of the list, the same seed and the same
+ * operations build the same towers. */
+static void hc_skiplist_seed(struct hc_skiplist *list, unsigned long long seed)
+{
+        /* splitmix64 spreads small seeds over the whole state */
+        seed += 0x9e3779b97f4a7c15ULL;
+        seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebULL;
+        seed ^= seed >> 31;
+        list->rand = seed != 0 ? seed : 1;
+}
+
+static struct hc_skiplist *hc_skiplist_new(void)
+{
+        int i;
+        struct hc_skiplist *list = (struct hc_skiplist *)malloc(sizeof(*list));
+        if (list != NULL) {
+                list->level = 1;
+                list->count = 0;
+                hc_skiplist_seed(list, 0);
+                list->slabs = NULL;
+                for (i = 0; i < MAX_LEVEL; i++) {
+                        list->head[i].next = &list->head[i];
+                        list->head_prev[i] = &list->head[i];
+                        list->free_list[i] = NULL;
+                }
+        }
+        return list;
+}
+
+static void hc_skiplist_delete(struct hc_skiplist *list)
+{
+        struct hc_slab *slab, *n;
+        for (slab = list->slabs; slab != NULL; slab = n) {
+                n = slab->next;
+                SKIPLIST_SLAB_FREE(slab);
+        }
+        free(list);
+}
+
+/* Mirrors random_level() of skiplist.h. */
+static int hc_random_level(struct hc_skiplist *list)
+{
+        int level, cap;
+        unsigned long long x = list->rand;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        list->rand = x;
+
+        level = __builtin_ctzll(x) / SKIPLIST_P_SHIFT + 1;
+        cap = (64 - __builtin_clzll((unsigned long long)list->count + 1)) / SKIPLIST_P_SHIFT + 1;
+        if (cap > MAX_LEVEL) {
+                cap = MAX_LEVEL;
+        }
+        return level < cap ? level : cap;
+}
+
+/* Fill pred[] with the last link before key on every level. */
+static void
+__hc_find(struct hc_skiplist *list, hc_key_t key, struct hc_link **pred)
+{
+        int i = list->level - 1;
+        struct hc_link *pos = &list->head[i];
+
+        do {
+                while (pos->next != &list->head[i] &&
+                       SKIPLIST_KEY_CMP(pos->key, key) < 0) {
+                        pos = pos->next;
+                }
+                pred[i] = pos;
+                pos--;
+        } while (--i >= 0);
+}
+
+static struct hc_node *hc_skiplist_search(struct hc_skiplist *list, hc_key_t key)
+{
+        int i = list->level - 1;
+        struct hc_link *pos = &list->head[i];
+
+        for (; i >= 0; i--) {
+                while (pos->next != &list->head[i]) {
+                        int cmp = SKIPLIST_KEY_CMP(pos->key, key);
+                        if (cmp == 0) {
+                                return hc_entry(pos->next, i);
+                        } else if (cmp > 0) {
+                                break;
+                        }
+                        pos = pos->next;
+                }
+                pos--;
+        }
+
+        return NULL;
+}
+
+static struct hc_node *
+hc_skiplist_insert(struct hc_skiplist *list, hc_key_t key, hc_value_t value)
+{
+        int i;
+        struct hc_link *pred[MAX_LEVEL];
+        int level = hc_random_level(list);
+        struct hc_node *node = hc_node_new(list, level, key, value);
+        if (node == NULL) {
+                return NULL;
+        }
+
+        if (level > list->level) {
+                list->level = level;
+        }
+        __hc_find(list, key, pred);
+
+        for (i = 0; i < level; i++) {
+                struct hc_link *next = pred[i]->next;
+                node->link[i].next = next;
+                node->link[i].key = pred[i]->key;
+                pred[i]->next = &node->link[i];
+                pred[i]->key = key;
+                *hc_prev(list, &node->link[i], i) = pred[i];
+                *hc_prev(list, next, i) = &node->link[i];
+        }
+        list->count++;
+
+        return node;
+}
+
+/* Remove all the nodes with the key, we allow nodes with same key. */
+static void hc_skiplist_remove(struct hc_skiplist *list, hc_key_t key)
+{
+        int i, level;
+        struct hc_node *node;
+        struct hc_link *pred[MAX_LEVEL];
+
+        __hc_find(list, key, pred);
+        while (pred[0]->next != &list->head[0] && SKIPLIST_KEY_CMP(pred[0]->key, key) == 0) {
+                node = hc_entry(pred[0]->next, 0);
+                level = hc_slab_of(node)->level;
+                for (i = 0; i < level; i++) {
+                        struct hc_link *next = node->link[i].next;
+                        pred[i]->next = next;
+                        pred[i]->key = node->link[i].key;
+                        *hc_prev(list, next, i) = pred[i];
+                }
+                hc_node_delete(list, node);
+                list->count--;
+        }
+
+        while (list->level > 1 && list->head[list->level - 1].next == &list->head[list->level - 1]) {
+                list->level--;
+        }
+}
+
+/* Reverse walk on level 0 through the cold backward pointers. */
+static struct hc_node *hc_skiplist_last(struct hc_skiplist *list)
+{
+        struct hc_link *link = list->head_prev[0];
+        return link == &list->head[0] ? NULL : hc_entry(link, 0);
+}
+
+static struct hc_node *hc_skiplist_prev(struct hc_skiplist *list, struct hc_node *node)
+{
+        struct hc_link *link = *hc_prev(list, &node->link[0], 0);
+        return link == &list->head[0] ? NULL : hc_entry(link, 0);
+}
+
+#endif  /* _SKIPLIST_HOTCOLD_H */
@@ -0,0 +1,108 @@
+/*
+* Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "skiplist.h"
+#include "skiplist_hotcold.h"
+#include "skiplist_perf.h"
+
+#define N 2 * 1024 * 1024
+
+int
+main(void)
+{
+    int i;
+    struct phase ph;
+
+    int *key = malloc(N * sizeof(int));
+    if (key == NULL) {
+        exit(-1);
+    }
+
+    struct skiplist *list = skiplist_new();
+    struct hc_skiplist *hc = hc_skiplist_new();
+    if (list == NULL || hc == NULL) {
+        exit(-1);
+    }
+
+    srandom(time(NULL));
+    for (i = 0; i < N; i++) {
+        key[i] = (int)random();
+    }
+
+    printf("Test start!\n");
+    printf("Add %d nodes...\n", N);
+    printf("skiplist.h:         ");
+    phase_start(&ph);
+    for (i = 0; i < N; i++) {
+        skiplist_insert(list, key[i], key[i]);
+    }
+    phase_end(&ph, N);
+    printf("skiplist_hotcold.h: ");
+    phase_start(&ph);
+    for (i = 0; i < N; i++) {
+        hc_skiplist_insert(hc, key[i], key[i]);
+    }
+    phase_end(&ph, N);
+
+    printf("Now search each node...\n");
+    printf("skiplist.h:         ");
+    phase_start(&ph);
+    for (i = 0; i < N; i++) {
+        if (skiplist_search(list, key[i]) == NULL) {
+            printf("Not found:0x%08x\n", key[i]);
+        }
+    }
+    phase_end(&ph, N);
+    printf("skiplist_hotcold.h: ");
+    phase_start(&ph);
+    for (i = 0; i < N; i++) {
+        struct hc_node *node = hc_skiplist_search(hc, key[i]);
+        if (node == NULL || node->value != key[i]) {
+            printf("Not found:0x%08x\n", key[i]);
+        }
+    }
+    phase_end(&ph, N);
+
+    /* The cold backward pointers must still describe the list in reverse */
+    struct hc_node *node = hc_skiplist_last(hc);
+    for (i = 0; node != NULL; i++) {
+        struct hc_node *prev = hc_skiplist_prev(hc, node);
+        if (prev != NULL && prev->key > node->key) {
+            printf("Out of order:0x%08x\n", node->key);
+        }
+        node = prev;
+    }
+    if (i != hc->count) {
+        printf("Reverse walk found %d of %d nodes\n", i, hc->count);
+    }
+
+    printf("Now remove all nodes...\n");
+    printf("skiplist.h:         ");
+    phase_start(&ph);
+    for (i = 0; i < N; i++) {
+        skiplist_remove(list, key[i]);
+    }
+    phase_end(&ph, N);
+    printf("skiplist_hotcold.h: ");
+    phase_start(&ph);
+    for (i = 0; i < N; i++) {
+        hc_skiplist_remove(hc, key[i]);
+    }
+    phase_end(&ph, N);
+    if (hc->count != 0) {
+        printf("%d nodes left\n", hc->count);
+    }
+
+    printf("End of Test.\n");
+    skiplist_delete(list);
+    hc_skiplist_delete(hc);
+
+    free(key);
+
+    return 0;
+}
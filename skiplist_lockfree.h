@@ -0,0 +1,498 @@
+/*
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ */
+
+#ifndef _SKIPLIST_LOCKFREE_H
+#define _SKIPLIST_LOCKFREE_H
+
+/*
+ * Lock-free skiplist in the style of Fraser and Herlihy-Shavit.
+ *
+ * Every level is a singly linked list whose next pointers are updated with
+ * CAS. The lowest bit of a next pointer marks the node owning it as deleted
+ * at that level. A node is removed logically by marking its pointers from the
+ * top level down, the thread that marks level 0 owns the removal, and any
+ * traversal that meets a marked node snips it out of the level.
+ *
+ * Unlinked nodes are reclaimed with epochs: every operation runs inside a
+ * critical section tagged with the global epoch, and a node retired in epoch
+ * e is freed only after the global epoch reaches e + 2, when no thread can
+ * still hold a reference to it.
+ *
+ * Keys are unique in this variant. Each thread registers once through
+ * lf_thread_join() and passes its handle to every call.
+ */
+
+#ifndef MAX_LEVEL
+#define MAX_LEVEL 32  /* Should be enough for 2^32 elements */
+#endif
+
+#ifndef SKIPLIST_KEY_TYPE
+#define SKIPLIST_KEY_TYPE int
+#endif
+
+#ifndef SKIPLIST_VALUE_TYPE
+#define SKIPLIST_VALUE_TYPE int
+#endif
+
+#ifndef SKIPLIST_KEY_CMP
+#define SKIPLIST_KEY_CMP(a, b) (((a) > (b)) - ((a) < (b)))
+#endif
+
+#ifndef SKIPLIST_P_SHIFT
+#define SKIPLIST_P_SHIFT 2  /* promotion probability p = 1/2^SKIPLIST_P_SHIFT: 1, 2 or 3 */
+#endif
+
+typedef SKIPLIST_KEY_TYPE lf_key_t;
+typedef SKIPLIST_VALUE_TYPE lf_value_t;
+
+#define LF_RETIRE_THRESHOLD 64  /* retirements between epoch advance attempts */
+
+#define lf_load(ptr)            __atomic_load_n(ptr, __ATOMIC_ACQUIRE)
+#define lf_store(ptr, val)      __atomic_store_n(ptr, val, __ATOMIC_RELEASE)
+#define lf_cas(ptr, old, new) \
+        __atomic_compare_exchange_n(ptr, old, new, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)
+
+#define lf_marked(next)         ((next) & 1)
+#define lf_ptr(next)            ((struct lf_node *)((next) & ~(size_t)1))
+
+struct lf_node {
+        lf_key_t key;
+        lf_value_t value;
+        int level;
+        int refs;                       /* inserter + remover, see lf_release() */
+        struct lf_node *retire_next;    /* chain in a limbo list */
+        size_t next[0];                 /* struct lf_node * | mark bit */
+};
+
+struct lf_thread {
+        struct lf_thread *next;
+        size_t epoch;                   /* (global epoch << 1) | 1 when active */
+        int in_use;
+        int retired;
+        unsigned long long rand;
+        size_t limbo_epoch[3];
+        struct lf_node *limbo[3];
+};
+
+struct lf_skiplist {
+        struct lf_node *head;
+        int level;
+        long count;
+        size_t epoch;
+        size_t seed;
+        struct lf_thread *threads;
+};
+
+static struct lf_node *
+lf_node_new(int level, lf_key_t key, lf_value_t value)
+{
+        struct lf_node *node;
+        node = (struct lf_node *)malloc(sizeof(*node) + level * sizeof(size_t));
+        if (node != NULL) {
+                node->key = key;
+                node->value = value;
+                node->level = level;
+                node->refs = 2;
+                node->retire_next = NULL;
+        }
+        return node;
+}
+
+static struct lf_skiplist *lf_skiplist_new(void)
+{
+        int i;
+        struct lf_skiplist *list = (struct lf_skiplist *)malloc(sizeof(*list));
+        if (list != NULL) {
+                list->head = (struct lf_node *)malloc(sizeof(struct lf_node) +
+                                                      MAX_LEVEL * sizeof(size_t));
+                if (list->head == NULL) {
+                        free(list);
+                        return NULL;
+                }
+                for (i = 0; i < MAX_LEVEL; i++) {
+                        list->head->next[i] = 0;
+                }
+                list->head->level = MAX_LEVEL;
+                list->level = 1;
+                list->count = 0;
+                list->epoch = 0;
+                list->seed = 0;
+                list->threads = NULL;
+        }
+        return list;
+}
+
+static void lf_free_limbo(struct lf_thread *thr, int idx)
+{
+        struct lf_node *node, *n;
+        for (node = thr->limbo[idx]; node != NULL; node = n) {
+                n = node->retire_next;
+                free(node);
+        }
+        thr->limbo[idx] = NULL;
+}
+
+/* Must not run concurrently with any other operation on the list. */
+static void lf_skiplist_delete(struct lf_skiplist *list)
+{
+        int i;
+        struct lf_node *node, *n;
+        struct lf_thread *thr, *tn;
+
+        for (node = lf_ptr(list->head->next[0]); node != NULL; node = n) {
+                n = lf_ptr(node->next[0]);
+                free(node);
+        }
+        for (thr = list->threads; thr != NULL; thr = tn) {
+                tn = thr->next;
+                for (i = 0; i < 3; i++) {
+                        lf_free_limbo(thr, i);
+                }
+                free(thr);
+        }
+        free(list->head);
+        free(list);
+}
+
+/* Threads joining afterwards draw their levels from streams derived from
+ * seed, in join order. Call before the first lf_thread_join(). */
+static void lf_skiplist_seed(struct lf_skiplist *list, unsigned long long seed)
+{
+        list->seed = (size_t)seed;
+}
+
+/* Register the calling thread, reusing a handle released by lf_thread_leave(). */
+static struct lf_thread *lf_thread_join(struct lf_skiplist *list)
+{
+        int i, unused;
+        struct lf_thread *thr;
+        size_t seed;
+
+        for (thr = lf_load(&list->threads); thr != NULL; thr = thr->next) {
+                unused = 0;
+                if (lf_load(&thr->in_use) == 0 && lf_cas(&thr->in_use, &unused, 1)) {
+                        return thr;
+                }
+        }
+
+        thr = (struct lf_thread *)malloc(sizeof(*thr));
+        if (thr == NULL) {
+                return NULL;
+        }
+        thr->epoch = 0;
+        thr->in_use = 1;
+        thr->retired = 0;
+        for (i = 0; i < 3; i++) {
+                thr->limbo_epoch[i] = 0;
+                thr->limbo[i] = NULL;
+        }
+
+        /* splitmix64 of a per-list sequence gives each thread its own stream */
+        seed = __atomic_add_fetch(&list->seed, 1, __ATOMIC_RELAXED);
+        thr->rand = (unsigned long long)seed * 0x9e3779b97f4a7c15ULL;
+        thr->rand = (thr->rand ^ (thr->rand >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        thr->rand = (thr->rand ^ (thr->rand >> 27)) * 0x94d049bb133111ebULL;
+        thr->rand ^= thr->rand >> 31;
+        if (thr->rand == 0) {
+                thr->rand = 1;
+        }
+
+        thr->next = lf_load(&list->threads);
+        while (!lf_cas(&list->threads, &thr->next, thr)) {
+                ;
+        }
+        return thr;
+}
+
+/* The handle stays registered, its pending retirements are freed by the next
+ * thread that joins with it or by lf_skiplist_delete(). */
+static void lf_thread_leave(struct lf_thread *thr)
+{
+        lf_store(&thr->in_use, 0);
+}
+
+/* Every SKIPLIST_P_SHIFT trailing zero bits of a draw promote once more, up
+ * to log_1/p(count) + 1 levels. */
+static int lf_random_level(struct lf_skiplist *list, struct lf_thread *thr)
+{
+        int level, cap;
+        unsigned long long x = thr->rand;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        thr->rand = x;
+
+        level = __builtin_ctzll(x) / SKIPLIST_P_SHIFT + 1;
+        cap = (64 - __builtin_clzll((unsigned long long)__atomic_load_n(&list->count, __ATOMIC_RELAXED) + 1)) / SKIPLIST_P_SHIFT + 1;
+        if (cap > MAX_LEVEL) {
+                cap = MAX_LEVEL;
+        }
+        return level < cap ? level : cap;
+}
+
+static void lf_try_advance(struct lf_skiplist *list)
+{
+        struct lf_thread *thr;
+        size_t epoch = lf_load(&list->epoch);
+
+        for (thr = lf_load(&list->threads); thr != NULL; thr = thr->next) {
+                size_t e = lf_load(&thr->epoch);
+                if ((e & 1) && (e >> 1) != epoch) {
+                        return;
+                }
+        }
+        lf_cas(&list->epoch, &epoch, epoch + 1);
+}
+
+static void lf_reclaim(struct lf_thread *thr, size_t epoch)
+{
+        int i;
+        for (i = 0; i < 3; i++) {
+                if (thr->limbo[i] != NULL && thr->limbo_epoch[i] + 2 <= epoch) {
+                        lf_free_limbo(thr, i);
+                }
+        }
+}
+
+static void lf_enter(struct lf_skiplist *list, struct lf_thread *thr)
+{
+        size_t epoch = lf_load(&list->epoch);
+        __atomic_store_n(&thr->epoch, (epoch << 1) | 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        lf_reclaim(thr, epoch);
+}
+
+static void lf_exit(struct lf_thread *thr)
+{
+        lf_store(&thr->epoch, 0);
+}
+
+/* Called once the node is unreachable at every level. The epoch is read after
+ * the unlink, so any thread that may still see the node is active in an epoch
+ * not later than this one. */
+static void lf_retire(struct lf_skiplist *list, struct lf_thread *thr, struct lf_node *node)
+{
+        size_t epoch;
+        int idx;
+
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        epoch = lf_load(&list->epoch);
+        idx = epoch % 3;
+        if (thr->limbo_epoch[idx] != epoch) {
+                /* the bucket holds nodes of epoch - 3 or older */
+                lf_free_limbo(thr, idx);
+                thr->limbo_epoch[idx] = epoch;
+        }
+        node->retire_next = thr->limbo[idx];
+        thr->limbo[idx] = node;
+
+        if (++thr->retired >= LF_RETIRE_THRESHOLD) {
+                thr->retired = 0;
+                lf_try_advance(list);
+                lf_reclaim(thr, lf_load(&list->epoch));
+        }
+}
+
+/* Fill preds[]/succs[] for key, snipping every marked node on the way.
+ * With upto set the walk also passes nodes equal to key, which makes sure
+ * that a marked node with this key is unlinked from every level. */
+static int
+__lf_find(struct lf_skiplist *list, lf_key_t key,
+          struct lf_node **preds, struct lf_node **succs, int upto)
+{
+        int i, cmp;
+        size_t next;
+        struct lf_node *pred, *curr;
+
+retry:
+        pred = list->head;
+        for (i = lf_load(&list->level) - 1; i >= 0; i--) {
+                curr = lf_ptr(lf_load(&pred->next[i]));
+                while (curr != NULL) {
+                        next = lf_load(&curr->next[i]);
+                        if (lf_marked(next)) {
+                                size_t expected = (size_t)curr;
+                                if (!lf_cas(&pred->next[i], &expected, next & ~(size_t)1)) {
+                                        goto retry;
+                                }
+                                curr = lf_ptr(next);
+                                continue;
+                        }
+                        cmp = SKIPLIST_KEY_CMP(curr->key, key);
+                        if (cmp > 0 || (cmp == 0 && !upto)) {
+                                break;
+                        }
+                        pred = curr;
+                        curr = lf_ptr(next);
+                }
+                preds[i] = pred;
+                succs[i] = curr;
+        }
+
+        return succs[0] != NULL && SKIPLIST_KEY_CMP(succs[0]->key, key) == 0;
+}
+
+/* Both the inserter and the remover drop a reference once they are done
+ * linking or unlinking, the last one retires the node. */
+static void
+lf_release(struct lf_skiplist *list, struct lf_thread *thr, struct lf_node *node)
+{
+        if (__atomic_sub_fetch(&node->refs, 1, __ATOMIC_ACQ_REL) == 0) {
+                lf_retire(list, thr, node);
+        }
+}
+
+/* Returns 1 if inserted, 0 if the key exists and -1 when out of memory. */
+static int
+lf_skiplist_insert(struct lf_skiplist *list, struct lf_thread *thr,
+                   lf_key_t key, lf_value_t value)
+{
+        int i, top;
+        size_t next, expected;
+        struct lf_node *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+        int level = lf_random_level(list, thr);
+        struct lf_node *node = lf_node_new(level, key, value);
+        if (node == NULL) {
+                return -1;
+        }
+
+        top = lf_load(&list->level);
+        while (level > top && !lf_cas(&list->level, &top, level)) {
+                ;
+        }
+
+        lf_enter(list, thr);
+        for (;;) {
+                if (__lf_find(list, key, preds, succs, 0)) {
+                        lf_exit(thr);
+                        free(node);
+                        return 0;
+                }
+                for (i = 0; i < level; i++) {
+                        __atomic_store_n(&node->next[i], (size_t)succs[i], __ATOMIC_RELAXED);
+                }
+                expected = (size_t)succs[0];
+                if (lf_cas(&preds[0]->next[0], &expected, (size_t)node)) {
+                        break;
+                }
+        }
+        __atomic_add_fetch(&list->count, 1, __ATOMIC_RELAXED);
+
+        for (i = 1; i < level; i++) {
+                for (;;) {
+                        next = lf_load(&node->next[i]);
+                        if (lf_marked(next)) {
+                                goto out;
+                        }
+                        if (next != (size_t)succs[i] &&
+                            !lf_cas(&node->next[i], &next, (size_t)succs[i])) {
+                                goto out;
+                        }
+                        expected = (size_t)succs[i];
+                        if (lf_cas(&preds[i]->next[i], &expected, (size_t)node)) {
+                                break;
+                        }
+                        __lf_find(list, key, preds, succs, 0);
+                        if (succs[0] != node) {
+                                goto out;
+                        }
+                }
+        }
+
+out:
+        /* A remover may have finished its unlink before an upper level was
+         * linked here, so unlink again on its behalf. */
+        if (lf_marked(lf_load(&node->next[0]))) {
+                __lf_find(list, key, preds, succs, 1);
+        }
+        lf_release(list, thr, node);
+        lf_exit(thr);
+        return 1;
+}
+
+/* Returns 1 if the key was found and removed by this call. */
+static int
+lf_skiplist_remove(struct lf_skiplist *list, struct lf_thread *thr, lf_key_t key)
+{
+        int i;
+        size_t next;
+        struct lf_node *node, *preds[MAX_LEVEL], *succs[MAX_LEVEL];
+
+        lf_enter(list, thr);
+        if (!__lf_find(list, key, preds, succs, 0)) {
+                lf_exit(thr);
+                return 0;
+        }
+
+        node = succs[0];
+        for (i = node->level - 1; i > 0; i--) {
+                next = lf_load(&node->next[i]);
+                while (!lf_marked(next) && !lf_cas(&node->next[i], &next, next | 1)) {
+                        ;
+                }
+        }
+
+        next = lf_load(&node->next[0]);
+        for (;;) {
+                if (lf_marked(next)) {
+                        /* another thread owns the removal */
+                        lf_exit(thr);
+                        return 0;
+                }
+                if (lf_cas(&node->next[0], &next, next | 1)) {
+                        break;
+                }
+        }
+
+        __atomic_sub_fetch(&list->count, 1, __ATOMIC_RELAXED);
+        __lf_find(list, key, preds, succs, 1);
+        lf_release(list, thr, node);
+        lf_exit(thr);
+        return 1;
+}
+
+/* Wait-free lookup, marked nodes are skipped but left for writers to snip.
+ * Returns 1 and stores the value if the key is present. */
+static int
+lf_skiplist_search(struct lf_skiplist *list, struct lf_thread *thr,
+                   lf_key_t key, lf_value_t *value)
+{
+        int i, found = 0;
+        size_t next;
+        struct lf_node *pred, *curr = NULL;
+
+        lf_enter(list, thr);
+        pred = list->head;
+        for (i = lf_load(&list->level) - 1; i >= 0; i--) {
+                curr = lf_ptr(lf_load(&pred->next[i]));
+                while (curr != NULL) {
+                        next = lf_load(&curr->next[i]);
+                        if (lf_marked(next)) {
+                                curr = lf_ptr(next);
+                                continue;
+                        }
+                        if (SKIPLIST_KEY_CMP(curr->key, key) >= 0) {
+                                break;
+                        }
+                        pred = curr;
+                        curr = lf_ptr(next);
+                }
+        }
+
+        if (curr != NULL && SKIPLIST_KEY_CMP(curr->key, key) == 0) {
+                if (value != NULL) {
+                        *value = curr->value;
+                }
+                found = 1;
+        }
+        lf_exit(thr);
+        return found;
+}
+
+static long lf_skiplist_count(struct lf_skiplist *list)
+{
+        return __atomic_load_n(&list->count, __ATOMIC_RELAXED);
+}
+
+#endif  /* _SKIPLIST_LOCKFREE_H */
@@ -0,0 +1,231 @@
+/*
+* Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "skiplist_lockfree.h"
+
+#define N 2 * 1024 * 1024
+#define MAX_THREADS 16
+#define BENCH_OPS 1024 * 1024
+#define HOT_KEYS 1024
+
+struct worker {
+    pthread_t tid;
+    int id;
+    int nthreads;
+    int ops;
+    long hits;
+    struct lf_skiplist *list;
+};
+
+static long elapsed_ms(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000 + (end->tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static unsigned int next_rand(unsigned int *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+/* Each thread inserts its own stripe of keys. */
+static void *insert_stripe(void *arg)
+{
+    int i;
+    struct worker *w = arg;
+    struct lf_thread *thr = lf_thread_join(w->list);
+    for (i = w->id; i < N; i += w->nthreads) {
+        if (lf_skiplist_insert(w->list, thr, i, i) != 1) {
+            printf("Insert failed:%d\n", i);
+        }
+    }
+    lf_thread_leave(thr);
+    return NULL;
+}
+
+/* Remove even keys of the stripe while re-inserting odd ones, which must fail. */
+static void *remove_even(void *arg)
+{
+    int i, value;
+    struct worker *w = arg;
+    struct lf_thread *thr = lf_thread_join(w->list);
+    for (i = w->id; i < N; i += w->nthreads) {
+        if (i & 1) {
+            if (lf_skiplist_insert(w->list, thr, i, i) != 0) {
+                printf("Duplicate inserted:%d\n", i);
+            }
+            if (!lf_skiplist_search(w->list, thr, i, &value) || value != i) {
+                printf("Not found:%d\n", i);
+            }
+        } else if (!lf_skiplist_remove(w->list, thr, i)) {
+            printf("Remove failed:%d\n", i);
+        }
+    }
+    lf_thread_leave(thr);
+    return NULL;
+}
+
+/* All threads fight over the same few keys. */
+static void *contend(void *arg)
+{
+    int i;
+    struct worker *w = arg;
+    unsigned int seed = w->id + 1;
+    struct lf_thread *thr = lf_thread_join(w->list);
+    for (i = 0; i < w->ops; i++) {
+        unsigned int r = next_rand(&seed);
+        int key = r % HOT_KEYS;
+        switch ((r >> 16) % 3) {
+        case 0:
+            lf_skiplist_insert(w->list, thr, key, key);
+            break;
+        case 1:
+            lf_skiplist_remove(w->list, thr, key);
+            break;
+        default:
+            w->hits += lf_skiplist_search(w->list, thr, key, NULL);
+            break;
+        }
+    }
+    lf_thread_leave(thr);
+    return NULL;
+}
+
+/* 80% search, 10% insert, 10% remove over the prefilled key space. */
+static void *mixed(void *arg)
+{
+    int i;
+    struct worker *w = arg;
+    unsigned int seed = w->id * 7919 + 1;
+    struct lf_thread *thr = lf_thread_join(w->list);
+    for (i = 0; i < w->ops; i++) {
+        unsigned int r = next_rand(&seed);
+        int key = r % (N);
+        int op = (r >> 24) % 10;
+        if (op == 0) {
+            lf_skiplist_insert(w->list, thr, key, key);
+        } else if (op == 1) {
+            lf_skiplist_remove(w->list, thr, key);
+        } else {
+            w->hits += lf_skiplist_search(w->list, thr, key, NULL);
+        }
+    }
+    lf_thread_leave(thr);
+    return NULL;
+}
+
+static void run(struct lf_skiplist *list, int nthreads, int ops, void *(*fn)(void *))
+{
+    int i;
+    struct worker w[MAX_THREADS];
+    for (i = 0; i < nthreads; i++) {
+        w[i].id = i;
+        w[i].nthreads = nthreads;
+        w[i].ops = ops;
+        w[i].hits = 0;
+        w[i].list = list;
+        pthread_create(&w[i].tid, NULL, fn, &w[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(w[i].tid, NULL);
+    }
+}
+
+int
+main(void)
+{
+    int i, nthreads = 4;
+    long present;
+    struct timespec start, end;
+    struct lf_thread *thr;
+
+    struct lf_skiplist *list = lf_skiplist_new();
+    struct lf_skiplist *twin = lf_skiplist_new();
+    struct lf_skiplist *other = lf_skiplist_new();
+    if (list == NULL || twin == NULL || other == NULL) {
+        exit(-1);
+    }
+
+    /* The seed drives the towers, so a run can be repeated with SKIPLIST_SEED */
+    unsigned int seed = getenv("SKIPLIST_SEED") ? (unsigned int)strtoul(getenv("SKIPLIST_SEED"), NULL, 0)
+                                              : (unsigned int)time(NULL);
+    lf_skiplist_seed(list, seed);
+    lf_skiplist_seed(twin, seed);
+    lf_skiplist_seed(other, seed + 1ULL);
+    thr = lf_thread_join(list);
+
+    /* the first thread to join gets the same level stream under the same
+     * seed and another one under another seed */
+    struct lf_thread *twin_thr = lf_thread_join(twin);
+    struct lf_thread *other_thr = lf_thread_join(other);
+    if (twin_thr->rand != thr->rand || other_thr->rand == thr->rand) {
+        printf("Level streams do not follow the seed\n");
+    }
+    lf_thread_leave(twin_thr);
+    lf_thread_leave(other_thr);
+    lf_skiplist_delete(twin);
+    lf_skiplist_delete(other);
+
+    printf("Test start! seed:%u\n", seed);
+    printf("Add %d nodes with %d threads...\n", N, nthreads);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run(list, nthreads, 0, insert_stripe);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", elapsed_ms(&start, &end));
+    if (lf_skiplist_count(list) != N) {
+        printf("Wrong count:%ld\n", lf_skiplist_count(list));
+    }
+
+    printf("Now remove even nodes with %d threads...\n", nthreads);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    run(list, nthreads, 0, remove_even);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", elapsed_ms(&start, &end));
+    for (i = 0; i < N; i++) {
+        if (lf_skiplist_search(list, thr, i, NULL) != (i & 1)) {
+            printf("Wrong presence:%d\n", i);
+        }
+    }
+    if (lf_skiplist_count(list) != N / 2) {
+        printf("Wrong count:%ld\n", lf_skiplist_count(list));
+    }
+
+    printf("Now contend on %d keys with %d threads...\n", HOT_KEYS, nthreads);
+    for (i = 0; i < N; i++) {
+        lf_skiplist_remove(list, thr, i);
+    }
+    run(list, nthreads, BENCH_OPS, contend);
+    present = 0;
+    for (i = 0; i < HOT_KEYS; i++) {
+        present += lf_skiplist_search(list, thr, i, NULL);
+    }
+    if (present != lf_skiplist_count(list)) {
+        printf("Count %ld does not match %ld present keys\n",
+               lf_skiplist_count(list), present);
+    }
+
+    printf("Throughput of 80%% search / 10%% insert / 10%% remove:\n");
+    for (i = 0; i < N; i += 2) {
+        lf_skiplist_insert(list, thr, i, i);
+    }
+    for (nthreads = 1; nthreads <= MAX_THREADS; nthreads *= 2) {
+        long ms;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        run(list, nthreads, BENCH_OPS / nthreads, mixed);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        ms = elapsed_ms(&start, &end);
+        printf("threads:%2d time span: %ldms %.2f Mops/s\n", nthreads, ms,
+               ms ? (double)(BENCH_OPS / nthreads * nthreads) / ms / 1000 : 0.0);
+    }
+
+    printf("End of Test.\n");
+    lf_thread_leave(thr);
+    lf_skiplist_delete(list);
+
+    return 0;
+}
@@ -0,0 +1,72 @@
+/*
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ */
+
+#ifndef _SKIPLIST_PERF_H
+#define _SKIPLIST_PERF_H
+
+/*
+ * Timing of a test phase, with the last level cache misses it caused when
+ * perf events are available. Shared by the layout tests.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+struct phase {
+    struct timespec start;
+    int fd;
+};
+
+static void phase_start(struct phase *ph)
+{
+    ph->fd = -1;
+#ifdef __linux__
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = PERF_COUNT_HW_CACHE_MISSES;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    ph->fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    if (ph->fd >= 0) {
+        ioctl(ph->fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(ph->fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+    clock_gettime(CLOCK_MONOTONIC, &ph->start);
+}
+
+/* Print the time span and the misses per op of the ops the phase ran. */
+static void phase_end(struct phase *ph, long ops)
+{
+    struct timespec end;
+    long long misses = -1;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+#ifdef __linux__
+    if (ph->fd >= 0) {
+        ioctl(ph->fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(ph->fd, &misses, sizeof(misses)) != sizeof(misses)) {
+            misses = -1;
+        }
+        close(ph->fd);
+    }
+#endif
+    printf("time span: %ldms", (end.tv_sec - ph->start.tv_sec)*1000 + (end.tv_nsec - ph->start.tv_nsec)/1000000);
+    if (misses >= 0) {
+        printf(" cache misses: %lld (%.2f per op)\n", misses, (double)misses / ops);
+    } else {
+        printf(" cache misses: n/a\n");
+    }
+}
+
+#endif  /* _SKIPLIST_PERF_H */
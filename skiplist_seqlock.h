@@ -0,0 +1,304 @@
+/*
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ */
+
+#ifndef _SKIPLIST_SEQLOCK_H
+#define _SKIPLIST_SEQLOCK_H
+
+/*
+ * Skiplist with optimistic reads for read-mostly workloads.
+ *
+ * Writers serialize on a mutex and make the sequence count odd while they
+ * modify the list. Readers take no lock and write nothing shared: they note
+ * the sequence, run the plain skiplist_with_rank.h descent and retry if the
+ * sequence has moved meanwhile, so a result is only returned when no write
+ * overlapped it.
+ *
+ * A reader racing with a writer may still be walking a node the writer has
+ * just unlinked. skiplist_with_rank.h publishes new links only once they are
+ * filled in and leaves the links of unlinked nodes pointing back into the
+ * list, so such a walk always moves forward and ends, and the nodes go
+ * through epoch based reclamation rather than straight back to the free
+ * lists: a reader announces the epoch it starts in, unlinked nodes are
+ * stamped with the epoch they were retired in, and a node is reused only
+ * once every active reader started in a later epoch.
+ *
+ * Each reader thread registers once with sq_reader_new() and passes the slot
+ * to the lookups, and gives it back with sq_reader_release() when it is done;
+ * a slot is a cache line of its own. This header includes
+ * skiplist_with_rank.h itself, include it instead.
+ */
+
+#include <pthread.h>
+#include <sched.h>
+
+struct skiplist;
+struct skipnode;
+static void sq_retire(struct skiplist *list, struct skipnode *node);
+#define SKIPLIST_RETIRE(list, node) sq_retire(list, node)
+
+#include "skiplist_with_rank.h"
+
+#ifndef SQ_MAX_READERS
+#define SQ_MAX_READERS 128
+#endif
+
+#ifndef SQ_RECLAIM_BATCH
+#define SQ_RECLAIM_BATCH 256  /* retired nodes that trigger a reclaim pass */
+#endif
+
+#ifndef SQ_SPINS
+#define SQ_SPINS 128  /* pauses before a reader waiting on a writer yields */
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#define sq_cpu_relax() __builtin_ia32_pause()
+#else
+#define sq_cpu_relax() do { } while (0)
+#endif
+
+struct sq_reader {
+        unsigned long long epoch;       /* epoch of the read in progress, 0 when idle */
+        int in_use;
+} __attribute__((aligned(64)));
+
+struct sq_retired {
+        struct skipnode *node;
+        unsigned long long epoch;
+};
+
+struct sq_skiplist {
+        unsigned long long seq __attribute__((aligned(64)));  /* odd while a writer is in */
+        unsigned long long epoch __attribute__((aligned(64)));
+        int readers;                    /* slots ever handed out, the ones reclaim scans */
+        pthread_mutex_t lock;
+        struct skiplist *list;
+        struct sq_retired *retired;
+        int nretired, cap;
+        struct sq_reader reader[SQ_MAX_READERS];
+};
+
+/* The list being written by this thread, which its retired nodes go to */
+static __thread struct sq_skiplist *sq_writer;
+
+static struct sq_skiplist *sq_skiplist_new(void)
+{
+        struct sq_skiplist *sq;
+        if (posix_memalign((void **)&sq, 64, sizeof(*sq))) {
+                return NULL;
+        }
+        memset(sq, 0, sizeof(*sq));
+        sq->list = skiplist_new();
+        if (sq->list == NULL) {
+                free(sq);
+                return NULL;
+        }
+        sq->epoch = 1;
+        pthread_mutex_init(&sq->lock, NULL);
+        return sq;
+}
+
+/* No reader may be active. */
+static void sq_skiplist_delete(struct sq_skiplist *sq)
+{
+        skiplist_delete(sq->list);
+        pthread_mutex_destroy(&sq->lock);
+        free(sq->retired);
+        free(sq);
+}
+
+/* Register a reader thread, reusing a slot released by sq_reader_release().
+ * Returns the slot or -1 if all are taken. */
+static int sq_reader_new(struct sq_skiplist *sq)
+{
+        int slot, unused, n;
+
+        for (slot = 0; slot < SQ_MAX_READERS; slot++) {
+                unused = 0;
+                if (__atomic_load_n(&sq->reader[slot].in_use, __ATOMIC_RELAXED) == 0 &&
+                    __atomic_compare_exchange_n(&sq->reader[slot].in_use, &unused, 1, 0,
+                                                __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                        break;
+                }
+        }
+        if (slot == SQ_MAX_READERS) {
+                return -1;
+        }
+        n = __atomic_load_n(&sq->readers, __ATOMIC_RELAXED);
+        while (n <= slot && !__atomic_compare_exchange_n(&sq->readers, &n, slot + 1, 0,
+                                                         __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                ;
+        }
+        return slot;
+}
+
+/* The slot must be idle, outside any lookup. */
+static void sq_reader_release(struct sq_skiplist *sq, int slot)
+{
+        __atomic_store_n(&sq->reader[slot].in_use, 0, __ATOMIC_RELEASE);
+}
+
+static void sq_retire(struct skiplist *list, struct skipnode *node)
+{
+        struct sq_skiplist *sq = sq_writer;
+        if (sq == NULL || sq->list != list) {
+                skipnode_free(list, node);
+                return;
+        }
+        if (sq->nretired == sq->cap) {
+                int cap = sq->cap ? sq->cap * 2 : SQ_RECLAIM_BATCH;
+                struct sq_retired *r = (struct sq_retired *)realloc(sq->retired, cap * sizeof(*r));
+                if (r == NULL) {
+                        /* readers may hold it and can not be waited for
+                         * inside the write, so the node is never reused */
+                        return;
+                }
+                sq->retired = r;
+                sq->cap = cap;
+        }
+        sq->retired[sq->nretired].node = node;
+        sq->retired[sq->nretired].epoch = sq->epoch;
+        sq->nretired++;
+}
+
+/* Start a new epoch and reuse the nodes retired before the oldest epoch any
+ * reader is still in. Called with the lock held. */
+static void sq_reclaim(struct sq_skiplist *sq)
+{
+        int i, j, n = __atomic_load_n(&sq->readers, __ATOMIC_RELAXED);
+        unsigned long long e, oldest;
+
+        /* pairs with the fence of sq_read_begin(): a reader either sees the
+         * nodes unlinked or is seen in its slot */
+        oldest = __atomic_add_fetch(&sq->epoch, 1, __ATOMIC_SEQ_CST);
+        for (i = 0; i < n && i < SQ_MAX_READERS; i++) {
+                e = __atomic_load_n(&sq->reader[i].epoch, __ATOMIC_SEQ_CST);
+                if (e != 0 && e < oldest) {
+                        oldest = e;
+                }
+        }
+        for (i = j = 0; i < sq->nretired; i++) {
+                if (sq->retired[i].epoch < oldest) {
+                        skipnode_free(sq->list, sq->retired[i].node);
+                } else {
+                        sq->retired[j++] = sq->retired[i];
+                }
+        }
+        sq->nretired = j;
+}
+
+static void sq_write_begin(struct sq_skiplist *sq)
+{
+        pthread_mutex_lock(&sq->lock);
+        __atomic_store_n(&sq->seq, sq->seq + 1, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        sq_writer = sq;
+}
+
+static void sq_write_end(struct sq_skiplist *sq)
+{
+        sq_writer = NULL;
+        __atomic_store_n(&sq->seq, sq->seq + 1, __ATOMIC_RELEASE);
+        if (sq->nretired >= SQ_RECLAIM_BATCH) {
+                sq_reclaim(sq);
+        }
+        pthread_mutex_unlock(&sq->lock);
+}
+
+static inline void sq_read_begin(struct sq_skiplist *sq, int slot)
+{
+        __atomic_store_n(&sq->reader[slot].epoch, __atomic_load_n(&sq->epoch, __ATOMIC_RELAXED),
+                         __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+static inline void sq_read_end(struct sq_skiplist *sq, int slot)
+{
+        __atomic_store_n(&sq->reader[slot].epoch, 0, __ATOMIC_RELEASE);
+}
+
+/* Sequence to read under: waits out a writer that is in, giving the CPU up
+ * if it takes long, as when the writer was preempted. */
+static inline unsigned long long sq_seq_begin(struct sq_skiplist *sq)
+{
+        int spins = 0;
+        unsigned long long seq;
+        while ((seq = __atomic_load_n(&sq->seq, __ATOMIC_ACQUIRE)) & 1) {
+                if (++spins < SQ_SPINS) {
+                        sq_cpu_relax();
+                } else {
+                        sched_yield();
+                }
+        }
+        return seq;
+}
+
+static inline int sq_seq_retry(struct sq_skiplist *sq, unsigned long long seq)
+{
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        return __atomic_load_n(&sq->seq, __ATOMIC_RELAXED) != seq;
+}
+
+static int sq_skiplist_insert(struct sq_skiplist *sq, sk_key_t key, sk_value_t value)
+{
+        struct skipnode *node;
+        sq_write_begin(sq);
+        node = skiplist_insert(sq->list, key, value);
+        sq_write_end(sq);
+        return node != NULL ? 0 : -1;
+}
+
+static void sq_skiplist_remove(struct sq_skiplist *sq, sk_key_t key)
+{
+        sq_write_begin(sq);
+        skiplist_remove(sq->list, key);
+        sq_write_end(sq);
+}
+
+static sk_rank_t sq_remove_in_range(struct sq_skiplist *sq, struct range_spec *range)
+{
+        sk_rank_t removed;
+        sq_write_begin(sq);
+        removed = remove_in_range(sq->list, range);
+        sq_write_end(sq);
+        return removed;
+}
+
+/* Copy the value of key into value, returns 0, or -1 if it is not there. */
+static int sq_skiplist_search(struct sq_skiplist *sq, int slot, sk_key_t key, sk_value_t *value)
+{
+        unsigned long long seq;
+        struct skipnode *node;
+        sk_value_t v;
+
+        sq_read_begin(sq, slot);
+        do {
+                seq = sq_seq_begin(sq);
+                node = skiplist_search_by_key(sq->list, key);
+                if (node != NULL) {
+                        v = node->value;
+                }
+        } while (sq_seq_retry(sq, seq));
+        sq_read_end(sq, slot);
+
+        if (node != NULL) {
+                *value = v;
+        }
+        return node != NULL ? 0 : -1;
+}
+
+static sk_rank_t sq_skiplist_key_rank(struct sq_skiplist *sq, int slot, sk_key_t key)
+{
+        unsigned long long seq;
+        sk_rank_t rank;
+
+        sq_read_begin(sq, slot);
+        do {
+                seq = sq_seq_begin(sq);
+                rank = skiplist_key_rank(sq->list, key);
+        } while (sq_seq_retry(sq, seq));
+        sq_read_end(sq, slot);
+        return rank;
+}
+
+#endif  /* _SKIPLIST_SEQLOCK_H */
@@ -0,0 +1,164 @@
+/*
+* Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "skiplist_seqlock.h"
+
+#define N 1024 * 1024
+#define MAX_THREADS 64
+#define BENCH_OPS 1024 * 1024
+#define WRITE_PERCENT 5
+
+struct worker {
+    pthread_t tid;
+    int id;
+    int ops;
+    int locked;         /* rwlock baseline instead of optimistic reads */
+    long misses;
+    const int *key;
+    struct sq_skiplist *sq;
+    pthread_rwlock_t *rwlock;
+};
+
+static long elapsed_ms(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000 + (end->tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static unsigned int next_rand(unsigned int *seed)
+{
+    *seed = *seed * 1103515245 + 12345;
+    return *seed >> 8;
+}
+
+/* Mostly lookups and ranks of keys that stay in the list, the rest inserts
+ * and removals of negative keys of the thread's own, so every lookup must
+ * hit with the right value whatever the writers do. */
+static void *run_mix(void *arg)
+{
+    int i, k;
+    struct worker *w = arg;
+    unsigned int seed = 0x9e3779b9 * (w->id + 1);
+    struct sq_skiplist *sq = w->sq;
+    int slot = sq_reader_new(sq);
+    sk_value_t value;
+
+    if (slot < 0) {
+        return NULL;
+    }
+    for (i = 0; i < w->ops; i++) {
+        unsigned int r = next_rand(&seed);
+        k = w->key[r % N];
+        if (r % 100 < WRITE_PERCENT) {
+            int neg = -(w->id * BENCH_OPS + i) - 1;
+            if (w->locked) {
+                pthread_rwlock_wrlock(w->rwlock);
+                skiplist_insert(sq->list, neg, 0);
+                skiplist_remove(sq->list, neg);
+                pthread_rwlock_unlock(w->rwlock);
+            } else {
+                sq_skiplist_insert(sq, neg, 0);
+                sq_skiplist_remove(sq, neg);
+            }
+        } else if (w->locked) {
+            struct skipnode *node;
+            pthread_rwlock_rdlock(w->rwlock);
+            node = r & 1 ? skiplist_search_by_key(sq->list, k) : NULL;
+            if (node == NULL ? skiplist_key_rank(sq->list, k) == 0 : node->value != ~k) {
+                w->misses++;
+            }
+            pthread_rwlock_unlock(w->rwlock);
+        } else if (r & 1) {
+            if (sq_skiplist_search(sq, slot, k, &value) < 0 || value != ~k) {
+                w->misses++;
+            }
+        } else if (sq_skiplist_key_rank(sq, slot, k) == 0) {
+            w->misses++;
+        }
+    }
+    sq_reader_release(sq, slot);
+    return NULL;
+}
+
+static long run(struct sq_skiplist *sq, const int *key, int nthreads, int locked)
+{
+    int i;
+    long misses = 0;
+    struct timespec start, end;
+    struct worker w[MAX_THREADS];
+    pthread_rwlock_t rwlock;
+
+    pthread_rwlock_init(&rwlock, NULL);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nthreads; i++) {
+        w[i].id = i;
+        w[i].ops = BENCH_OPS / nthreads;
+        w[i].locked = locked;
+        w[i].misses = 0;
+        w[i].key = key;
+        w[i].sq = sq;
+        w[i].rwlock = &rwlock;
+        pthread_create(&w[i].tid, NULL, run_mix, &w[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(w[i].tid, NULL);
+        misses += w[i].misses;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_rwlock_destroy(&rwlock);
+    if (misses != 0) {
+        printf("%ld lookups missed\n", misses);
+    }
+    return elapsed_ms(&start, &end);
+}
+
+int
+main(void)
+{
+    int i, threads;
+    long ms;
+
+    int *key = malloc(N * sizeof(int));
+    if (key == NULL) {
+        exit(-1);
+    }
+
+    struct sq_skiplist *sq = sq_skiplist_new();
+    if (sq == NULL) {
+        exit(-1);
+    }
+
+    srandom(time(NULL));
+    for (i = 0; i < N; i++) {
+        key[i] = (int)(random() & 0x7fffffff);
+        sq_skiplist_insert(sq, key[i], ~key[i]);
+    }
+
+    printf("Test start!\n");
+    printf("%d%% writes, %d ops per run\n", WRITE_PERCENT, BENCH_OPS);
+    for (threads = 1; threads <= MAX_THREADS; threads *= 2) {
+        ms = run(sq, key, threads, 1);
+        printf("%2d threads: rwlock %5ldms, ", threads, ms);
+        ms = run(sq, key, threads, 0);
+        printf("seqlock %5ldms\n", ms);
+    }
+    if (sq->list->count != N) {
+        printf("Count " SKIPLIST_RANK_FMT ", %d expected\n", sq->list->count, N);
+    }
+    printf("%d nodes waiting for readers\n", sq->nretired);
+    /* every run reuses the slots the last one released */
+    if (sq->readers > MAX_THREADS) {
+        printf("%d reader slots for at most %d threads\n", sq->readers, MAX_THREADS);
+    }
+
+    printf("End of Test.\n");
+    sq_skiplist_delete(sq);
+
+    free(key);
+
+    return 0;
+}
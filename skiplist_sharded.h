@@ -0,0 +1,398 @@
+/*
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ */
+
+#ifndef _SKIPLIST_SHARDED_H
+#define _SKIPLIST_SHARDED_H
+
+/*
+ * Sharded skiplist: the key space is split over independent lists from
+ * skiplist_with_rank.h, each behind its own read-write lock and drawing its
+ * levels from its own generator, so writers to different shards never meet.
+ *
+ * Keys are assigned either by range, shard i holding the keys from split
+ * point i - 1 up to but not including split point i, or by hash. Point
+ * operations lock one shard. Queries over the whole key order read-lock all
+ * the shards, always in index order, and combine the per-shard answers:
+ *
+ *   - by range, the shards are already in key order, so the global rank of
+ *     a key is the count of the shards before its own plus its rank there,
+ *     and rank r is found by walking the counts to the shard holding it, in
+ *     O(shards + log n). Range scans go through the shards in turn.
+ *   - by hash, the rank of a key sums the keys below it in every shard, in
+ *     O(shards log n). Rank r is selected by bisecting the shards around a
+ *     pivot node until one lands on r, and range scans merge the shards.
+ *     Equal keys always hash to the same shard, which keeps both exact.
+ *
+ * Hash sharding needs SKIPLIST_KEY_HASH(key), an unsigned hash of a key,
+ * which defaults to a multiplicative hash for the default int keys of
+ * skiplist_with_rank.h (SKIPLIST_KEY_INT).
+ */
+
+#include <pthread.h>
+
+#ifndef SKIPLIST_KEY_HASH
+#ifdef SKIPLIST_KEY_INT
+#define SKIPLIST_KEY_HASH(key) ((unsigned int)(((unsigned long long)(key) * 0x9e3779b97f4a7c15ULL) >> 32))
+#endif
+#endif
+
+#ifndef SH_MAX_SHARDS
+#define SH_MAX_SHARDS 256
+#endif
+
+#ifndef SH_MERGE_BATCH
+#define SH_MERGE_BATCH 32  /* pairs pulled from a shard at a time when merging */
+#endif
+
+struct sh_shard {
+        pthread_rwlock_t lock;
+        struct skiplist *list;
+} __attribute__((aligned(64)));  /* no false sharing between shard locks */
+
+struct sh_skiplist {
+        int nshards;
+        sk_key_t *splits;       /* nshards - 1 split points, NULL when sharded by hash */
+        struct sh_shard *shards;
+};
+
+/* Create a sharded list of nshards shards. With splits, an array of
+ * nshards - 1 ascending keys, the key space is split by range, and without
+ * by hash. The shards are seeded one after the other from seed. */
+static struct sh_skiplist *
+sh_skiplist_new(int nshards, const sk_key_t *splits, unsigned long long seed)
+{
+        int i;
+        struct sh_skiplist *sl;
+
+        if (nshards < 1 || nshards > SH_MAX_SHARDS) {
+                return NULL;
+        }
+#ifndef SKIPLIST_KEY_HASH
+        if (splits == NULL) {
+                return NULL;
+        }
+#endif
+        sl = (struct sh_skiplist *)malloc(sizeof(*sl));
+        if (sl == NULL) {
+                return NULL;
+        }
+        sl->nshards = nshards;
+        sl->splits = NULL;
+        if (posix_memalign((void **)&sl->shards, 64, nshards * sizeof(struct sh_shard))) {
+                free(sl);
+                return NULL;
+        }
+        for (i = 0; i < nshards; i++) {
+                pthread_rwlock_init(&sl->shards[i].lock, NULL);
+                sl->shards[i].list = skiplist_new();
+                if (sl->shards[i].list == NULL) {
+                        goto fail;
+                }
+                skiplist_seed(sl->shards[i].list, seed + i);
+        }
+        if (splits != NULL) {
+                sl->splits = (sk_key_t *)malloc((nshards - 1) * sizeof(sk_key_t) + 1);
+                if (sl->splits == NULL) {
+                        i = nshards - 1;
+                        goto fail;
+                }
+                memcpy(sl->splits, splits, (nshards - 1) * sizeof(sk_key_t));
+        }
+        return sl;
+
+fail:
+        for (; i >= 0; i--) {
+                if (sl->shards[i].list != NULL) {
+                        skiplist_delete(sl->shards[i].list);
+                }
+                pthread_rwlock_destroy(&sl->shards[i].lock);
+        }
+        free(sl->shards);
+        free(sl);
+        return NULL;
+}
+
+static void sh_skiplist_delete(struct sh_skiplist *sl)
+{
+        int i;
+        for (i = 0; i < sl->nshards; i++) {
+                skiplist_delete(sl->shards[i].list);
+                pthread_rwlock_destroy(&sl->shards[i].lock);
+        }
+        free(sl->splits);
+        free(sl->shards);
+        free(sl);
+}
+
+/* Shard holding key: the number of split points not above it by range. */
+static inline int sh_shard_of(struct sh_skiplist *sl, sk_key_t key)
+{
+        int lo = 0, hi = sl->nshards - 1;
+
+        if (sl->splits == NULL) {
+#ifdef SKIPLIST_KEY_HASH
+                return SKIPLIST_KEY_HASH(key) % sl->nshards;
+#endif
+        }
+        while (lo < hi) {
+                int mid = (lo + hi) / 2;
+                if (SKIPLIST_KEY_CMP(sl->splits[mid], key) <= 0) {
+                        lo = mid + 1;
+                } else {
+                        hi = mid;
+                }
+        }
+        return lo;
+}
+
+static void sh_lock_all(struct sh_skiplist *sl)
+{
+        int i;
+        for (i = 0; i < sl->nshards; i++) {
+                pthread_rwlock_rdlock(&sl->shards[i].lock);
+        }
+}
+
+static void sh_unlock_all(struct sh_skiplist *sl)
+{
+        int i;
+        for (i = sl->nshards - 1; i >= 0; i--) {
+                pthread_rwlock_unlock(&sl->shards[i].lock);
+        }
+}
+
+static int sh_skiplist_insert(struct sh_skiplist *sl, sk_key_t key, sk_value_t value)
+{
+        struct skipnode *node;
+        struct sh_shard *shard = &sl->shards[sh_shard_of(sl, key)];
+        pthread_rwlock_wrlock(&shard->lock);
+        node = skiplist_insert(shard->list, key, value);
+        pthread_rwlock_unlock(&shard->lock);
+        return node != NULL ? 0 : -1;
+}
+
+static void sh_skiplist_remove(struct sh_skiplist *sl, sk_key_t key)
+{
+        struct sh_shard *shard = &sl->shards[sh_shard_of(sl, key)];
+        pthread_rwlock_wrlock(&shard->lock);
+        skiplist_remove(shard->list, key);
+        pthread_rwlock_unlock(&shard->lock);
+}
+
+/* Copy the value of key into value, returns 0, or -1 if it is not there. */
+static int sh_skiplist_search(struct sh_skiplist *sl, sk_key_t key, sk_value_t *value)
+{
+        struct skipnode *node;
+        struct sh_shard *shard = &sl->shards[sh_shard_of(sl, key)];
+        pthread_rwlock_rdlock(&shard->lock);
+        node = skiplist_search_by_key(shard->list, key);
+        if (node != NULL) {
+                *value = node->value;
+        }
+        pthread_rwlock_unlock(&shard->lock);
+        return node != NULL ? 0 : -1;
+}
+
+/* Number of nodes with key below key in one shard. */
+static inline sk_rank_t sh_count_below(struct skiplist *list, sk_key_t key)
+{
+        struct range_spec range;
+        range.min = key;
+        range.minex = 0;
+        return range_rank(list, &range, 0);
+}
+
+static sk_rank_t sh_skiplist_count(struct sh_skiplist *sl)
+{
+        int i;
+        sk_rank_t count = 0;
+        sh_lock_all(sl);
+        for (i = 0; i < sl->nshards; i++) {
+                count += sl->shards[i].list->count;
+        }
+        sh_unlock_all(sl);
+        return count;
+}
+
+/* Global rank of key, 0 if it is not there. */
+static sk_rank_t sh_skiplist_key_rank(struct sh_skiplist *sl, sk_key_t key)
+{
+        int i, home = sh_shard_of(sl, key);
+        sk_rank_t rank;
+
+        sh_lock_all(sl);
+        rank = skiplist_key_rank(sl->shards[home].list, key);
+        if (rank > 0) {
+                for (i = 0; i < sl->nshards; i++) {
+                        if (sl->splits != NULL && i < home) {
+                                rank += sl->shards[i].list->count;
+                        } else if (sl->splits == NULL && i != home) {
+                                rank += sh_count_below(sl->shards[i].list, key);
+                        }
+                }
+        }
+        sh_unlock_all(sl);
+        return rank;
+}
+
+/* Node of global rank within the hash shards. Every shard keeps a window of
+ * candidate ranks, lo[i] excluded to hi[i] included. A node of the widest
+ * window is a pivot: counting the nodes below its key elsewhere gives its
+ * global rank, and every window is cut to the side of the pivot that still
+ * holds rank. The pivot is taken where rank would fall if the candidates
+ * were spread evenly, which hashing makes nearly true, so a few rounds do.
+ * Called with all the shards locked. */
+static struct skipnode *sh_select(struct sh_skiplist *sl, sk_rank_t rank)
+{
+        int i, s;
+        sk_rank_t mid, pos, need, total, below[SH_MAX_SHARDS];
+        sk_rank_t lo[SH_MAX_SHARDS], hi[SH_MAX_SHARDS];
+        struct skipnode *pivot;
+
+        for (i = 0; i < sl->nshards; i++) {
+                lo[i] = 0;
+                hi[i] = sl->shards[i].list->count;
+        }
+        for (;;) {
+                need = rank;
+                total = 0;
+                for (s = 0, i = 0; i < sl->nshards; i++) {
+                        if (hi[i] - lo[i] > hi[s] - lo[s]) {
+                                s = i;
+                        }
+                        need -= lo[i];
+                        total += hi[i] - lo[i];
+                }
+                if (hi[s] == lo[s] || need < 1 || need > total) {
+                        return NULL;
+                }
+
+                mid = lo[s] + (sk_rank_t)((double)(hi[s] - lo[s]) * need / total);
+                mid = mid <= lo[s] ? lo[s] + 1 : mid > hi[s] ? hi[s] : mid;
+                pivot = skiplist_search_by_rank(sl->shards[s].list, mid);
+                pos = mid;
+                for (i = 0; i < sl->nshards; i++) {
+                        if (i != s) {
+                                below[i] = sh_count_below(sl->shards[i].list, pivot->key);
+                                pos += below[i];
+                        }
+                }
+                if (pos == rank) {
+                        return pivot;
+                }
+                for (i = 0; i < sl->nshards; i++) {
+                        if (i == s) {
+                                if (pos > rank) {
+                                        hi[s] = mid - 1;
+                                } else {
+                                        lo[s] = mid;
+                                }
+                        } else if (pos > rank) {
+                                hi[i] = below[i] < hi[i] ? below[i] : hi[i];
+                        } else {
+                                lo[i] = below[i] > lo[i] ? below[i] : lo[i];
+                        }
+                }
+        }
+}
+
+/* Copy the node of the given global rank into out, returns 0, or -1 if the
+ * rank is out of range. */
+static int sh_skiplist_search_by_rank(struct sh_skiplist *sl, sk_rank_t rank, struct sk_pair *out)
+{
+        int i;
+        struct skipnode *node = NULL;
+
+        sh_lock_all(sl);
+        if (sl->splits == NULL) {
+                node = rank > 0 ? sh_select(sl, rank) : NULL;
+        } else {
+                for (i = 0; i < sl->nshards; i++) {
+                        if (rank <= sl->shards[i].list->count) {
+                                node = skiplist_search_by_rank(sl->shards[i].list, rank);
+                                break;
+                        }
+                        rank -= sl->shards[i].list->count;
+                }
+        }
+        if (node != NULL) {
+                out->key = node->key;
+                out->value = node->value;
+        }
+        sh_unlock_all(sl);
+        return node != NULL ? 0 : -1;
+}
+
+/* Copy up to limit pairs with key in range into out, in key order, after
+ * skipping the first offset of them. Returns how many were copied. */
+static int
+sh_skiplist_range(struct sh_skiplist *sl, struct range_spec *range, sk_rank_t offset,
+                  struct sk_pair *out, int limit)
+{
+        int i, n = 0;
+        struct range_iter it;
+
+        sh_lock_all(sl);
+        if (sl->splits != NULL) {
+                /* whole shards are skipped by their count in range */
+                for (i = 0; i < sl->nshards && n < limit; i++) {
+                        struct skiplist *list = sl->shards[i].list;
+                        if (!key_in_range(list, range)) {
+                                continue;
+                        }
+                        if (offset > 0) {
+                                sk_rank_t in = range_rank(list, range, 1) - range_rank(list, range, 0);
+                                if (offset >= in) {
+                                        offset -= in;
+                                        continue;
+                                }
+                        }
+                        range_iter_init(&it, list, range, offset, limit - n, 0);
+                        offset = 0;
+                        n += range_iter_next(&it, out + n, limit - n);
+                }
+        } else {
+                /* merge the shard streams, SH_MERGE_BATCH pairs at a time */
+                struct sh_stream {
+                        struct range_iter it;
+                        int pos, len;
+                        struct sk_pair buf[SH_MERGE_BATCH];
+                } *st = (struct sh_stream *)malloc(sl->nshards * sizeof(*st));
+
+                if (st != NULL) {
+                        for (i = 0; i < sl->nshards; i++) {
+                                range_iter_init(&st[i].it, sl->shards[i].list, range, 0, -1, 0);
+                                st[i].pos = 0;
+                                st[i].len = range_iter_next(&st[i].it, st[i].buf, SH_MERGE_BATCH);
+                        }
+                        while (n < limit) {
+                                int s = -1;
+                                for (i = 0; i < sl->nshards; i++) {
+                                        if (st[i].pos < st[i].len &&
+                                            (s < 0 || SKIPLIST_KEY_CMP(st[i].buf[st[i].pos].key,
+                                                                       st[s].buf[st[s].pos].key) < 0)) {
+                                                s = i;
+                                        }
+                                }
+                                if (s < 0) {
+                                        break;
+                                }
+                                if (offset > 0) {
+                                        offset--;
+                                } else {
+                                        out[n++] = st[s].buf[st[s].pos];
+                                }
+                                if (++st[s].pos == st[s].len) {
+                                        st[s].pos = 0;
+                                        st[s].len = range_iter_next(&st[s].it, st[s].buf, SH_MERGE_BATCH);
+                                }
+                        }
+                        free(st);
+                }
+        }
+        sh_unlock_all(sl);
+        return n;
+}
+
+#endif  /* _SKIPLIST_SHARDED_H */
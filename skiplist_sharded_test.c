@@ -0,0 +1,182 @@
+/*
+* Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "skiplist_with_rank.h"
+#include "skiplist_sharded.h"
+
+#define N 2 * 1024 * 1024
+#define MAX_THREADS 8
+#define SHARDS 16
+#define CHECKS 4096
+#define PAGE 100
+
+struct worker {
+    pthread_t tid;
+    const int *key;
+    int ops;
+    int search;
+    struct sh_skiplist *sl;
+};
+
+static long elapsed_ms(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000 + (end->tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static int int_cmp(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static void *run_stripe(void *arg)
+{
+    int i;
+    sk_value_t value;
+    struct worker *w = arg;
+    for (i = 0; i < w->ops; i++) {
+        if (w->search) {
+            if (sh_skiplist_search(w->sl, w->key[i], &value) < 0 || value != ~w->key[i]) {
+                printf("Not found:0x%08x\n", w->key[i]);
+                break;
+            }
+        } else {
+            sh_skiplist_insert(w->sl, w->key[i], ~w->key[i]);
+        }
+    }
+    return NULL;
+}
+
+/* Run the inserts, or the searches, of all the keys split over nthreads. */
+static long run(struct sh_skiplist *sl, const int *key, int nthreads, int search)
+{
+    int i;
+    struct timespec start, end;
+    struct worker w[MAX_THREADS];
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nthreads; i++) {
+        w[i].key = key + (long)i * (N / nthreads);
+        w[i].ops = N / nthreads;
+        w[i].search = search;
+        w[i].sl = sl;
+        pthread_create(&w[i].tid, NULL, run_stripe, &w[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(w[i].tid, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return elapsed_ms(&start, &end);
+}
+
+/* Global ranks and range pages must match the sorted keys. */
+static void check(struct sh_skiplist *sl, const int *sorted)
+{
+    int i, j, n;
+    sk_rank_t rank;
+    struct sk_pair pair, page[PAGE];
+    struct range_spec range;
+
+    if (sh_skiplist_count(sl) != N) {
+        printf("Count " SKIPLIST_RANK_FMT "\n", sh_skiplist_count(sl));
+    }
+    for (i = 0; i < CHECKS; i++) {
+        j = random() % N;
+        rank = sh_skiplist_key_rank(sl, sorted[j]);
+        if (rank != j + 1) {
+            printf("Rank of 0x%08x is " SKIPLIST_RANK_FMT ", %d expected\n", sorted[j], rank, j + 1);
+            return;
+        }
+        if (sh_skiplist_search_by_rank(sl, j + 1, &pair) < 0 || pair.key != sorted[j]) {
+            printf("Rank %d gave 0x%08x, 0x%08x expected\n", j + 1, pair.key, sorted[j]);
+            return;
+        }
+    }
+    for (i = 0; i < CHECKS / 16; i++) {
+        j = random() % N;
+        range.min = sorted[j];
+        range.max = sorted[N - 1];
+        range.minex = range.maxex = 0;
+        n = sh_skiplist_range(sl, &range, i % 50, page, PAGE);
+        j += i % 50;
+        if (n != (N - j < PAGE ? (N - j > 0 ? N - j : 0) : PAGE)) {
+            printf("Range page of %d from 0x%08x\n", n, sorted[j - i % 50]);
+            return;
+        }
+        while (n-- > 0) {
+            if (page[n].key != sorted[j + n] || page[n].value != ~sorted[j + n]) {
+                printf("Range page differs at 0x%08x\n", sorted[j + n]);
+                return;
+            }
+        }
+    }
+}
+
+int
+main(void)
+{
+    int i, j, tmp, threads, mode;
+    long ms;
+    struct timespec start, end;
+    sk_key_t splits[SHARDS - 1];
+
+    int *key = malloc(N * sizeof(int));
+    int *sorted = malloc(N * sizeof(int));
+    if (key == NULL || sorted == NULL) {
+        exit(-1);
+    }
+
+    /* distinct keys in random order */
+    srandom(time(NULL));
+    for (i = 0; i < N; i++) {
+        key[i] = i;
+    }
+    for (i = N - 1; i > 0; i--) {
+        j = random() % (i + 1);
+        tmp = key[i];
+        key[i] = key[j];
+        key[j] = tmp;
+    }
+    memcpy(sorted, key, N * sizeof(int));
+    qsort(sorted, N, sizeof(int), int_cmp);
+    for (i = 1; i < SHARDS; i++) {
+        splits[i - 1] = sorted[(long)i * N / SHARDS];
+    }
+
+    printf("Test start!\n");
+    for (mode = 0; mode < 3; mode++) {
+        for (threads = 1; threads <= MAX_THREADS; threads *= 2) {
+            struct sh_skiplist *sl = mode == 0 ? sh_skiplist_new(1, NULL, time(NULL)) :
+                                     sh_skiplist_new(SHARDS, mode == 1 ? splits : NULL, time(NULL));
+            if (sl == NULL) {
+                exit(-1);
+            }
+            printf("%-6s %2d shards %d threads:", mode == 0 ? "single" : mode == 1 ? "range" : "hash",
+                   sl->nshards, threads);
+            ms = run(sl, key, threads, 0);
+            printf(" insert %ldms,", ms);
+            ms = run(sl, key, threads, 1);
+            printf(" search %ldms\n", ms);
+
+            if (threads == MAX_THREADS) {
+                clock_gettime(CLOCK_MONOTONIC, &start);
+                check(sl, sorted);
+                clock_gettime(CLOCK_MONOTONIC, &end);
+                printf("ranks and ranges checked: %ldms\n", elapsed_ms(&start, &end));
+            }
+            sh_skiplist_delete(sl);
+        }
+    }
+
+    printf("End of Test.\n");
+
+    free(sorted);
+    free(key);
+
+    return 0;
+}
@@ -0,0 +1,142 @@
+/*
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ */
+
+#ifndef _SKIPLIST_SIMD_H
+#define _SKIPLIST_SIMD_H
+
+/*
+ * Vectorized search in a sorted block of int keys.
+ *
+ * In a sorted block the index of the first key not less than a target is the
+ * number of keys less than it, so the kernels count the lanes of a vector
+ * compare over the whole block instead of branching on every key, which a
+ * random target mispredicts about once per lookup. The widest kernel the CPU
+ * supports is picked once at runtime: AVX2, then SSE2 (32-bit compares need
+ * nothing newer), then plain C on other architectures.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SKIPLIST_SIMD_X86
+#endif
+
+enum {
+        SK_SIMD_UNKNOWN = -1,
+        SK_SIMD_SCALAR,
+        SK_SIMD_SSE2,
+        SK_SIMD_AVX2,
+};
+
+static int sk_simd_level = SK_SIMD_UNKNOWN;
+
+static inline int sk_lower_bound_scalar(const int *keys, int n, int key)
+{
+        int i;
+        for (i = 0; i < n && keys[i] < key; i++) {
+                ;
+        }
+        return i;
+}
+
+static inline int sk_upper_bound_scalar(const int *keys, int n, int key)
+{
+        int i;
+        for (i = 0; i < n && keys[i] <= key; i++) {
+                ;
+        }
+        return i;
+}
+
+#ifdef SKIPLIST_SIMD_X86
+/* The compares leave -1 in every matching lane, subtracting them counts the
+ * matches per lane without a branch; with upper set, the keys greater than
+ * key are counted and taken off the total. */
+__attribute__((target("sse2")))
+static inline int sk_bound_sse2(const int *keys, int n, int key, int upper)
+{
+        int i;
+        __m128i k = _mm_set1_epi32(key);
+        __m128i acc = _mm_setzero_si128();
+        for (i = 0; i + 4 <= n; i += 4) {
+                __m128i v = _mm_loadu_si128((const __m128i *)(keys + i));
+                acc = _mm_sub_epi32(acc, upper ? _mm_cmpgt_epi32(v, k) : _mm_cmpgt_epi32(k, v));
+        }
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0x4e));
+        acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, 0xb1));
+        if (upper) {
+                return i - _mm_cvtsi128_si32(acc) + sk_upper_bound_scalar(keys + i, n - i, key);
+        }
+        return _mm_cvtsi128_si32(acc) + sk_lower_bound_scalar(keys + i, n - i, key);
+}
+
+__attribute__((target("avx2")))
+static int sk_bound_avx2(const int *keys, int n, int key, int upper)
+{
+        int i, count;
+        __m256i k = _mm256_set1_epi32(key);
+        __m256i acc = _mm256_setzero_si256();
+        __m128i sum;
+        for (i = 0; i + 8 <= n; i += 8) {
+                __m256i v = _mm256_loadu_si256((const __m256i *)(keys + i));
+                acc = _mm256_sub_epi32(acc, upper ? _mm256_cmpgt_epi32(v, k) : _mm256_cmpgt_epi32(k, v));
+        }
+        sum = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+        count = _mm_cvtsi128_si32(sum);
+        if (upper) {
+                count = i - count;
+        }
+        return count + sk_bound_sse2(keys + i, n - i, key, upper);
+}
+#endif
+
+/* Pick the kernel from cpuid, once per translation unit. */
+static int sk_simd_detect(void)
+{
+#ifdef SKIPLIST_SIMD_X86
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+                sk_simd_level = SK_SIMD_AVX2;
+        } else if (__builtin_cpu_supports("sse2")) {
+                sk_simd_level = SK_SIMD_SSE2;
+        } else {
+                sk_simd_level = SK_SIMD_SCALAR;
+        }
+#else
+        sk_simd_level = SK_SIMD_SCALAR;
+#endif
+        return sk_simd_level;
+}
+
+static inline int sk_bound(const int *keys, int n, int key, int upper)
+{
+        int level = sk_simd_level;
+        if (level == SK_SIMD_UNKNOWN) {
+                level = sk_simd_detect();
+        }
+#ifdef SKIPLIST_SIMD_X86
+        if (level == SK_SIMD_AVX2) {
+                return sk_bound_avx2(keys, n, key, upper);
+        } else if (level == SK_SIMD_SSE2) {
+                return sk_bound_sse2(keys, n, key, upper);
+        }
+#endif
+        return upper ? sk_upper_bound_scalar(keys, n, key) :
+                       sk_lower_bound_scalar(keys, n, key);
+}
+
+/* Index of the first key not less than key in a sorted block. */
+static inline int sk_lower_bound(const int *keys, int n, int key)
+{
+        return sk_bound(keys, n, key, 0);
+}
+
+/* Index of the first key greater than key in a sorted block. */
+static inline int sk_upper_bound(const int *keys, int n, int key)
+{
+        return sk_bound(keys, n, key, 1);
+}
+
+#endif  /* _SKIPLIST_SIMD_H */
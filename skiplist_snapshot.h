@@ -0,0 +1,359 @@
+/*
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ */
+
+#ifndef _SKIPLIST_SNAPSHOT_H
+#define _SKIPLIST_SNAPSHOT_H
+
+/*
+ * Skiplist with copy-on-write snapshots.
+ *
+ * Every write bumps the list version. A node is stamped with the version
+ * that inserted it and, once removed, with the version that removed it, and
+ * a snapshot is nothing but the version it was taken at: it sees the nodes
+ * born at or before it and not yet dead at it. Taking one is O(1) and
+ * nothing is copied.
+ *
+ * A removed node that no open snapshot can see is unlinked at once. One that
+ * is still visible to some snapshot stays linked as a zombie, skipped by the
+ * live operations, and is reclaimed when the last snapshot seeing it is
+ * released. Calls on the list and its snapshots must be serialized, but a
+ * snapshot stays consistent across any writes made between its calls, so a
+ * long scan can be interleaved with updates.
+ *
+ * The names do not clash with skiplist.h, so both can be used side by side.
+ */
+
+#ifndef MAX_LEVEL
+#define MAX_LEVEL 32  /* Should be enough for 2^32 elements */
+#endif
+
+#ifndef SKIPLIST_KEY_TYPE
+#define SKIPLIST_KEY_TYPE int
+#endif
+
+#ifndef SKIPLIST_VALUE_TYPE
+#define SKIPLIST_VALUE_TYPE int
+#endif
+
+#ifndef SKIPLIST_KEY_CMP
+#define SKIPLIST_KEY_CMP(a, b) (((a) > (b)) - ((a) < (b)))
+#endif
+
+#ifndef SKIPLIST_P_SHIFT
+#define SKIPLIST_P_SHIFT 2  /* promotion probability p = 1/2^SKIPLIST_P_SHIFT: 1, 2 or 3 */
+#endif
+
+#define SS_LIVE (~0ULL)  /* death stamp of a node not removed yet */
+
+typedef SKIPLIST_KEY_TYPE ss_key_t;
+typedef SKIPLIST_VALUE_TYPE ss_value_t;
+
+struct ss_link {
+        struct ss_link *next, *prev;
+};
+
+struct ss_node {
+        ss_key_t key;
+        ss_value_t value;
+        unsigned long long born;        /* version that inserted the node */
+        unsigned long long dead;        /* version that removed it, SS_LIVE until then */
+        struct ss_node *zombie_next;
+        int level;
+        struct ss_link link[0];
+};
+
+struct ss_snapshot {
+        struct ss_skiplist *list;
+        unsigned long long version;
+        struct ss_snapshot *prev, *next;  /* open snapshots, oldest first */
+};
+
+struct ss_skiplist {
+        int level;
+        int count;                      /* live nodes */
+        int zombies;                    /* removed nodes kept for snapshots */
+        unsigned long long version;
+        unsigned long long rand;        /* level generator state */
+        struct ss_node *zombie_list;
+        struct ss_snapshot *oldest, *newest;
+        struct ss_link head[MAX_LEVEL];
+};
+
+#define ss_entry(ptr, i) \
+        ((struct ss_node *)((char *)(ptr) - (size_t)(&((struct ss_node *)0)->link[i])))
+
+static inline int ss_visible(struct ss_node *node, unsigned long long version)
+{
+        return node->born <= version && version < node->dead;
+}
+
+/* Seed the level generator of the list, the same seed and the same
+ * operations build the same towers. */
+static void ss_skiplist_seed(struct ss_skiplist *list, unsigned long long seed)
+{
+        /* splitmix64 spreads small seeds over the whole state */
+        seed += 0x9e3779b97f4a7c15ULL;
+        seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebULL;
+        seed ^= seed >> 31;
+        list->rand = seed != 0 ? seed : 1;
+}
+
+static struct ss_skiplist *ss_skiplist_new(void)
+{
+        int i;
+        struct ss_skiplist *list = (struct ss_skiplist *)malloc(sizeof(*list));
+        if (list != NULL) {
+                list->level = 1;
+                list->count = 0;
+                list->zombies = 0;
+                list->version = 0;
+                ss_skiplist_seed(list, 0);
+                list->zombie_list = NULL;
+                list->oldest = list->newest = NULL;
+                for (i = 0; i < MAX_LEVEL; i++) {
+                        list->head[i].next = &list->head[i];
+                        list->head[i].prev = &list->head[i];
+                }
+        }
+        return list;
+}
+
+/* Frees the nodes and any snapshot still open, which must not be used after. */
+static void ss_skiplist_delete(struct ss_skiplist *list)
+{
+        struct ss_link *pos, *n;
+        struct ss_snapshot *snap, *next;
+        for (pos = list->head[0].next; pos != &list->head[0]; pos = n) {
+                n = pos->next;
+                free(ss_entry(pos, 0));
+        }
+        for (snap = list->oldest; snap != NULL; snap = next) {
+                next = snap->next;
+                free(snap);
+        }
+        free(list);
+}
+
+/* random_level() of skiplist.h, with the zombies counted in the cap. */
+static int ss_random_level(struct ss_skiplist *list)
+{
+        int level, cap;
+        unsigned long long x = list->rand;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        list->rand = x;
+
+        level = __builtin_ctzll(x) / SKIPLIST_P_SHIFT + 1;
+        cap = (64 - __builtin_clzll((unsigned long long)(list->count + list->zombies) + 1)) / SKIPLIST_P_SHIFT + 1;
+        if (cap > MAX_LEVEL) {
+                cap = MAX_LEVEL;
+        }
+        return level < cap ? level : cap;
+}
+
+/* Fill pred[] with the last link before key on every level, zombies
+ * included, and return the first level 0 link not before it. */
+static struct ss_link *
+__ss_find(struct ss_skiplist *list, ss_key_t key, struct ss_link **pred)
+{
+        int i = list->level - 1;
+        struct ss_link *pos = &list->head[i];
+
+        for (;;) {
+                while (pos->next != &list->head[i] &&
+                       SKIPLIST_KEY_CMP(ss_entry(pos->next, i)->key, key) < 0) {
+                        pos = pos->next;
+                }
+                if (pred != NULL) {
+                        pred[i] = pos;
+                }
+                if (i-- == 0) {
+                        return pos->next;
+                }
+                pos--;
+        }
+}
+
+static struct ss_node *
+ss_skiplist_insert(struct ss_skiplist *list, ss_key_t key, ss_value_t value)
+{
+        int i;
+        struct ss_link *pred[MAX_LEVEL];
+        int level = ss_random_level(list);
+        struct ss_node *node = (struct ss_node *)malloc(sizeof(*node) + level * sizeof(struct ss_link));
+        if (node == NULL) {
+                return NULL;
+        }
+
+        node->key = key;
+        node->value = value;
+        node->born = ++list->version;
+        node->dead = SS_LIVE;
+        node->zombie_next = NULL;
+        node->level = level;
+        if (level > list->level) {
+                list->level = level;
+        }
+
+        __ss_find(list, key, pred);
+        for (i = 0; i < level; i++) {
+                struct ss_link *link = &node->link[i];
+                link->next = pred[i]->next;
+                link->prev = pred[i];
+                link->next->prev = link;
+                pred[i]->next = link;
+        }
+        list->count++;
+
+        return node;
+}
+
+static void ss_unlink(struct ss_skiplist *list, struct ss_node *node)
+{
+        int i;
+        for (i = 0; i < node->level; i++) {
+                node->link[i].prev->next = node->link[i].next;
+                node->link[i].next->prev = node->link[i].prev;
+        }
+        while (list->level > 1 && list->head[list->level - 1].next == &list->head[list->level - 1]) {
+                list->level--;
+        }
+        free(node);
+}
+
+/* Remove all the live nodes with the key, returns how many. */
+static int ss_skiplist_remove(struct ss_skiplist *list, ss_key_t key)
+{
+        int removed = 0;
+        struct ss_link *n, *pos = __ss_find(list, key, NULL);
+        unsigned long long version = list->version + 1;
+
+        for (; pos != &list->head[0]; pos = n) {
+                struct ss_node *node = ss_entry(pos, 0);
+                n = pos->next;
+                if (SKIPLIST_KEY_CMP(node->key, key) != 0) {
+                        break;
+                }
+                if (node->dead != SS_LIVE) {
+                        continue;
+                }
+                if (list->newest != NULL && list->newest->version >= node->born) {
+                        /* some snapshot still sees it */
+                        node->dead = version;
+                        node->zombie_next = list->zombie_list;
+                        list->zombie_list = node;
+                        list->zombies++;
+                } else {
+                        ss_unlink(list, node);
+                }
+                list->count--;
+                removed++;
+        }
+
+        if (removed > 0) {
+                list->version = version;
+        }
+        return removed;
+}
+
+/* First node from the level 0 link pos on that the version sees, NULL if
+ * there is none. */
+static struct ss_node *
+__ss_scan(struct ss_skiplist *list, struct ss_link *pos, unsigned long long version)
+{
+        for (; pos != &list->head[0]; pos = pos->next) {
+                struct ss_node *node = ss_entry(pos, 0);
+                if (ss_visible(node, version)) {
+                        return node;
+                }
+        }
+        return NULL;
+}
+
+static struct ss_node *ss_skiplist_search(struct ss_skiplist *list, ss_key_t key)
+{
+        struct ss_node *node = __ss_scan(list, __ss_find(list, key, NULL), list->version);
+        return node != NULL && SKIPLIST_KEY_CMP(node->key, key) == 0 ? node : NULL;
+}
+
+/* Freeze the current contents in O(1). */
+static struct ss_snapshot *ss_snapshot_take(struct ss_skiplist *list)
+{
+        struct ss_snapshot *snap = (struct ss_snapshot *)malloc(sizeof(*snap));
+        if (snap != NULL) {
+                snap->list = list;
+                snap->version = list->version;
+                snap->next = NULL;
+                snap->prev = list->newest;
+                if (list->newest != NULL) {
+                        list->newest->next = snap;
+                } else {
+                        list->oldest = snap;
+                }
+                list->newest = snap;
+        }
+        return snap;
+}
+
+/* Drop the snapshot and unlink the zombies no other snapshot can see. */
+static void ss_snapshot_release(struct ss_snapshot *snap)
+{
+        struct ss_skiplist *list = snap->list;
+        struct ss_node *node, **pnode;
+        struct ss_snapshot *s;
+
+        if (snap->prev != NULL) {
+                snap->prev->next = snap->next;
+        } else {
+                list->oldest = snap->next;
+        }
+        if (snap->next != NULL) {
+                snap->next->prev = snap->prev;
+        } else {
+                list->newest = snap->prev;
+        }
+        free(snap);
+
+        for (pnode = &list->zombie_list; (node = *pnode) != NULL;) {
+                /* the oldest open snapshot not older than the node decides */
+                for (s = list->oldest; s != NULL && s->version < node->born; s = s->next) {
+                        ;
+                }
+                if (s != NULL && s->version < node->dead) {
+                        pnode = &node->zombie_next;
+                        continue;
+                }
+                *pnode = node->zombie_next;
+                list->zombies--;
+                ss_unlink(list, node);
+        }
+}
+
+/* Lookups and ordered scans of the frozen contents: ss_snapshot_seek() gives
+ * the first node not before key and ss_snapshot_next() the one after node,
+ * NULL at the end. Nodes returned stay valid until the snapshot is released. */
+static struct ss_node *ss_snapshot_seek(struct ss_snapshot *snap, ss_key_t key)
+{
+        return __ss_scan(snap->list, __ss_find(snap->list, key, NULL), snap->version);
+}
+
+static struct ss_node *ss_snapshot_first(struct ss_snapshot *snap)
+{
+        return __ss_scan(snap->list, snap->list->head[0].next, snap->version);
+}
+
+static struct ss_node *ss_snapshot_next(struct ss_snapshot *snap, struct ss_node *node)
+{
+        return __ss_scan(snap->list, node->link[0].next, snap->version);
+}
+
+static struct ss_node *ss_snapshot_search(struct ss_snapshot *snap, ss_key_t key)
+{
+        struct ss_node *node = ss_snapshot_seek(snap, key);
+        return node != NULL && SKIPLIST_KEY_CMP(node->key, key) == 0 ? node : NULL;
+}
+
+#endif  /* _SKIPLIST_SNAPSHOT_H */
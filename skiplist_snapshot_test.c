@@ -0,0 +1,119 @@
+/*
+* Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "skiplist_snapshot.h"
+
+#define N 2 * 1024 * 1024
+#define SCAN_STEP 64  /* snapshot nodes read between two writes */
+
+static int int_cmp(const void *a, const void *b)
+{
+    int x = *(const int *)a, y = *(const int *)b;
+    return (x > y) - (x < y);
+}
+
+static long elapsed_ms(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000 + (end->tv_nsec - start->tv_nsec) / 1000000;
+}
+
+int
+main(void)
+{
+    int i, j, w;
+    struct timespec start, end;
+    struct ss_node *node;
+
+    int *key = malloc(N * sizeof(int));
+    int *sorted = malloc(N * sizeof(int));
+    if (key == NULL || sorted == NULL) {
+        exit(-1);
+    }
+
+    struct ss_skiplist *list = ss_skiplist_new();
+    if (list == NULL) {
+        exit(-1);
+    }
+
+    srandom(time(NULL));
+    for (i = 0; i < N; i++) {
+        sorted[i] = key[i] = (int)random();
+    }
+    qsort(sorted, N, sizeof(int), int_cmp);
+
+    printf("Test start!\n");
+    printf("Add %d nodes...\n", N);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i++) {
+        ss_skiplist_insert(list, key[i], key[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", elapsed_ms(&start, &end));
+
+    /* The whole scan must see the list as it was when the snapshot was
+     * taken, while every step removes one key and adds another */
+    printf("Now scan a snapshot, removing and adding a node every %d nodes...\n", SCAN_STEP);
+    struct ss_snapshot *snap = ss_snapshot_take(list);
+    if (snap == NULL) {
+        exit(-1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    node = ss_snapshot_first(snap);
+    for (i = 0, w = 0; node != NULL; w++) {
+        for (j = 0; j < SCAN_STEP && node != NULL; j++, i++) {
+            if (i >= N || node->key != sorted[i]) {
+                printf("Snapshot changed at:%d\n", i);
+                break;
+            }
+            node = ss_snapshot_next(snap, node);
+        }
+        if (j < SCAN_STEP && node != NULL) {
+            break;
+        }
+        ss_skiplist_remove(list, key[w % N]);
+        ss_skiplist_insert(list, -(int)random() - 1, 0);  /* never clashes with key[] */
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms, %d writes, %d zombies\n", elapsed_ms(&start, &end), 2 * w, list->zombies);
+    if (i != N) {
+        printf("Snapshot scan saw %d of %d nodes\n", i, N);
+    }
+    for (i = 0; i < w; i++) {
+        if (ss_snapshot_search(snap, key[i]) == NULL) {
+            printf("Not in snapshot:0x%08x\n", key[i]);
+        }
+    }
+
+    printf("Now release the snapshot...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ss_snapshot_release(snap);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", elapsed_ms(&start, &end));
+    if (list->zombies != 0 || list->zombie_list != NULL) {
+        printf("%d zombies left\n", list->zombies);
+    }
+
+    /* Without a snapshot removals unlink at once */
+    printf("Now remove all nodes...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i++) {
+        ss_skiplist_remove(list, key[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", elapsed_ms(&start, &end));
+    if (list->count != w || list->zombies != 0) {
+        printf("%d nodes and %d zombies left, %d expected\n", list->count, list->zombies, w);
+    }
+
+    printf("End of Test.\n");
+    ss_skiplist_delete(list);
+
+    free(sorted);
+    free(key);
+
+    return 0;
+}
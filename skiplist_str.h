@@ -0,0 +1,286 @@
+/*
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ */
+
+#ifndef _SKIPLIST_STR_H
+#define _SKIPLIST_STR_H
+
+/*
+ * Skiplist keyed by byte strings of any length, in memcmp() order with the
+ * shorter of two equal runs first.
+ *
+ * A node keeps its key inline behind the link tower, length first, and a
+ * copy of the first 8 key bytes up front as a big endian integer, zero
+ * padded, so that comparing prefixes as integers orders them like memcmp():
+ *
+ *   | prefix | value | level | link[0] ... link[level-1] | len | key bytes |
+ *
+ * A descent turns its key into a prefix once, and most compares in the loop
+ * are then a single integer compare against the node header the links are
+ * in anyway. Only when the prefixes tie are the key bytes behind the tower
+ * read, and even then the 8 bytes the prefix covered are skipped.
+ * Keys sharing long common heads, paths say, tie on most compares and gain
+ * little.
+ *
+ * Nodes are sized by their key and come from malloc(). The names do not
+ * clash with skiplist.h or the other variants, so any of them can be used
+ * side by side.
+ */
+
+#ifndef MAX_LEVEL
+#define MAX_LEVEL 32  /* Should be enough for 2^32 elements */
+#endif
+
+#ifndef SKIPLIST_VALUE_TYPE
+#define SKIPLIST_VALUE_TYPE int
+#endif
+
+#ifndef SKIPLIST_P_SHIFT
+#define SKIPLIST_P_SHIFT 2  /* promotion probability p = 1/2^SKIPLIST_P_SHIFT: 1, 2 or 3 */
+#endif
+
+typedef SKIPLIST_VALUE_TYPE str_value_t;
+
+struct str_link {
+        struct str_link *prev, *next;
+};
+
+struct str_key {
+        unsigned int len;
+        char data[0];
+};
+
+struct str_node {
+        unsigned long long prefix;      /* first 8 key bytes, big endian */
+        str_value_t value;
+        int level;
+        struct str_link link[0];
+};
+
+struct str_skiplist {
+        int level;
+        int count;
+        unsigned long long rand;        /* level generator state */
+        struct str_link head[MAX_LEVEL];
+};
+
+#define str_entry(ptr, i) \
+        ((struct str_node *)((char *)(ptr) - (size_t)(&((struct str_node *)0)->link[i])))
+
+/* The key stored behind the tower of a node */
+#define str_key(node) ((struct str_key *)&(node)->link[(node)->level])
+
+static inline unsigned long long str_prefix(const char *key, size_t len)
+{
+        unsigned long long prefix = 0;
+        memcpy(&prefix, key, len < sizeof(prefix) ? len : sizeof(prefix));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        prefix = __builtin_bswap64(prefix);
+#endif
+        return prefix;
+}
+
+/* Compare the key of node with key, whose prefix is given, like memcmp()
+ * would and the shorter first on a tie. */
+static inline int
+str_cmp(struct str_node *node, unsigned long long prefix, const char *key, size_t len)
+{
+        int cmp;
+        size_t n;
+        struct str_key *k;
+
+        if (node->prefix != prefix) {
+                return node->prefix < prefix ? -1 : 1;
+        }
+        /* equal prefixes, the first min(n, 8) bytes are the same */
+        k = str_key(node);
+        n = k->len < len ? k->len : len;
+        if (n > sizeof(prefix)) {
+                cmp = memcmp(k->data + sizeof(prefix), key + sizeof(prefix), n - sizeof(prefix));
+                if (cmp != 0) {
+                        return cmp;
+                }
+        }
+        return (k->len > len) - (k->len < len);
+}
+
+static struct str_node *
+str_node_new(int level, const char *key, size_t len, str_value_t value)
+{
+        struct str_key *k;
+        struct str_node *node = (struct str_node *)malloc(sizeof(*node) + level * sizeof(struct str_link) +
+                                                          sizeof(struct str_key) + len);
+        if (node != NULL) {
+                node->prefix = str_prefix(key, len);
+                node->value = value;
+                node->level = level;
+                k = str_key(node);
+                k->len = len;
+                memcpy(k->data, key, len);
+        }
+        return node;
+}
+
+/* Mirrors skiplist_seed() of skiplist.h. */
+static void str_skiplist_seed(struct str_skiplist *list, unsigned long long seed)
+{
+        seed += 0x9e3779b97f4a7c15ULL;
+        seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebULL;
+        seed ^= seed >> 31;
+        list->rand = seed != 0 ? seed : 1;
+}
+
+static struct str_skiplist *str_skiplist_new(void)
+{
+        int i;
+        struct str_skiplist *list = (struct str_skiplist *)malloc(sizeof(*list));
+        if (list != NULL) {
+                list->level = 1;
+                list->count = 0;
+                str_skiplist_seed(list, 0);
+                for (i = 0; i < MAX_LEVEL; i++) {
+                        list->head[i].prev = list->head[i].next = &list->head[i];
+                }
+        }
+        return list;
+}
+
+static void str_skiplist_delete(struct str_skiplist *list)
+{
+        struct str_link *pos, *n;
+        for (pos = list->head[0].next; pos != &list->head[0]; pos = n) {
+                n = pos->next;
+                free(str_entry(pos, 0));
+        }
+        free(list);
+}
+
+/* Mirrors random_level() of skiplist.h. */
+static int str_random_level(struct str_skiplist *list)
+{
+        int level, cap;
+        unsigned long long x = list->rand;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        list->rand = x;
+
+        level = __builtin_ctzll(x) / SKIPLIST_P_SHIFT + 1;
+        cap = (64 - __builtin_clzll((unsigned long long)list->count + 1)) / SKIPLIST_P_SHIFT + 1;
+        if (cap > MAX_LEVEL) {
+                cap = MAX_LEVEL;
+        }
+        return level < cap ? level : cap;
+}
+
+static struct str_node *str_skiplist_search(struct str_skiplist *list, const char *key, size_t len)
+{
+        int cmp;
+        struct str_node *node;
+        unsigned long long prefix = str_prefix(key, len);
+        int i = list->level - 1;
+        struct str_link *pos = &list->head[i];
+        struct str_link *end = &list->head[i];
+
+        for (; i >= 0; i--) {
+                for (pos = pos->next; pos != end; pos = pos->next) {
+                        node = str_entry(pos, i);
+                        cmp = str_cmp(node, prefix, key, len);
+                        if (cmp == 0) {
+                                return node;
+                        }
+                        if (cmp > 0) {
+                                end = pos;
+                                break;
+                        }
+                }
+                pos = end->prev;
+                pos--;
+                end--;
+        }
+
+        return NULL;
+}
+
+/* Insert a copy of key, after the nodes with an equal key. */
+static struct str_node *
+str_skiplist_insert(struct str_skiplist *list, const char *key, size_t len, str_value_t value)
+{
+        int i, level = str_random_level(list);
+        struct str_node *node = str_node_new(level, key, len, value);
+        struct str_link *pos, *end;
+
+        if (node == NULL) {
+                return NULL;
+        }
+        if (level > list->level) {
+                list->level = level;
+        }
+
+        i = list->level - 1;
+        pos = end = &list->head[i];
+        for (; i >= 0; i--) {
+                for (pos = pos->next; pos != end; pos = pos->next) {
+                        if (str_cmp(str_entry(pos, i), node->prefix, key, len) > 0) {
+                                end = pos;
+                                break;
+                        }
+                }
+                pos = end->prev;
+                if (i < level) {
+                        node->link[i].next = end;
+                        node->link[i].prev = pos;
+                        end->prev = &node->link[i];
+                        pos->next = &node->link[i];
+                }
+                pos--;
+                end--;
+        }
+
+        list->count++;
+        return node;
+}
+
+/* Remove every node with the key, returns how many there were. The first
+ * one is found in a single descent and the others follow it on level 0,
+ * each doubly linked tower unlinking by its own links. */
+static int str_skiplist_remove(struct str_skiplist *list, const char *key, size_t len)
+{
+        int i, removed = 0;
+        struct str_node *node;
+        unsigned long long prefix = str_prefix(key, len);
+        struct str_link *pos = &list->head[list->level - 1];
+
+        for (i = list->level - 1; i >= 0; i--) {
+                for (; pos->next != &list->head[i]; pos = pos->next) {
+                        if (str_cmp(str_entry(pos->next, i), prefix, key, len) >= 0) {
+                                break;
+                        }
+                }
+                if (i > 0) {
+                        pos--;
+                }
+        }
+
+        while (pos->next != &list->head[0]) {
+                node = str_entry(pos->next, 0);
+                if (str_cmp(node, prefix, key, len) != 0) {
+                        break;
+                }
+                for (i = 0; i < node->level; i++) {
+                        node->link[i].prev->next = node->link[i].next;
+                        node->link[i].next->prev = node->link[i].prev;
+                }
+                free(node);
+                list->count--;
+                removed++;
+        }
+
+        while (list->level > 1 && list->head[list->level - 1].next == &list->head[list->level - 1]) {
+                list->level--;
+        }
+        return removed;
+}
+
+#endif  /* _SKIPLIST_STR_H */
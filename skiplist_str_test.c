@@ -0,0 +1,158 @@
+/*
+* Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* skiplist.h over pointers to the same strings is the baseline */
+#define SKIPLIST_KEY_TYPE const char *
+#define SKIPLIST_KEY_CMP(a, b) strcmp(a, b)
+
+#include "skiplist.h"
+#include "skiplist_str.h"
+
+#define N 1024 * 1024
+#define KEY_MAX 64
+
+static long ms(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec)*1000 + (end->tv_nsec - start->tv_nsec)/1000000;
+}
+
+/* Run the insert, search and remove phases of skiplist_test.c over the keys
+ * with both lists. */
+static void bench(const char *name, char **key, size_t *len)
+{
+    int i, removed = 0;
+    struct timespec start, end;
+    struct str_node *node;
+
+    struct str_skiplist *list = str_skiplist_new();
+    struct skiplist *ptr = skiplist_new();
+    if (list == NULL || ptr == NULL) {
+        exit(-1);
+    }
+
+    printf("Add %d %s...\n", N, name);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i++) {
+        if (str_skiplist_insert(list, key[i], len[i], i) == NULL) {
+            exit(-1);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("inline:   %ldms, %d levels\n", ms(&start, &end), list->level);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i++) {
+        if (skiplist_insert(ptr, key[i], i) == NULL) {
+            exit(-1);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("pointers: %ldms, %d levels\n", ms(&start, &end), ptr->level);
+
+    /* level 0 must come out in strcmp() order, the keys hold no NUL */
+    struct str_link *pos;
+    const char *last = NULL;
+    for (pos = list->head[0].next; pos != &list->head[0]; pos = pos->next) {
+        node = str_entry(pos, 0);
+        if (last != NULL && strcmp(last, key[node->value]) >= 0) {
+            printf("Out of order: %s after %s\n", key[node->value], last);
+            break;
+        }
+        last = key[node->value];
+    }
+
+    printf("Now search each node...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i++) {
+        node = str_skiplist_search(list, key[i], len[i]);
+        if (node == NULL || node->value != i) {
+            printf("Not found:%s\n", key[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("inline:   %ldms\n", ms(&start, &end));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i++) {
+        if (skiplist_search(ptr, key[i]) == NULL) {
+            printf("Not found:%s\n", key[i]);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("pointers: %ldms\n", ms(&start, &end));
+
+    /* a key one byte short, or one byte longer, must not match */
+    char longer[KEY_MAX + 1];
+    memcpy(longer, key[0], len[0]);
+    longer[len[0]] = 'x';
+    if (str_skiplist_search(list, key[0], len[0] - 1) != NULL ||
+        str_skiplist_search(list, longer, len[0] + 1) != NULL ||
+        str_skiplist_remove(list, "~", 1) != 0) {
+        printf("Found a key that is not there\n");
+    }
+
+    printf("Now remove all nodes...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i++) {
+        removed += str_skiplist_remove(list, key[i], len[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("inline:   %ldms\n", ms(&start, &end));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i++) {
+        skiplist_remove(ptr, key[i]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("pointers: %ldms\n", ms(&start, &end));
+    if (removed != N || list->count != 0 || list->level != 1) {
+        printf("Removed %d of %d nodes, %d in %d levels left\n", removed, N, list->count, list->level);
+    }
+
+    str_skiplist_delete(list);
+    skiplist_delete(ptr);
+}
+
+int
+main(void)
+{
+    int i, j, n;
+    char *buf = malloc((size_t)N * KEY_MAX);
+    char **key = malloc(N * sizeof(*key));
+    size_t *len = malloc(N * sizeof(*len));
+    if (buf == NULL || key == NULL || len == NULL) {
+        exit(-1);
+    }
+
+    unsigned int seed = getenv("SKIPLIST_SEED") ? (unsigned int)strtoul(getenv("SKIPLIST_SEED"), NULL, 0)
+                                              : (unsigned int)time(NULL);
+    srandom(seed);
+    printf("Test start! seed:%u\n", seed);
+
+    /* Member names: random words, made unique by a hex tail */
+    for (i = 0; i < N; i++) {
+        key[i] = buf + (size_t)i * KEY_MAX;
+        n = 3 + random() % 14;
+        for (j = 0; j < n; j++) {
+            key[i][j] = 'a' + random() % 26;
+        }
+        len[i] = n + sprintf(key[i] + n, "%x", i);
+    }
+    bench("member names", key, len);
+
+    /* Paths: a shared head longer than the prefix, every compare ties */
+    for (i = 0; i < N; i++) {
+        len[i] = sprintf(key[i], "/home/user/projects/%04lx/src/file_%x.c", random() % 4096, i);
+    }
+    bench("paths", key, len);
+
+    printf("End of Test.\n");
+    free(len);
+    free(key);
+    free(buf);
+
+    return 0;
+}
@@ -24,6 +24,7 @@ int clock_gettime(int clk_id, struct timespec* t) {
 #include "skiplist.h"
 
 #define N 2 * 1024 * 1024
+#define DUPS 64
 // #define SKIPLIST_DEBUG
 
 int
@@ -42,18 +43,24 @@ main(void)
         exit(-1);
     }
 
-    printf("Test start!\n");
+    /* One seed drives both the keys and the towers, so a run can be
+     * repeated with SKIPLIST_SEED */
+    unsigned int seed = getenv("SKIPLIST_SEED") ? (unsigned int)strtoul(getenv("SKIPLIST_SEED"), NULL, 0)
+                                              : (unsigned int)time(NULL);
+    srandom(seed);
+    skiplist_seed(list, seed);
+
+    printf("Test start! seed:%u\n", seed);
     printf("Add %d nodes...\n", N);
 
     /* Insert test */
-    srandom(time(NULL));
     clock_gettime(CLOCK_MONOTONIC, &start);
     for (i = 0; i < N; i++) {
         int value = key[i] = (int)random();
         skiplist_insert(list, key[i], value);
     }
     clock_gettime(CLOCK_MONOTONIC, &end);
-    printf("time span: %ldms\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000);
+    printf("time span: %ldms, %d levels\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000, list->level);
     #ifdef SKIPLIST_DEBUG
     skiplist_dump(list);
     #endif
@@ -74,6 +81,37 @@ main(void)
     clock_gettime(CLOCK_MONOTONIC, &end);
     printf("time span: %ldms\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000);
 
+    /* Batched search test */
+    printf("Now search all nodes in groups...\n");
+    struct skipnode **nodes = malloc(N * sizeof(*nodes));
+    if (nodes == NULL) {
+        exit(-1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    skiplist_search_many(list, key, N, nodes);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000);
+    for (i = 0; i < N; i++) {
+        if (nodes[i] == NULL || nodes[i]->key != key[i]) {
+            printf("Not found:0x%08x\n", key[i]);
+        }
+    }
+    free(nodes);
+
+    #ifdef SKIPLIST_STATS
+    /* The towers counted by height must add up to the nodes */
+    struct skiplist_stats stats;
+    int towers = 0;
+    skiplist_stats(list, &stats);
+    skiplist_stats_dump(&stats);
+    for (i = 0; i < MAX_LEVEL; i++) {
+        towers += stats.height[i];
+    }
+    if (towers != stats.count || stats.op[SK_STAT_SEARCH].calls != N) {
+        printf("Stats counted %d towers and %llu searches\n", towers, stats.op[SK_STAT_SEARCH].calls);
+    }
+    #endif
+
     /* Delete test */
     printf("Now remove all nodes...\n");
     clock_gettime(CLOCK_MONOTONIC, &start);
@@ -85,6 +123,69 @@ main(void)
     #ifdef SKIPLIST_DEBUG
     skiplist_dump(list);
     #endif
+    if (list->count != 0 || list->level != 1) {
+        printf("%d nodes in %d levels left\n", list->count, list->level);
+    }
+
+    /* Duplicate keys test, DUPS nodes share each key */
+    int removed = 0;
+    printf("Add %d nodes, %d with each key...\n", N, DUPS);
+    for (i = 0; i < N; i++) {
+        skiplist_insert(list, key[i / DUPS], i);
+    }
+    printf("Now remove them one by one...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i++) {
+        removed += skiplist_remove_one(list, key[i / DUPS]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000);
+    for (i = 0; i < N; i++) {
+        skiplist_insert(list, key[i / DUPS], i);
+    }
+    printf("Now remove all nodes of each key at once...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i += DUPS) {
+        removed += skiplist_remove_all(list, key[i / DUPS]);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000);
+    if (removed != 2 * N || list->count != 0 || list->level != 1) {
+        printf("Removed %d of %d nodes, %d in %d levels left\n", removed, 2 * N, list->count, list->level);
+    }
+
+    /* Batch insert test */
+    struct sk_pair *pairs = malloc(N * sizeof(*pairs));
+    if (pairs == NULL) {
+        exit(-1);
+    }
+    for (i = 0; i < N; i++) {
+        pairs[i].key = key[i];
+        pairs[i].value = key[i];
+    }
+    printf("Now add all nodes in one batch...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    skiplist_insert_batch(list, pairs, N);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000);
+
+    /* Bulk load test, the batch above left the pairs sorted */
+    struct skiplist *bulk = skiplist_new();
+    if (bulk == NULL) {
+        exit(-1);
+    }
+    printf("Now bulk load all sorted nodes...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    skiplist_bulk_load(bulk, pairs, N);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000);
+    for (i = 0; i < N; i++) {
+        if (skiplist_search(bulk, pairs[i].key) == NULL) {
+            printf("Not found:0x%08x\n", pairs[i].key);
+        }
+    }
+    skiplist_delete(bulk);
+    free(pairs);
 
     printf("End of Test.\n");
     skiplist_delete(list);
@@ -0,0 +1,517 @@
+/*
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ */
+
+#ifndef _SKIPLIST_UNROLLED_H
+#define _SKIPLIST_UNROLLED_H
+
+/*
+ * Unrolled skiplist with rank.
+ *
+ * The bottom level is a list of blocks of up to SKIPLIST_BLOCK sorted keys,
+ * and the towers index the blocks by their first key, so the link overhead is
+ * paid once per block rather than once per key. A span counts the keys from
+ * the previous block on that level, exclusive, to this block, inclusive, so
+ * rank queries keep working in O(log n).
+ *
+ * Blocks are split in halves when full and merged with their successor when
+ * both fit in half a block. Keys are stored contiguously in each block, the
+ * values follow the link tower:
+ *
+ *   | nr | level | keys[SKIPLIST_BLOCK] | link[0] ... link[level-1] | values |
+ *
+ * With plain int keys a block is searched with the vector kernels of
+ * skiplist_simd.h instead of one compare per key.
+ */
+
+#ifndef MAX_LEVEL
+#define MAX_LEVEL 32  /* Should be enough for 2^32 elements */
+#endif
+
+/* Default int keys in their natural order, searched with skiplist_simd.h */
+#if !defined(SKIPLIST_KEY_TYPE) && !defined(SKIPLIST_KEY_CMP)
+#define SKIPLIST_KEY_INT
+#endif
+
+#ifndef SKIPLIST_KEY_TYPE
+#define SKIPLIST_KEY_TYPE int
+#endif
+
+#ifndef SKIPLIST_VALUE_TYPE
+#define SKIPLIST_VALUE_TYPE int
+#endif
+
+#ifndef SKIPLIST_KEY_CMP
+#define SKIPLIST_KEY_CMP(a, b) (((a) > (b)) - ((a) < (b)))
+#endif
+
+#ifndef SKIPLIST_P_SHIFT
+#define SKIPLIST_P_SHIFT 2  /* promotion probability p = 1/2^SKIPLIST_P_SHIFT: 1, 2 or 3 */
+#endif
+
+#ifndef SKIPLIST_BLOCK
+#define SKIPLIST_BLOCK 32  /* keys per block */
+#endif
+
+#ifdef SKIPLIST_KEY_INT
+#include "skiplist_simd.h"
+#endif
+
+typedef SKIPLIST_KEY_TYPE ul_key_t;
+typedef SKIPLIST_VALUE_TYPE ul_value_t;
+
+struct ul_link {
+        struct ul_link *next, *prev;
+        int span;
+};
+
+struct ul_block {
+        int nr;
+        int level;
+        ul_key_t keys[SKIPLIST_BLOCK];
+        struct ul_link link[0];
+};
+
+struct ul_skiplist {
+        int level;
+        int count;
+        int blocks;
+        unsigned long long rand;  /* level generator state */
+        size_t bytes;
+        struct ul_link head[MAX_LEVEL];
+};
+
+#define ul_entry(ptr, i) \
+        ((struct ul_block *)((char *)(ptr) - (size_t)(&((struct ul_block *)0)->link[i])))
+
+#define ul_values(block) ((ul_value_t *)&(block)->link[(block)->level])
+
+static inline size_t ul_block_size(int level)
+{
+        return sizeof(struct ul_block) + level * sizeof(struct ul_link) +
+               SKIPLIST_BLOCK * sizeof(ul_value_t);
+}
+
+/* Seed the level generator of the list, the same seed and the same
+ * operations build the same blocks. */
+static void ul_skiplist_seed(struct ul_skiplist *list, unsigned long long seed)
+{
+        /* splitmix64 spreads small seeds over the whole state */
+        seed += 0x9e3779b97f4a7c15ULL;
+        seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebULL;
+        seed ^= seed >> 31;
+        list->rand = seed != 0 ? seed : 1;
+}
+
+static struct ul_skiplist *ul_skiplist_new(void)
+{
+        int i;
+        struct ul_skiplist *list = (struct ul_skiplist *)malloc(sizeof(*list));
+        if (list != NULL) {
+                list->level = 1;
+                list->count = 0;
+                ul_skiplist_seed(list, 0);
+                list->blocks = 0;
+                list->bytes = sizeof(*list);
+                for (i = 0; i < MAX_LEVEL; i++) {
+                        list->head[i].next = &list->head[i];
+                        list->head[i].prev = &list->head[i];
+                        list->head[i].span = 0;
+                }
+        }
+        return list;
+}
+
+static void ul_skiplist_delete(struct ul_skiplist *list)
+{
+        struct ul_link *pos, *n;
+        for (pos = list->head[0].next; pos != &list->head[0]; pos = n) {
+                n = pos->next;
+                free(ul_entry(pos, 0));
+        }
+        free(list);
+}
+
+/* random_level() of skiplist.h, capped by the number of blocks. */
+static int ul_random_level(struct ul_skiplist *list)
+{
+        int level, cap;
+        unsigned long long x = list->rand;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        list->rand = x;
+
+        level = __builtin_ctzll(x) / SKIPLIST_P_SHIFT + 1;
+        cap = (64 - __builtin_clzll((unsigned long long)list->blocks + 1)) / SKIPLIST_P_SHIFT + 1;
+        if (cap > MAX_LEVEL) {
+                cap = MAX_LEVEL;
+        }
+        return level < cap ? level : cap;
+}
+
+/* First index in the block whose key is not less than key. */
+static inline int ul_block_search(struct ul_block *block, ul_key_t key)
+{
+#ifdef SKIPLIST_KEY_INT
+        return sk_lower_bound(block->keys, block->nr, key);
+#else
+        int i;
+        for (i = 0; i < block->nr; i++) {
+                if (SKIPLIST_KEY_CMP(block->keys[i], key) >= 0) {
+                        break;
+                }
+        }
+        return i;
+#endif
+}
+
+/* First index in the block whose key is greater than key. */
+static inline int ul_block_upper(struct ul_block *block, ul_key_t key)
+{
+#ifdef SKIPLIST_KEY_INT
+        return sk_upper_bound(block->keys, block->nr, key);
+#else
+        int i;
+        for (i = 0; i < block->nr; i++) {
+                if (SKIPLIST_KEY_CMP(block->keys[i], key) > 0) {
+                        break;
+                }
+        }
+        return i;
+#endif
+}
+
+/* Fill pred[] with the last link on every level whose block starts with a
+ * key not greater than key, and rank[] with the number of keys up to the end
+ * of that block. Returns the block on level 0, or NULL if key goes before
+ * every block. */
+static struct ul_block *
+__ul_find(struct ul_skiplist *list, ul_key_t key, struct ul_link **pred, int *rank)
+{
+        int i, traversed = 0;
+        struct ul_link *pos = &list->head[list->level - 1];
+
+        for (i = MAX_LEVEL - 1; i >= list->level; i--) {
+                pred[i] = &list->head[i];
+                rank[i] = 0;
+        }
+        for (; i >= 0; i--) {
+                while (pos->next != &list->head[i] &&
+                       SKIPLIST_KEY_CMP(ul_entry(pos->next, i)->keys[0], key) <= 0) {
+                        pos = pos->next;
+                        traversed += pos->span;
+                }
+                pred[i] = pos;
+                rank[i] = traversed;
+                pos--;
+        }
+
+        return pred[0] == &list->head[0] ? NULL : ul_entry(pred[0], 0);
+}
+
+/* The link whose span covers the keys of block, given a path to it. */
+static inline struct ul_link *
+ul_cover(struct ul_link **pred, struct ul_block *block, int i)
+{
+        return pred[i] == &block->link[i] ? pred[i] : pred[i]->next;
+}
+
+static void
+ul_adjust(struct ul_skiplist *list, struct ul_link **pred, struct ul_block *block, int delta)
+{
+        int i;
+        for (i = 0; i < list->level; i++) {
+                ul_cover(pred, block, i)->span += delta;
+        }
+}
+
+/* Link an empty block right after the block ending pred[0], whose rank is
+ * rank[0], and turn pred[] into the path to the new block. */
+static struct ul_block *
+ul_block_new(struct ul_skiplist *list, struct ul_link **pred, int *rank)
+{
+        int i;
+        int level = ul_random_level(list);
+        struct ul_block *block = (struct ul_block *)malloc(ul_block_size(level));
+        if (block == NULL) {
+                return NULL;
+        }
+
+        block->nr = 0;
+        block->level = level;
+        if (level > list->level) {
+                list->level = level;
+        }
+        for (i = 0; i < level; i++) {
+                struct ul_link *link = &block->link[i];
+                link->next = pred[i]->next;
+                link->prev = pred[i];
+                link->next->prev = link;
+                pred[i]->next = link;
+                link->span = rank[0] - rank[i];
+                link->next->span -= link->span;
+                pred[i] = link;
+                rank[i] = rank[0];
+        }
+
+        list->blocks++;
+        list->bytes += ul_block_size(level);
+        return block;
+}
+
+/* Unlink an empty block whose keys were already taken out of the spans. */
+static void ul_block_delete(struct ul_skiplist *list, struct ul_block *block)
+{
+        int i;
+        for (i = 0; i < block->level; i++) {
+                struct ul_link *link = &block->link[i];
+                link->next->span += link->span;
+                link->prev->next = link->next;
+                link->next->prev = link->prev;
+        }
+        while (list->level > 1 && list->head[list->level - 1].next == &list->head[list->level - 1]) {
+                list->level--;
+        }
+
+        list->blocks--;
+        list->bytes -= ul_block_size(block->level);
+        free(block);
+}
+
+static void
+ul_block_move(struct ul_block *dst, int to, struct ul_block *src, int from, int nr)
+{
+        memmove(&dst->keys[to], &src->keys[from], nr * sizeof(ul_key_t));
+        memmove(&ul_values(dst)[to], &ul_values(src)[from], nr * sizeof(ul_value_t));
+}
+
+/* Returns 0 on success and -1 when out of memory. */
+static int ul_skiplist_insert(struct ul_skiplist *list, ul_key_t key, ul_value_t value)
+{
+        int i, idx, rank[MAX_LEVEL];
+        struct ul_link *pred[MAX_LEVEL];
+        struct ul_block *block = __ul_find(list, key, pred, rank);
+
+        if (block == NULL) {
+                if (list->head[0].next == &list->head[0]) {
+                        block = ul_block_new(list, pred, rank);
+                        if (block == NULL) {
+                                return -1;
+                        }
+                } else {
+                        /* smaller than every key, goes to the front of the
+                         * first block which is first on all its levels */
+                        block = ul_entry(list->head[0].next, 0);
+                        for (i = 0; i < block->level; i++) {
+                                pred[i] = &block->link[i];
+                                rank[i] = block->nr;
+                        }
+                }
+        }
+
+        if (block->nr == SKIPLIST_BLOCK) {
+                int half = SKIPLIST_BLOCK / 2;
+                struct ul_link *path[MAX_LEVEL];
+                struct ul_block *right;
+
+                for (i = 0; i < MAX_LEVEL; i++) {
+                        path[i] = pred[i];
+                }
+                right = ul_block_new(list, path, rank);
+                if (right == NULL) {
+                        return -1;
+                }
+                ul_block_move(right, 0, block, half, SKIPLIST_BLOCK - half);
+                right->nr = SKIPLIST_BLOCK - half;
+                block->nr = half;
+                ul_adjust(list, pred, block, -right->nr);
+                ul_adjust(list, path, right, right->nr);
+
+                if (SKIPLIST_KEY_CMP(right->keys[0], key) <= 0) {
+                        block = right;
+                        for (i = 0; i < MAX_LEVEL; i++) {
+                                pred[i] = path[i];
+                        }
+                }
+        }
+
+        idx = ul_block_search(block, key);
+        ul_block_move(block, idx + 1, block, idx, block->nr - idx);
+        block->keys[idx] = key;
+        ul_values(block)[idx] = value;
+        block->nr++;
+        ul_adjust(list, pred, block, 1);
+        list->count++;
+
+        return 0;
+}
+
+/* Remove one key, returns 1 if it was found. */
+static int ul_skiplist_remove(struct ul_skiplist *list, ul_key_t key)
+{
+        int i, idx, rank[MAX_LEVEL];
+        struct ul_link *pred[MAX_LEVEL];
+        struct ul_block *next, *block = __ul_find(list, key, pred, rank);
+
+        if (block == NULL) {
+                return 0;
+        }
+        idx = ul_block_search(block, key);
+        if (idx == block->nr || SKIPLIST_KEY_CMP(block->keys[idx], key) != 0) {
+                return 0;
+        }
+
+        ul_block_move(block, idx, block, idx + 1, block->nr - idx - 1);
+        block->nr--;
+        ul_adjust(list, pred, block, -1);
+        list->count--;
+
+        if (block->nr == 0) {
+                ul_block_delete(list, block);
+                return 1;
+        }
+
+        if (block->link[0].next == &list->head[0]) {
+                return 1;
+        }
+        next = ul_entry(block->link[0].next, 0);
+        if (block->nr + next->nr <= SKIPLIST_BLOCK / 2) {
+                struct ul_link *path[MAX_LEVEL];
+                int nr = next->nr;
+                for (i = 0; i < MAX_LEVEL; i++) {
+                        path[i] = i < next->level ? &next->link[i] : pred[i];
+                }
+                ul_block_move(block, block->nr, next, 0, nr);
+                block->nr += nr;
+                next->nr = 0;
+                ul_adjust(list, pred, block, nr);
+                ul_adjust(list, path, next, -nr);
+                ul_block_delete(list, next);
+        }
+
+        return 1;
+}
+
+/* Returns 1 and stores the value if the key is present. */
+static int ul_skiplist_search(struct ul_skiplist *list, ul_key_t key, ul_value_t *value)
+{
+        int idx, rank[MAX_LEVEL];
+        struct ul_link *pred[MAX_LEVEL];
+        struct ul_block *block = __ul_find(list, key, pred, rank);
+
+        if (block == NULL) {
+                return 0;
+        }
+        idx = ul_block_search(block, key);
+        if (idx == block->nr || SKIPLIST_KEY_CMP(block->keys[idx], key) != 0) {
+                return 0;
+        }
+        if (value != NULL) {
+                *value = ul_values(block)[idx];
+        }
+        return 1;
+}
+
+/* Get the key rank, 0 if absent. */
+static int ul_skiplist_key_rank(struct ul_skiplist *list, ul_key_t key)
+{
+        int idx, rank[MAX_LEVEL];
+        struct ul_link *pred[MAX_LEVEL];
+        struct ul_block *block = __ul_find(list, key, pred, rank);
+
+        if (block == NULL) {
+                return 0;
+        }
+        idx = ul_block_search(block, key);
+        if (idx == block->nr || SKIPLIST_KEY_CMP(block->keys[idx], key) != 0) {
+                return 0;
+        }
+        return rank[0] - block->nr + idx + 1;
+}
+
+/* Returns 1 and stores the key and value of the given rank if it exists. */
+static int
+ul_skiplist_search_by_rank(struct ul_skiplist *list, int rank, ul_key_t *key, ul_value_t *value)
+{
+        int i, traversed = 0;
+        struct ul_link *pos = &list->head[list->level - 1];
+        struct ul_block *block;
+
+        if (rank <= 0 || rank > list->count) {
+                return 0;
+        }
+
+        for (i = list->level - 1; i >= 0; i--) {
+                while (pos->next != &list->head[i] && traversed + pos->next->span < rank) {
+                        pos = pos->next;
+                        traversed += pos->span;
+                }
+                pos--;
+        }
+
+        pos++;
+        block = ul_entry(pos->next, 0);
+        if (key != NULL) {
+                *key = block->keys[rank - traversed - 1];
+        }
+        if (value != NULL) {
+                *value = ul_values(block)[rank - traversed - 1];
+        }
+        return 1;
+}
+
+/* Copy the keys in [min, max] in order, and their values unless values is
+ * NULL, stopping after limit keys. Returns the number of keys copied. Blocks
+ * inside the range are copied whole, only the two ends are searched. */
+static int
+ul_skiplist_range(struct ul_skiplist *list, ul_key_t min, ul_key_t max,
+                  ul_key_t *keys, ul_value_t *values, int limit)
+{
+        int i, from = 0, to, n = 0;
+        struct ul_link *pos = &list->head[list->level - 1];
+        struct ul_block *block;
+
+        /* last block starting before min, duplicates of min may end it */
+        for (i = list->level - 1; i >= 0; i--) {
+                while (pos->next != &list->head[i] &&
+                       SKIPLIST_KEY_CMP(ul_entry(pos->next, i)->keys[0], min) < 0) {
+                        pos = pos->next;
+                }
+                pos--;
+        }
+        pos++;
+        if (pos == &list->head[0]) {
+                pos = pos->next;
+        } else {
+                from = ul_block_search(ul_entry(pos, 0), min);
+        }
+
+        for (; pos != &list->head[0] && n < limit; pos = pos->next, from = 0) {
+                block = ul_entry(pos, 0);
+                if (SKIPLIST_KEY_CMP(block->keys[block->nr - 1], max) <= 0) {
+                        to = block->nr;
+                } else {
+                        to = ul_block_upper(block, max);
+                }
+                if (to < from) {
+                        break;
+                }
+                if (to - from > limit - n) {
+                        to = from + limit - n;
+                }
+                memcpy(&keys[n], &block->keys[from], (to - from) * sizeof(ul_key_t));
+                if (values != NULL) {
+                        memcpy(&values[n], &ul_values(block)[from], (to - from) * sizeof(ul_value_t));
+                }
+                n += to - from;
+                if (to < block->nr) {
+                        break;
+                }
+        }
+
+        return n;
+}
+
+#endif  /* _SKIPLIST_UNROLLED_H */
@@ -0,0 +1,254 @@
+/*
+* Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* skiplist_unrolled.h first, so it sees the default int keys it scans with SIMD */
+#include "skiplist_unrolled.h"
+#include "skiplist.h"
+#include "skiplist_perf.h"
+
+#define N 2 * 1024 * 1024
+#define RANGE_WIDTH 0x10000  /* about 64 of the random keys per window */
+#define RANGE_MAX 1024
+
+static const char *simd_name[] = { "scalar", "sse2", "avx2" };
+
+/* The vector kernels must agree with the scalar ones on every block size. */
+static void check_kernels(void)
+{
+    int i, n, k, keys[SKIPLIST_BLOCK];
+    for (n = 0; n <= SKIPLIST_BLOCK; n++) {
+        for (i = 0; i < n; i++) {
+            keys[i] = i / 2 * 2 - n;
+        }
+        for (k = -n - 2; k <= n + 2; k++) {
+            if (sk_lower_bound(keys, n, k) != sk_lower_bound_scalar(keys, n, k) ||
+                sk_upper_bound(keys, n, k) != sk_upper_bound_scalar(keys, n, k)) {
+                printf("Kernel mismatch: n=%d key=%d\n", n, k);
+            }
+        }
+    }
+}
+
+/* Every span must count the keys from the end of the previous block on its
+ * level to the end of its own block, and the blocks must hold count keys. */
+static int check_spans(struct ul_skiplist *ul)
+{
+    int i, rank = 0, last[MAX_LEVEL] = {0};
+    struct ul_link *pos;
+
+    for (pos = ul->head[0].next; pos != &ul->head[0]; pos = pos->next) {
+        struct ul_block *block = ul_entry(pos, 0);
+        if (block->nr < 1 || block->nr > SKIPLIST_BLOCK || block->level > ul->level) {
+            printf("Bad block after rank %d: %d keys, level %d\n", rank, block->nr, block->level);
+            return 0;
+        }
+        rank += block->nr;
+        for (i = 0; i < block->level; i++) {
+            if (block->link[i].span != rank - last[i]) {
+                printf("Bad span at rank %d level %d\n", rank, i);
+                return 0;
+            }
+            last[i] = rank;
+        }
+    }
+    if (rank != ul->count) {
+        printf("Count %d but %d keys in blocks\n", ul->count, rank);
+        return 0;
+    }
+    return 1;
+}
+
+/* The keys are distinct, so the key of each rank must be above the one
+ * before it and rank back to it. */
+static int check_ranks(struct ul_skiplist *ul)
+{
+    int r, k, v, last = 0;
+    for (r = 1; r <= ul->count; r++) {
+        if (!ul_skiplist_search_by_rank(ul, r, &k, &v)) {
+            printf("Not found:%d\n", r);
+            return 0;
+        }
+        if ((r > 1 && k <= last) || ul_skiplist_key_rank(ul, k) != r) {
+            printf("Wrong rank:%d\n", r);
+            return 0;
+        }
+        last = k;
+    }
+    return 1;
+}
+
+static long range_scan(struct ul_skiplist *ul, int *key, int *out)
+{
+    int i, j, n;
+    long total = 0;
+    for (i = 0; i < N; i++) {
+        int min = key[i], max = min > 0x7fffffff - RANGE_WIDTH ? 0x7fffffff : min + RANGE_WIDTH;
+        n = ul_skiplist_range(ul, min, max, out, NULL, RANGE_MAX);
+        for (j = 0; j < n; j++) {
+            if (out[j] < min || out[j] > max || (j > 0 && out[j - 1] > out[j])) {
+                printf("Bad range:0x%08x\n", min);
+                break;
+            }
+        }
+        if (n == 0 || out[0] != min) {
+            printf("Range misses:0x%08x\n", min);
+        }
+        total += n;
+    }
+    return total;
+}
+
+static size_t skiplist_memory(struct skiplist *list)
+{
+    size_t bytes = sizeof(*list);
+    struct sk_slab *slab;
+    for (slab = list->slabs; slab != NULL; slab = slab->next) {
+        bytes += SKIPLIST_SLAB_SIZE;
+    }
+    return bytes;
+}
+
+int
+main(void)
+{
+    int i, k, v;
+    struct phase ph;
+
+    int *key = malloc(N * sizeof(int));
+    if (key == NULL) {
+        exit(-1);
+    }
+
+    struct skiplist *list = skiplist_new();
+    struct ul_skiplist *ul = ul_skiplist_new();
+    if (list == NULL || ul == NULL) {
+        exit(-1);
+    }
+
+    /* Distinct keys spread evenly over the positive ints from a random
+     * start: i times an odd number is a permutation modulo 2^31 */
+    srandom(time(NULL));
+    unsigned int base = (unsigned int)random();
+    for (i = 0; i < N; i++) {
+        key[i] = (int)((base + (unsigned int)i * 0x9e3779b1U) & 0x7fffffff);
+    }
+
+    printf("Test start!\n");
+    printf("Add %d nodes...\n", N);
+    printf("skiplist.h:          ");
+    phase_start(&ph);
+    for (i = 0; i < N; i++) {
+        skiplist_insert(list, key[i], key[i]);
+    }
+    phase_end(&ph, N);
+    printf("skiplist_unrolled.h: ");
+    phase_start(&ph);
+    for (i = 0; i < N; i++) {
+        ul_skiplist_insert(ul, key[i], key[i]);
+    }
+    phase_end(&ph, N);
+    printf("memory per key: skiplist.h %.1f bytes, skiplist_unrolled.h %.1f bytes in %d blocks\n",
+           (double)skiplist_memory(list) / (N), (double)ul->bytes / (N), ul->blocks);
+    if (!check_spans(ul)) {
+        printf("Spans broken by splits\n");
+    }
+
+    printf("Now search each node...\n");
+    printf("skiplist.h:          ");
+    phase_start(&ph);
+    for (i = 0; i < N; i++) {
+        if (skiplist_search(list, key[i]) == NULL) {
+            printf("Not found:0x%08x\n", key[i]);
+        }
+    }
+    phase_end(&ph, N);
+    printf("skiplist_unrolled.h: ");
+    phase_start(&ph);
+    for (i = 0; i < N; i++) {
+        if (!ul_skiplist_search(ul, key[i], &v) || v != key[i]) {
+            printf("Not found:0x%08x\n", key[i]);
+        }
+    }
+    phase_end(&ph, N);
+
+    printf("Now search each node and scan ranges, scalar against %s...\n",
+           simd_name[sk_simd_detect()]);
+    check_kernels();
+    int *out = malloc(RANGE_MAX * sizeof(int));
+    if (out == NULL) {
+        exit(-1);
+    }
+    long total[2];
+    int level = sk_simd_level;
+    for (k = 0; k < 2; k++) {
+        sk_simd_level = k == 0 ? SK_SIMD_SCALAR : level;
+        printf("search %-7s", simd_name[sk_simd_level]);
+        phase_start(&ph);
+        for (i = 0; i < N; i++) {
+            if (!ul_skiplist_search(ul, key[i], &v) || v != key[i]) {
+                printf("Not found:0x%08x\n", key[i]);
+            }
+        }
+        phase_end(&ph, N);
+        printf("range  %-7s", simd_name[sk_simd_level]);
+        phase_start(&ph);
+        total[k] = range_scan(ul, key, out);
+        phase_end(&ph, N);
+    }
+    if (total[0] != total[1]) {
+        printf("Range scans differ: %ld and %ld keys\n", total[0], total[1]);
+    }
+    printf("%.1f keys per range\n", (double)total[1] / (N));
+    free(out);
+
+    printf("Now search each node by rank...\n");
+    printf("skiplist_unrolled.h: ");
+    phase_start(&ph);
+    check_ranks(ul);
+    phase_end(&ph, N);
+
+    /* Taking every other key out merges blocks and putting them back splits
+     * them again, the spans and ranks must follow both */
+    for (i = 1; i < N; i += 2) {
+        ul_skiplist_remove(ul, key[i]);
+    }
+    if (ul->count != N / 2 || !check_spans(ul) || !check_ranks(ul)) {
+        printf("Ranks broken by merges\n");
+    }
+    for (i = 1; i < N; i += 2) {
+        ul_skiplist_insert(ul, key[i], key[i]);
+    }
+    if (ul->count != N || !check_spans(ul) || !check_ranks(ul)) {
+        printf("Ranks broken by splits\n");
+    }
+
+    printf("Now remove all nodes...\n");
+    printf("skiplist.h:          ");
+    phase_start(&ph);
+    for (i = 0; i < N; i++) {
+        skiplist_remove(list, key[i]);
+    }
+    phase_end(&ph, N);
+    printf("skiplist_unrolled.h: ");
+    phase_start(&ph);
+    for (i = 0; i < N; i++) {
+        ul_skiplist_remove(ul, key[i]);
+    }
+    phase_end(&ph, N);
+    if (ul->count != 0 || ul->blocks != 0 || !check_spans(ul)) {
+        printf("%d nodes in %d blocks left\n", ul->count, ul->blocks);
+    }
+
+    printf("End of Test.\n");
+    skiplist_delete(list);
+    ul_skiplist_delete(ul);
+
+    free(key);
+
+    return 0;
+}
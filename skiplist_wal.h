@@ -0,0 +1,563 @@
+/*
+ * Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+ */
+
+#ifndef _SKIPLIST_WAL_H
+#define _SKIPLIST_WAL_H
+
+/*
+ * Write-ahead log for durable skiplist mutations.
+ *
+ * Include it after skiplist.h or skiplist_with_rank.h. Every mutation made
+ * through skiplist_wal_*() is applied to the list and appended to the log
+ * as one compact record, a CRC-32 and the type followed by the raw key and
+ * value. When the records reach the disk depends on the sync policy:
+ *
+ *   SKIPLIST_SYNC_ALWAYS    the call returns once its record is synced. The
+ *                           callers waiting meanwhile are committed as a
+ *                           group: one of them writes out everything logged
+ *                           so far with a single write and fdatasync, and
+ *                           the others sleep until it is done.
+ *   SKIPLIST_SYNC_INTERVAL  a mutation issued at least interval_ms after the
+ *                           last sync writes and syncs the log, so at most
+ *                           that much work is lost in a crash (plus the tail
+ *                           of an idle period, until the next call).
+ *   SKIPLIST_SYNC_NEVER     records are written when the buffer fills and
+ *                           left to the OS.
+ *
+ * skiplist_wal_compact() saves the list as a skiplist_file.h image next to
+ * the log, "<path>.img", and starts an empty log based on it. The log header
+ * names its base image by CRC and size, so after a crash between the two
+ * steps a log older than the image is recognized and dropped rather than
+ * replayed twice. skiplist_wal_open() loads the image, replays the log over
+ * it and cuts off a torn record at its end.
+ *
+ * The mutations take wal->lock, and lookups on wal->list made while other
+ * threads mutate must hold it too. A mutation is visible to them before it
+ * is durable.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+
+#include "skiplist_file.h"
+
+#define SKIPLIST_WAL_MAGIC "SKIPWAL"
+#define SKIPLIST_WAL_VERSION 1
+
+#define SKIPLIST_SYNC_ALWAYS 0
+#define SKIPLIST_SYNC_INTERVAL 1
+#define SKIPLIST_SYNC_NEVER 2
+
+#ifndef SKIPLIST_WAL_BUF
+#define SKIPLIST_WAL_BUF 65536         /* bytes logged before a write is forced */
+#endif
+
+#define WAL_INSERT 1
+#define WAL_REMOVE 2
+#define WAL_REMOVE_RANGE 3
+
+#define WAL_MINEX 0x1
+#define WAL_MAXEX 0x2
+
+struct wal_header {
+        char magic[8];
+        unsigned int version;
+        unsigned int order;             /* SKIPLIST_FILE_ORDER as written */
+        unsigned int key_size;
+        unsigned int value_size;
+        unsigned int base_crc;          /* CRC of the image the log applies to */
+        unsigned int reserved;
+        unsigned long long base_size;   /* its size, 0 when there is no image */
+};
+
+struct wal_record {
+        unsigned int crc;               /* CRC-32 of the rest of the record */
+        unsigned char type;
+        unsigned char flags;
+        unsigned short size;            /* payload bytes that follow */
+};
+
+struct skiplist_wal {
+        struct skiplist *list;
+        pthread_mutex_t lock;
+        pthread_cond_t synced;
+        int fd;
+        int policy;
+        int interval_ms;
+        int flushing;                   /* a write is in progress */
+        int error;                      /* sticky, set by a failed write */
+        unsigned long long lsn;         /* records logged */
+        unsigned long long synced_lsn;  /* records known to be on disk */
+        unsigned long long syncs;       /* fdatasync calls, for the curious */
+        struct timespec last_sync;
+        char *buf, *spare;              /* records not written yet, and the one being written */
+        size_t len, cap, spare_cap;
+        char *path, *image;
+};
+
+static long __wal_ms_since(struct timespec *then)
+{
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        return (now.tv_sec - then->tv_sec) * 1000 + (now.tv_nsec - then->tv_nsec) / 1000000;
+}
+
+static int __wal_write(int fd, const char *buf, size_t len)
+{
+        while (len > 0) {
+                ssize_t n = write(fd, buf, len);
+                if (n < 0) {
+                        if (errno == EINTR) {
+                                continue;
+                        }
+                        return -1;
+                }
+                buf += n;
+                len -= n;
+        }
+        return 0;
+}
+
+/* Write out everything logged so far, and sync it if asked. Called with the
+ * lock held, which is dropped around the I/O so that more records can be
+ * logged meanwhile: they make up the next group. */
+static int __wal_flush(struct skiplist_wal *wal, int sync)
+{
+        char *buf;
+        size_t len, cap;
+        unsigned long long lsn;
+        int ret;
+
+        while (wal->flushing) {
+                pthread_cond_wait(&wal->synced, &wal->lock);
+        }
+        if (wal->error) {
+                return -1;
+        }
+        if (wal->len == 0 && (!sync || wal->synced_lsn == wal->lsn)) {
+                return 0;
+        }
+
+        buf = wal->buf;
+        len = wal->len;
+        cap = wal->cap;
+        wal->buf = wal->spare;
+        wal->cap = wal->spare_cap;
+        wal->len = 0;
+        lsn = wal->lsn;
+        wal->flushing = 1;
+        pthread_mutex_unlock(&wal->lock);
+
+        ret = __wal_write(wal->fd, buf, len);
+        if (ret == 0 && sync) {
+                ret = fdatasync(wal->fd);
+        }
+
+        pthread_mutex_lock(&wal->lock);
+        wal->spare = buf;
+        wal->spare_cap = cap;
+        wal->flushing = 0;
+        if (ret < 0) {
+                wal->error = 1;
+        } else if (sync) {
+                wal->synced_lsn = lsn;
+                wal->syncs++;
+                clock_gettime(CLOCK_MONOTONIC, &wal->last_sync);
+        }
+        pthread_cond_broadcast(&wal->synced);
+        return ret;
+}
+
+/* Log one record, called with the lock held. */
+static int
+__wal_append(struct skiplist_wal *wal, int type, int flags,
+             const void *a, size_t a_size, const void *b, size_t b_size)
+{
+        struct wal_record rec;
+        size_t size = sizeof(rec) + a_size + b_size;
+        char *p;
+
+        if (wal->error) {
+                return -1;
+        }
+        if (wal->len + size > wal->cap) {
+                size_t cap = wal->cap * 2 > wal->len + size ? wal->cap * 2 : wal->len + size;
+                p = (char *)realloc(wal->buf, cap);
+                if (p == NULL) {
+                        return -1;
+                }
+                wal->buf = p;
+                wal->cap = cap;
+        }
+
+        p = wal->buf + wal->len;
+        rec.type = type;
+        rec.flags = flags;
+        rec.size = a_size + b_size;
+        memcpy(p + sizeof(rec), a, a_size);
+        if (b_size > 0) {
+                memcpy(p + sizeof(rec) + a_size, b, b_size);
+        }
+        rec.crc = sk_crc32(sk_crc32(0, &rec.type, sizeof(rec) - sizeof(rec.crc)),
+                           p + sizeof(rec), rec.size);
+        memcpy(p, &rec, sizeof(rec));
+        wal->len += size;
+        wal->lsn++;
+        return 0;
+}
+
+/* Make the record just logged as durable as the policy asks, called with the
+ * lock held. Under SKIPLIST_SYNC_ALWAYS the first caller to find no write in
+ * progress leads the next group commit, the rest wait for it. */
+static int __wal_commit(struct skiplist_wal *wal)
+{
+        unsigned long long lsn = wal->lsn;
+
+        switch (wal->policy) {
+        case SKIPLIST_SYNC_ALWAYS:
+                while (wal->synced_lsn < lsn && !wal->error) {
+                        if (wal->flushing) {
+                                pthread_cond_wait(&wal->synced, &wal->lock);
+                        } else {
+                                __wal_flush(wal, 1);
+                        }
+                }
+                break;
+        case SKIPLIST_SYNC_INTERVAL:
+                if (__wal_ms_since(&wal->last_sync) >= wal->interval_ms) {
+                        return __wal_flush(wal, 1);
+                }
+                /* fall through */
+        default:
+                if (wal->len >= SKIPLIST_WAL_BUF && !wal->flushing) {
+                        return __wal_flush(wal, 0);
+                }
+                break;
+        }
+        return wal->error ? -1 : 0;
+}
+
+/* Start a log based on the image with the given CRC and size, replacing the
+ * old one atomically and durably. */
+static int __wal_reset(struct skiplist_wal *wal, unsigned int base_crc, unsigned long long base_size)
+{
+        int fd;
+        char tmp[4096];
+        struct wal_header hdr;
+
+        if ((size_t)snprintf(tmp, sizeof(tmp), "%s.tmp", wal->path) >= sizeof(tmp)) {
+                return -1;
+        }
+        memset(&hdr, 0, sizeof(hdr));
+        memcpy(hdr.magic, SKIPLIST_WAL_MAGIC, sizeof(hdr.magic));
+        hdr.version = SKIPLIST_WAL_VERSION;
+        hdr.order = SKIPLIST_FILE_ORDER;
+        hdr.key_size = sizeof(sk_key_t);
+        hdr.value_size = sizeof(sk_value_t);
+        hdr.base_crc = base_crc;
+        hdr.base_size = base_size;
+
+        fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+                return -1;
+        }
+        if (__wal_write(fd, (const char *)&hdr, sizeof(hdr)) < 0 || fsync(fd) < 0 ||
+            rename(tmp, wal->path) < 0 || sk_file_sync_dir(wal->path) < 0) {
+                close(fd);
+                unlink(tmp);
+                return -1;
+        }
+        if (wal->fd >= 0) {
+                close(wal->fd);
+        }
+        wal->fd = fd;
+        return 0;
+}
+
+/* CRC and size of the image at path as its header records them, both 0 if
+ * there is no file. */
+static int __wal_image_stamp(const char *path, unsigned int *crc, unsigned long long *size)
+{
+        struct sk_file_header hdr;
+        int fd = open(path, O_RDONLY);
+        *crc = 0;
+        *size = 0;
+        if (fd < 0) {
+                return errno == ENOENT ? 0 : -1;
+        }
+        if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+                close(fd);
+                return -1;
+        }
+        close(fd);
+        *crc = hdr.crc;
+        *size = hdr.size;
+        return 0;
+}
+
+/* Apply the records of the log, which is left open for appending right after
+ * the last whole one. Returns -1 only if the log cannot be read. */
+static int __wal_replay(struct skiplist_wal *wal, int fd, unsigned long long len)
+{
+        char *buf, *p, *end;
+        struct wal_record rec;
+        unsigned long long n;
+
+        buf = (char *)malloc(len + 1);
+        if (buf == NULL) {
+                return -1;
+        }
+        for (n = 0; n < len;) {
+                ssize_t r = read(fd, buf + n, len - n);
+                if (r <= 0) {
+                        free(buf);
+                        return -1;
+                }
+                n += r;
+        }
+
+        p = buf + sizeof(struct wal_header);
+        end = buf + len;
+        while (p + sizeof(rec) <= end) {
+                sk_key_t key;
+                sk_value_t value;
+
+                memcpy(&rec, p, sizeof(rec));
+                if (p + sizeof(rec) + rec.size > end ||
+                    sk_crc32(sk_crc32(0, p + sizeof(rec.crc), sizeof(rec) - sizeof(rec.crc)),
+                             p + sizeof(rec), rec.size) != rec.crc) {
+                        break;  /* torn tail */
+                }
+                memcpy(&key, p + sizeof(rec), sizeof(key));
+                if (rec.type == WAL_INSERT && rec.size == sizeof(key) + sizeof(value)) {
+                        memcpy(&value, p + sizeof(rec) + sizeof(key), sizeof(value));
+                        skiplist_insert(wal->list, key, value);
+                } else if (rec.type == WAL_REMOVE && rec.size == sizeof(key)) {
+                        skiplist_remove(wal->list, key);
+#ifdef SKIPLIST_WITH_RANK
+                } else if (rec.type == WAL_REMOVE_RANGE && rec.size == 2 * sizeof(key)) {
+                        struct range_spec range;
+                        range.min = key;
+                        memcpy(&range.max, p + sizeof(rec) + sizeof(key), sizeof(range.max));
+                        range.minex = !!(rec.flags & WAL_MINEX);
+                        range.maxex = !!(rec.flags & WAL_MAXEX);
+                        remove_in_range(wal->list, &range);
+#endif
+                } else {
+                        break;
+                }
+                p += sizeof(rec) + rec.size;
+                wal->lsn++;
+        }
+        n = p - buf;
+        free(buf);
+
+        wal->synced_lsn = wal->lsn;
+        if (ftruncate(fd, n) < 0 || lseek(fd, n, SEEK_SET) < 0) {
+                return -1;
+        }
+        return 0;
+}
+
+static void skiplist_wal_close(struct skiplist_wal *wal);
+
+/* Open the log at path, creating it if needed, and rebuild the list from the
+ * image "<path>.img" and the log. Returns NULL on an I/O error or a log or
+ * image written for other key and value types. */
+static struct skiplist_wal *skiplist_wal_open(const char *path, int policy, int interval_ms)
+{
+        int fd;
+        struct stat st;
+        struct wal_header hdr;
+        unsigned int base_crc;
+        unsigned long long base_size;
+        size_t len = strlen(path);
+        struct skiplist_wal *wal = (struct skiplist_wal *)calloc(1, sizeof(*wal));
+        if (wal == NULL) {
+                return NULL;
+        }
+
+        pthread_mutex_init(&wal->lock, NULL);
+        pthread_cond_init(&wal->synced, NULL);
+        wal->fd = -1;
+        wal->policy = policy;
+        wal->interval_ms = interval_ms;
+        clock_gettime(CLOCK_MONOTONIC, &wal->last_sync);
+        wal->cap = wal->spare_cap = SKIPLIST_WAL_BUF + sizeof(struct wal_record) + 64;
+        wal->buf = (char *)malloc(wal->cap);
+        wal->spare = (char *)malloc(wal->spare_cap);
+        wal->path = (char *)malloc(len + 1);
+        wal->image = (char *)malloc(len + 5);
+        if (wal->buf == NULL || wal->spare == NULL || wal->path == NULL || wal->image == NULL) {
+                goto fail;
+        }
+        memcpy(wal->path, path, len + 1);
+        memcpy(wal->image, path, len);
+        memcpy(wal->image + len, ".img", 5);
+
+        if (__wal_image_stamp(wal->image, &base_crc, &base_size) < 0) {
+                goto fail;
+        }
+        wal->list = base_size != 0 ? skiplist_load(wal->image) : skiplist_new();
+        if (wal->list == NULL) {
+                goto fail;
+        }
+
+        fd = open(path, O_RDWR);
+        if (fd < 0) {
+                if (errno != ENOENT || __wal_reset(wal, base_crc, base_size) < 0) {
+                        goto fail;
+                }
+                return wal;
+        }
+        if (fstat(fd, &st) < 0 || read(fd, &hdr, sizeof(hdr)) != sizeof(hdr) ||
+            memcmp(hdr.magic, SKIPLIST_WAL_MAGIC, sizeof(hdr.magic)) != 0 ||
+            hdr.version != SKIPLIST_WAL_VERSION || hdr.order != SKIPLIST_FILE_ORDER ||
+            hdr.key_size != sizeof(sk_key_t) || hdr.value_size != sizeof(sk_value_t) ||
+            lseek(fd, 0, SEEK_SET) < 0) {
+                close(fd);
+                goto fail;
+        }
+        if (hdr.base_crc != base_crc || hdr.base_size != base_size) {
+                /* compaction got as far as the image, which has it all */
+                close(fd);
+                if (__wal_reset(wal, base_crc, base_size) < 0) {
+                        goto fail;
+                }
+                return wal;
+        }
+        wal->fd = fd;
+        if (__wal_replay(wal, fd, st.st_size) < 0) {
+                goto fail;
+        }
+        return wal;
+
+fail:
+        skiplist_wal_close(wal);
+        return NULL;
+}
+
+/* Write and sync everything logged so far, whatever the policy. */
+static int skiplist_wal_sync(struct skiplist_wal *wal)
+{
+        int ret;
+        pthread_mutex_lock(&wal->lock);
+        ret = __wal_flush(wal, 1);
+        pthread_mutex_unlock(&wal->lock);
+        return ret;
+}
+
+/* Sync the log and free everything, the list included. */
+static void skiplist_wal_close(struct skiplist_wal *wal)
+{
+        if (wal->fd >= 0) {
+                skiplist_wal_sync(wal);
+                close(wal->fd);
+        }
+        if (wal->list != NULL) {
+                skiplist_delete(wal->list);
+        }
+        pthread_cond_destroy(&wal->synced);
+        pthread_mutex_destroy(&wal->lock);
+        free(wal->buf);
+        free(wal->spare);
+        free(wal->path);
+        free(wal->image);
+        free(wal);
+}
+
+/* The mutations log their record first and then apply it. They return 0
+ * once the change is applied and logged as the sync policy asks, or -1. An
+ * insert the list has no room for is taken back out of the log. A record
+ * that can not be written leaves the list ahead of the log, and the wal
+ * should then be closed. */
+static int skiplist_wal_insert(struct skiplist_wal *wal, sk_key_t key, sk_value_t value)
+{
+        int ret;
+        size_t len;
+        pthread_mutex_lock(&wal->lock);
+        len = wal->len;
+        ret = __wal_append(wal, WAL_INSERT, 0, &key, sizeof(key), &value, sizeof(value));
+        if (ret == 0) {
+                if (skiplist_insert(wal->list, key, value) != NULL) {
+                        ret = __wal_commit(wal);
+                } else {
+                        /* still in the buffer, nothing flushed it meanwhile */
+                        wal->len = len;
+                        wal->lsn--;
+                        ret = -1;
+                }
+        }
+        pthread_mutex_unlock(&wal->lock);
+        return ret;
+}
+
+static int skiplist_wal_remove(struct skiplist_wal *wal, sk_key_t key)
+{
+        int ret;
+        pthread_mutex_lock(&wal->lock);
+        ret = __wal_append(wal, WAL_REMOVE, 0, &key, sizeof(key), NULL, 0);
+        if (ret == 0) {
+                skiplist_remove(wal->list, key);
+                ret = __wal_commit(wal);
+        }
+        pthread_mutex_unlock(&wal->lock);
+        return ret;
+}
+
+#ifdef SKIPLIST_WITH_RANK
+/* Returns the number of nodes removed, or -1 as above. */
+static sk_rank_t skiplist_wal_remove_in_range(struct skiplist_wal *wal, struct range_spec *range)
+{
+        sk_rank_t ret;
+        int flags = (range->minex ? WAL_MINEX : 0) | (range->maxex ? WAL_MAXEX : 0);
+        pthread_mutex_lock(&wal->lock);
+        ret = __wal_append(wal, WAL_REMOVE_RANGE, flags, &range->min, sizeof(range->min),
+                           &range->max, sizeof(range->max));
+        if (ret == 0) {
+                ret = remove_in_range(wal->list, range);
+                if (__wal_commit(wal) < 0) {
+                        ret = -1;
+                }
+        }
+        pthread_mutex_unlock(&wal->lock);
+        return ret;
+}
+#endif
+
+/* Fold the log into a fresh image of the list and start an empty log. The
+ * flush drops the lock for its I/O, so records may be logged and applied
+ * meanwhile; the image takes them in along with the rest, and they are
+ * dropped from the buffer rather than written to the new log, where they
+ * would be replayed a second time. */
+static int skiplist_wal_compact(struct skiplist_wal *wal)
+{
+        int ret;
+        unsigned int base_crc;
+        unsigned long long base_size;
+
+        pthread_mutex_lock(&wal->lock);
+        ret = __wal_flush(wal, 1);
+        if (ret == 0) {
+                ret = skiplist_save(wal->list, wal->image, SKIPLIST_FILE_TOWERS);
+        }
+        if (ret == 0) {
+                ret = __wal_image_stamp(wal->image, &base_crc, &base_size);
+        }
+        if (ret == 0 && __wal_reset(wal, base_crc, base_size) < 0) {
+                /* the old log no longer matches the image, so records
+                 * appended to it would be dropped at the next open */
+                wal->error = 1;
+                ret = -1;
+        }
+        if (ret == 0) {
+                wal->len = 0;
+                wal->synced_lsn = wal->lsn;
+                pthread_cond_broadcast(&wal->synced);
+        }
+        pthread_mutex_unlock(&wal->lock);
+        return ret;
+}
+
+#endif  /* _SKIPLIST_WAL_H */
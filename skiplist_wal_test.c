@@ -0,0 +1,217 @@
+/*
+* Copyright (C) 2015, Leo Ma <begeekmyfriend@gmail.com>
+*/
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "skiplist_with_rank.h"
+#include "skiplist_wal.h"
+
+#define N 1024 * 1024
+#define SYNC_OPS 16 * 1024  /* fdatasync bound runs are kept short */
+#define THREADS 8
+#define INTERVAL_MS 10
+#define COMPACTIONS 30
+#define LOG "skiplist_test.wal"
+
+struct worker {
+    pthread_t tid;
+    int *key;
+    int ops;
+    struct skiplist_wal *wal;
+};
+
+static long elapsed_ms(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) * 1000 + (end->tv_nsec - start->tv_nsec) / 1000000;
+}
+
+static void remove_files(void)
+{
+    unlink(LOG);
+    unlink(LOG ".img");
+}
+
+static void *insert_keys(void *arg)
+{
+    int i;
+    struct worker *w = arg;
+    for (i = 0; i < w->ops; i++) {
+        if (skiplist_wal_insert(w->wal, w->key[i], ~w->key[i]) < 0) {
+            printf("Log write failed\n");
+            break;
+        }
+    }
+    return NULL;
+}
+
+/* Insert ops keys from nthreads threads under the policy, starting from an
+ * empty log. The log is left behind for the checks that follow. */
+static void bench(const char *name, int policy, const int *key, int ops, int nthreads)
+{
+    int i;
+    struct timespec start, end;
+    struct worker w[THREADS];
+    long ms;
+
+    remove_files();
+    struct skiplist_wal *wal = skiplist_wal_open(LOG, policy, INTERVAL_MS);
+    if (wal == NULL) {
+        printf("Open failed\n");
+        exit(-1);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < nthreads; i++) {
+        w[i].key = (int *)key + i * (ops / nthreads);
+        w[i].ops = ops / nthreads;
+        w[i].wal = wal;
+        pthread_create(&w[i].tid, NULL, insert_keys, &w[i]);
+    }
+    for (i = 0; i < nthreads; i++) {
+        pthread_join(w[i].tid, NULL);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    ms = elapsed_ms(&start, &end);
+    printf("%-9s %d threads: %d ops in %ldms, %.0f ops/s, %llu syncs\n", name, nthreads,
+           ops, ms, ops * 1000.0 / (ms > 0 ? ms : 1), wal->syncs);
+    skiplist_wal_close(wal);
+}
+
+static struct skiplist_wal *reopen(sk_rank_t count)
+{
+    struct skiplist_wal *wal = skiplist_wal_open(LOG, SKIPLIST_SYNC_NEVER, 0);
+    if (wal == NULL || wal->list->count != count) {
+        printf("Replay gave " SKIPLIST_RANK_FMT " nodes, " SKIPLIST_RANK_FMT " expected\n",
+               wal != NULL ? wal->list->count : -1, count);
+        exit(-1);
+    }
+    return wal;
+}
+
+int
+main(void)
+{
+    int i, j, tmp;
+    sk_rank_t count, removed;
+    FILE *fp;
+    struct timespec start, end;
+    struct range_spec range;
+    struct skiplist_wal *wal;
+    struct worker w[THREADS];
+
+    int *key = malloc(N * sizeof(int));
+    if (key == NULL) {
+        exit(-1);
+    }
+
+    /* distinct keys in random order */
+    srandom(time(NULL));
+    for (i = 0; i < N; i++) {
+        key[i] = i;
+    }
+    for (i = N - 1; i > 0; i--) {
+        j = random() % (i + 1);
+        tmp = key[i];
+        key[i] = key[j];
+        key[j] = tmp;
+    }
+
+    printf("Test start!\n");
+    bench("always", SKIPLIST_SYNC_ALWAYS, key, SYNC_OPS, 1);
+    bench("always", SKIPLIST_SYNC_ALWAYS, key, SYNC_OPS, THREADS);
+    bench("interval", SKIPLIST_SYNC_INTERVAL, key, N, 1);
+    bench("never", SKIPLIST_SYNC_NEVER, key, N, 1);
+
+    printf("Now replay the log...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    wal = reopen(N);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", elapsed_ms(&start, &end));
+    for (i = 0; i < N; i++) {
+        struct skipnode *node = skiplist_search_by_key(wal->list, key[i]);
+        if (node == NULL || node->value != ~key[i]) {
+            printf("Not replayed:0x%08x\n", key[i]);
+            break;
+        }
+    }
+
+    /* every other key, then the lower quarter of the keys by range */
+    for (i = 0; i < N; i += 2) {
+        skiplist_wal_remove(wal, key[i]);
+    }
+    range.min = 0;
+    range.max = N / 4;
+    range.minex = 0;
+    range.maxex = 1;
+    removed = skiplist_wal_remove_in_range(wal, &range);
+    count = wal->list->count;
+    if (count != N / 2 - removed) {
+        printf("Removed " SKIPLIST_RANK_FMT " in range, " SKIPLIST_RANK_FMT " left\n", removed, count);
+    }
+    skiplist_wal_close(wal);
+    wal = reopen(count);
+
+    printf("Now compact the log...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    if (skiplist_wal_compact(wal) < 0) {
+        printf("Compaction failed\n");
+        exit(-1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", elapsed_ms(&start, &end));
+    skiplist_wal_insert(wal, -1, 0);
+    skiplist_wal_close(wal);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    wal = reopen(count + 1);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("restart from image and log: %ldms\n", elapsed_ms(&start, &end));
+    skiplist_wal_close(wal);
+
+    /* A torn record at the end is dropped */
+    fp = fopen(LOG, "ab");
+    if (fp == NULL || fwrite(key, 1, 11, fp) != 11 || fclose(fp) != 0) {
+        exit(-1);
+    }
+    wal = reopen(count + 1);
+    skiplist_wal_insert(wal, -2, 0);
+    skiplist_wal_close(wal);
+    wal = reopen(count + 2);
+    skiplist_wal_close(wal);
+
+    /* Compactions racing with inserts must neither lose nor replay any */
+    printf("Now compact %d times while %d threads insert...\n", COMPACTIONS, THREADS);
+    remove_files();
+    wal = skiplist_wal_open(LOG, SKIPLIST_SYNC_ALWAYS, 0);
+    if (wal == NULL) {
+        printf("Open failed\n");
+        exit(-1);
+    }
+    for (i = 0; i < THREADS; i++) {
+        w[i].key = key + i * (SYNC_OPS / THREADS);
+        w[i].ops = SYNC_OPS / THREADS;
+        w[i].wal = wal;
+        pthread_create(&w[i].tid, NULL, insert_keys, &w[i]);
+    }
+    for (i = 0; i < COMPACTIONS; i++) {
+        if (skiplist_wal_compact(wal) < 0) {
+            printf("Compaction failed\n");
+            break;
+        }
+    }
+    for (i = 0; i < THREADS; i++) {
+        pthread_join(w[i].tid, NULL);
+    }
+    skiplist_wal_close(wal);
+    wal = reopen(SYNC_OPS);
+    skiplist_wal_close(wal);
+    remove_files();
+
+    printf("End of Test.\n");
+
+    free(key);
+
+    return 0;
+}
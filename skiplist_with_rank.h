@@ -4,42 +4,96 @@
 
 #ifndef _SKIPLIST_H
 #define _SKIPLIST_H
-
+#define SKIPLIST_WITH_RANK  /* tells companion headers which skiplist.h this is */
+
+/* Ranks, spans and the node count are int by default, which keeps the links
+ * compact but caps the list at 2^31 - 1 nodes. Define SKIPLIST_RANK64 before
+ * including this header to make them 64-bit. */
+#ifdef SKIPLIST_RANK64
+typedef long long sk_rank_t;
+#define SKIPLIST_RANK_FMT "%lld"
+#else
+typedef int sk_rank_t;
+#define SKIPLIST_RANK_FMT "%d"
+#endif
+
+/* With SKIPLIST_SUM defined every link also carries the sum of the values it
+ * spans, like span counts them, so prefix and range sums take O(log n). */
+#ifndef SKIPLIST_SUM_TYPE
+#define SKIPLIST_SUM_TYPE long long
+#endif
+
+typedef SKIPLIST_SUM_TYPE sk_sum_t;
+
+/* With SKIPLIST_FORWARD defined only level 0 is linked both ways. The levels
+ * above are walked forward only and keep no prev, and on level 0, where every
+ * span is 1, prev takes the place of span, so a link is a pointer smaller.
+ * Reverse range walks still work on level 0. link_span() and the setters
+ * below read and write the span of a level i link knowing this, and
+ * link_has_prev(i) tells whether the links of level i keep prev. */
 struct sk_link {
-        struct sk_link *next, *prev;
-        int span;
+        struct sk_link *next;
+#ifdef SKIPLIST_FORWARD
+        union {
+                struct sk_link *prev;   /* level 0 */
+                sk_rank_t span;         /* the levels above */
+        };
+#else
+        struct sk_link *prev;
+        sk_rank_t span;
+#endif
+#ifdef SKIPLIST_SUM
+        sk_sum_t sum;
+#endif
 };
 
+#ifdef SKIPLIST_FORWARD
+#define link_has_prev(i) ((i) == 0)
+#define link_span(link, i) ((i) > 0 ? (link)->span : 1)
+#define link_span_set(link, i, n) do { \
+                if ((i) > 0) { \
+                        (link)->span = (n); \
+                } \
+        } while (0)
+#define link_span_add(link, i, n) do { \
+                if ((i) > 0) { \
+                        (link)->span += (n); \
+                } \
+        } while (0)
+#else
+#define link_has_prev(i) ((void)(i), 1)  /* i is only needed by SKIPLIST_FORWARD */
+#define link_span(link, i) ((link)->span)
+#define link_span_set(link, i, n) ((link)->span = (n))
+#define link_span_add(link, i, n) ((link)->span += (n))
+#endif
+
 static inline void list_init(struct sk_link *link)
 {
         link->prev = link;
         link->next = link;
 }
 
+/* Link in after prev on level i. The new link is filled in before it is
+ * published, so that a reader racing with the insertion, as
+ * skiplist_seqlock.h allows, never follows it early. */
 static inline void
-__list_add(struct sk_link *link, struct sk_link *prev, struct sk_link *next)
+__list_add(struct sk_link *link, struct sk_link *prev, struct sk_link *next, int i)
 {
         link->next = next;
-        link->prev = prev;
-        next->prev = link;
-        prev->next = link;
+        if (link_has_prev(i)) {
+                link->prev = prev;
+                next->prev = link;
+        }
+        __atomic_store_n(&prev->next, link, __ATOMIC_RELEASE);
 }
 
-static inline void __list_del(struct sk_link *prev, struct sk_link *next)
+/* Unlink what lies between prev and next on level i. */
+static inline void __list_del(struct sk_link *prev, struct sk_link *next, int i)
 {
         prev->next = next;
-        next->prev = prev;
-}
-
-static inline void list_add(struct sk_link *link, struct sk_link *next)
-{
-        __list_add(link, next->prev, next);
-}
-
-static inline void list_del(struct sk_link *link)
-{
-        __list_del(link->prev, link->next);
-        list_init(link);
+        if (link_has_prev(i)) {
+                next->prev = prev;
+        }
 }
 
 static inline int list_empty(struct sk_link *link)
@@ -62,120 +116,434 @@ static inline int list_empty(struct sk_link *link)
 #define skiplist_foreach_backward_safe(pos, n, end) \
         for (n = (pos)->prev; pos != end; pos = n, n = (pos)->prev)
 
+/* With SKIPLIST_PREFETCH defined, the lookups prefetch the next node on the
+ * current level and the first node on the level below while comparing the
+ * current key. */
+#ifdef SKIPLIST_PREFETCH
+#define skiplist_prefetch(ptr, i) do { \
+                __builtin_prefetch(ptr); \
+                __builtin_prefetch(list_entry(ptr, struct skipnode, link[i])); \
+        } while (0)
+#define skiplist_prefetch_hop(pos, i) do { \
+                skiplist_prefetch((pos)->next, i); \
+                if ((i) > 0) { \
+                        skiplist_prefetch(((pos) - 1)->next, (i) - 1); \
+                } \
+        } while (0)
+#else
+#define skiplist_prefetch_hop(pos, i) do { } while (0)
+#endif
+
+#ifndef SKIPLIST_GROUP
+#define SKIPLIST_GROUP 16  /* descents interleaved by skiplist_search_many() */
+#endif
+
+#ifndef MAX_LEVEL
 #define MAX_LEVEL 32  /* Should be enough for 2^32 elements */
+#endif
+
+/* Default int keys, which skiplist_sharded.h hashes when no
+ * SKIPLIST_KEY_HASH is given */
+#if !defined(SKIPLIST_KEY_TYPE) && !defined(SKIPLIST_KEY_CMP)
+#define SKIPLIST_KEY_INT
+#endif
+
+/* The key and value types can be chosen by defining these macros before
+ * including this header. SKIPLIST_KEY_CMP(a, b) returns a negative, zero or
+ * positive value like memcmp(), and is expanded in place so the compare is
+ * inlined into every descent. SKIPLIST_KEY_FMT/SKIPLIST_KEY_ARG (and the
+ * value counterparts) are only used by skiplist_dump(), which is left out
+ * when a custom type comes without a format. */
+#ifndef SKIPLIST_KEY_TYPE
+#define SKIPLIST_KEY_TYPE int
+#define SKIPLIST_KEY_FMT "0x%08x"
+#endif
+
+#ifndef SKIPLIST_VALUE_TYPE
+#define SKIPLIST_VALUE_TYPE int
+#define SKIPLIST_VALUE_FMT "0x%08x"
+#endif
+
+#ifndef SKIPLIST_KEY_CMP
+#define SKIPLIST_KEY_CMP(a, b) (((a) > (b)) - ((a) < (b)))
+#endif
+
+#ifndef SKIPLIST_KEY_ARG
+#define SKIPLIST_KEY_ARG(key) (key)
+#endif
+
+#ifndef SKIPLIST_VALUE_ARG
+#define SKIPLIST_VALUE_ARG(value) (value)
+#endif
+
+typedef SKIPLIST_KEY_TYPE sk_key_t;
+typedef SKIPLIST_VALUE_TYPE sk_value_t;
+
+#ifndef SKIPLIST_P_SHIFT
+#define SKIPLIST_P_SHIFT 2  /* promotion probability p = 1/2^SKIPLIST_P_SHIFT: 1, 2 or 3 */
+#endif
+
+/* Nodes are carved out of slabs of SKIPLIST_SLAB_SIZE bytes, one size class
+ * per level. Slabs are aligned to their size so that the level of a node can
+ * be found from its address, and so that the whole list can be released slab
+ * by slab. SKIPLIST_SLAB_SIZE must be a power of two large enough to hold a
+ * node of MAX_LEVEL. */
+#ifndef SKIPLIST_SLAB_SIZE
+#define SKIPLIST_SLAB_SIZE 4096
+#endif
+
+#ifndef SKIPLIST_SLAB_ALLOC
+#define SKIPLIST_SLAB_ALLOC(size) slab_alloc(size)
+#define SKIPLIST_SLAB_FREE(ptr) free(ptr)
+
+static inline void *slab_alloc(size_t size)
+{
+        void *ptr;
+        return posix_memalign(&ptr, size, size) ? NULL : ptr;
+}
+#endif
+
+/* With SKIPLIST_STATS defined the list counts, for each of search, insert and
+ * remove, the calls, the key compares and the nodes visited on every level,
+ * and keeps a histogram of the tower heights. skiplist_stats() takes a
+ * snapshot in O(levels). The counters are plain increments, so lists read by
+ * several threads at once must be built without them. Left undefined, the
+ * counting compiles to nothing. */
+#ifdef SKIPLIST_STATS
+enum { SK_STAT_SEARCH, SK_STAT_INSERT, SK_STAT_REMOVE, SK_STAT_OPS };
+
+struct sk_op_stats {
+        unsigned long long calls;
+        unsigned long long compares;
+        unsigned long long hops[MAX_LEVEL];     /* nodes visited on level i + 1 */
+};
+
+#define skiplist_stat_call(list, op) ((list)->stats[op].calls++)
+#define skiplist_stat_hop(list, op, i) do { \
+                (list)->stats[op].hops[i]++; \
+                (list)->stats[op].compares++; \
+        } while (0)
+#define skiplist_stat_cmp(list, op) ((list)->stats[op].compares++)
+#define skiplist_stat_height(list, level, n) ((list)->height[(level) - 1] += (n))
+#else
+#define skiplist_stat_call(list, op) do { } while (0)
+#define skiplist_stat_hop(list, op, i) do { } while (0)
+#define skiplist_stat_cmp(list, op) do { } while (0)
+#define skiplist_stat_height(list, level, n) do { } while (0)
+#endif
+
+struct sk_slab {
+        struct sk_slab *next;
+        int level;
+};
+
+#define slab_of(node) \
+        ((struct sk_slab *)((size_t)(node) & ~((size_t)SKIPLIST_SLAB_SIZE - 1)))
 
 struct range_spec {
-        int min, max;
+        sk_key_t min, max;
         int minex, maxex;
 };
 
 struct skiplist {
         int level;
-        int count;
+        sk_rank_t count;
+        unsigned long long rand;              /* level generator state */
         struct sk_link head[MAX_LEVEL];
+        struct sk_link *free_list[MAX_LEVEL];  /* free nodes chained by link[0] */
+        struct sk_slab *slabs;
+#ifdef SKIPLIST_STATS
+        struct sk_op_stats stats[SK_STAT_OPS];
+        sk_rank_t height[MAX_LEVEL];            /* nodes whose tower is i + 1 high */
+#endif
 };
 
 struct skipnode {
-        int key;
-        int value;
+        sk_key_t key;
+        sk_value_t value;
         struct sk_link link[0];
 };
 
-static struct skipnode *skipnode_new(int level, int key, int value)
+struct sk_pair {
+        sk_key_t key;
+        sk_value_t value;
+};
+
+static inline size_t skipnode_size(int level)
+{
+        return sizeof(struct skipnode) + level * sizeof(struct sk_link);
+}
+
+/* Carve a new slab into nodes of the given level and put them on the free
+ * list of that level. */
+static int slab_grow(struct skiplist *list, int level)
+{
+        char *pos, *end;
+        size_t size = skipnode_size(level);
+        struct sk_slab *slab = (struct sk_slab *)SKIPLIST_SLAB_ALLOC(SKIPLIST_SLAB_SIZE);
+        if (slab == NULL) {
+                return -1;
+        }
+
+        slab->level = level;
+        slab->next = list->slabs;
+        list->slabs = slab;
+
+        pos = (char *)slab + ((sizeof(*slab) + sizeof(void *) - 1) & ~(sizeof(void *) - 1));
+        end = (char *)slab + SKIPLIST_SLAB_SIZE;
+        for (; pos + size <= end; pos += size) {
+                struct skipnode *node = (struct skipnode *)pos;
+                node->link[0].next = list->free_list[level - 1];
+                list->free_list[level - 1] = &node->link[0];
+        }
+        return 0;
+}
+
+static struct skipnode *
+skipnode_new(struct skiplist *list, int level, sk_key_t key, sk_value_t value)
 {
         struct skipnode *node;
-        node = malloc(sizeof(*node) + level * sizeof(struct sk_link));
-        if (node != NULL) {
-                node->key = key;
-                node->value = value;
+        struct sk_link *link = list->free_list[level - 1];
+        if (link == NULL) {
+                if (slab_grow(list, level) < 0) {
+                        return NULL;
+                }
+                link = list->free_list[level - 1];
         }
+
+        list->free_list[level - 1] = link->next;
+        skiplist_stat_height(list, level, 1);
+        node = list_entry(link, struct skipnode, link[0]);
+        node->key = key;
+        node->value = value;
         return node;
 }
 
-static void skipnode_delete(struct skipnode *node)
+static void skipnode_free(struct skiplist *list, struct skipnode *node)
+{
+        int level = slab_of(node)->level;
+        node->link[0].next = list->free_list[level - 1];
+        list->free_list[level - 1] = &node->link[0];
+}
+
+/* Nodes unlinked from the list end up here. With SKIPLIST_RETIRE(list, node)
+ * defined they are handed to it instead of being reused at once, and it must
+ * call skipnode_free() once no reader can still be walking them. Unlinked
+ * nodes keep their links, which lead back into the list. */
+static void skipnode_delete(struct skiplist *list, struct skipnode *node)
 {
-        free(node);
+        skiplist_stat_height(list, slab_of(node)->level, -1);
+#ifdef SKIPLIST_RETIRE
+        SKIPLIST_RETIRE(list, node);
+#else
+        skipnode_free(list, node);
+#endif
+}
+
+#ifdef SKIPLIST_STATS
+struct skiplist_stats {
+        int level;                              /* levels in use */
+        sk_rank_t count;
+        sk_rank_t height[MAX_LEVEL];                /* nodes whose tower is i + 1 high */
+        struct sk_op_stats op[SK_STAT_OPS];
+};
+
+/* Zero the operation counters, the height histogram follows the nodes. */
+static void skiplist_stats_reset(struct skiplist *list)
+{
+        int i, j;
+        for (i = 0; i < SK_STAT_OPS; i++) {
+                list->stats[i].calls = 0;
+                list->stats[i].compares = 0;
+                for (j = 0; j < MAX_LEVEL; j++) {
+                        list->stats[i].hops[j] = 0;
+                }
+        }
+}
+
+/* Snapshot of the counters and the tower heights, O(levels) whatever the
+ * size of the list. */
+static void skiplist_stats(struct skiplist *list, struct skiplist_stats *stats)
+{
+        int i;
+        stats->level = list->level;
+        stats->count = list->count;
+        for (i = 0; i < MAX_LEVEL; i++) {
+                stats->height[i] = list->height[i];
+        }
+        for (i = 0; i < SK_STAT_OPS; i++) {
+                stats->op[i] = list->stats[i];
+        }
+}
+#else
+#define skiplist_stats_reset(list) do { } while (0)
+#endif
+
+#ifdef SKIPLIST_SUM
+/* Sum of the links after from up to and including to on one level. */
+static inline sk_sum_t __sum_between(struct sk_link *from, struct sk_link *to)
+{
+        sk_sum_t sum = 0;
+        while (from != to) {
+                from = from->next;
+                sum += from->sum;
+        }
+        return sum;
+}
+
+/* Set the sum of link i of a node about to go after pred[i], or add its
+ * value to the link after pred[i] when the node is not that tall. Levels must
+ * be linked bottom up: link i sums link i - 1 and the links below from its
+ * predecessor on. */
+static inline void
+sum_add(struct skipnode *node, struct sk_link **pred, int i, int level)
+{
+        sk_sum_t sum = node->value;
+        struct sk_link *next = pred[i]->next;
+        if (i >= level) {
+                next->sum += sum;
+                return;
+        }
+        if (i > 0) {
+                sum = node->link[i - 1].sum + __sum_between(pred[i] - 1, pred[i - 1]);
+        }
+        node->link[i].sum = sum;
+        next->sum -= sum - node->value;
+}
+
+/* Give the sum of link i of a node being removed back to next. */
+static inline void
+sum_del(struct skipnode *node, struct sk_link *next, int i, int level)
+{
+        if (i < level) {
+                next->sum += node->link[i].sum - node->value;
+        } else {
+                next->sum -= node->value;
+        }
+}
+
+/* The link after last takes over what pred to last covered, minus the sum
+ * of the nodes cut out. */
+static inline void sum_cut(struct sk_link *pred, struct sk_link *last, sk_sum_t removed)
+{
+        last->next->sum += __sum_between(pred, last) - removed;
+}
+#else
+#define __sum_between(from, to) ((sk_sum_t)0)
+#define sum_add(node, pred, i, level) do { } while (0)
+#define sum_del(node, next, i, level) do { } while (0)
+#define sum_cut(pred, last, removed) do { (void)(removed); } while (0)
+#endif
+
+/* Seed the level generator of the list, the same seed and the same
+ * operations build the same towers. */
+static void skiplist_seed(struct skiplist *list, unsigned long long seed)
+{
+        /* splitmix64 spreads small seeds over the whole state */
+        seed += 0x9e3779b97f4a7c15ULL;
+        seed = (seed ^ (seed >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        seed = (seed ^ (seed >> 27)) * 0x94d049bb133111ebULL;
+        seed ^= seed >> 31;
+        list->rand = seed != 0 ? seed : 1;
 }
 
 static struct skiplist *skiplist_new(void)
 {
         int i;
-        struct skiplist *list = malloc(sizeof(*list));
+        struct skiplist *list = (struct skiplist *)malloc(sizeof(*list));
         if (list != NULL) {
                 list->level = 1;
                 list->count = 0;
-                for (i = 0; i < sizeof(list->head) / sizeof(list->head[0]); i++) {
+                skiplist_seed(list, 0);
+                list->slabs = NULL;
+                skiplist_stats_reset(list);
+                for (i = 0; i < MAX_LEVEL; i++) {
                         list_init(&list->head[i]);
-                        list->head[i].span = 0;
+                        link_span_set(&list->head[i], i, 0);
+                        list->free_list[i] = NULL;
+#ifdef SKIPLIST_STATS
+                        list->height[i] = 0;
+#endif
                 }
         }
         return list;
 }
 
+/* All nodes live in slabs owned by the list, so there is no need to walk them. */
 static void skiplist_delete(struct skiplist *list)
 {
-        struct sk_link *n;
-        struct skipnode *node;
-        struct sk_link *pos = list->head[0].next;
-        skiplist_foreach_forward_safe(pos, n, &list->head[0]) {
-                node = list_entry(pos, struct skipnode, link[0]);
-                skipnode_delete(node);
+        struct sk_slab *slab, *n;
+        for (slab = list->slabs; slab != NULL; slab = n) {
+                n = slab->next;
+                SKIPLIST_SLAB_FREE(slab);
         }
         free(list);
 }
 
-static int random_level(void)
+/* One xorshift64 draw per node; each SKIPLIST_P_SHIFT trailing zero bits
+ * add a level, up to log_1/p(count) + 1. */
+static int random_level(struct skiplist *list)
 {
-        int level = 1;
-        const double p = 0.25;
-        while ((random() & 0xffff) < 0xffff * p) {
-                level++;
+        int level, cap;
+        unsigned long long x = list->rand;
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        list->rand = x;
+
+        level = __builtin_ctzll(x) / SKIPLIST_P_SHIFT + 1;
+        cap = (64 - __builtin_clzll((unsigned long long)list->count + 1)) / SKIPLIST_P_SHIFT + 1;
+        if (cap > MAX_LEVEL) {
+                cap = MAX_LEVEL;
         }
-        return level > MAX_LEVEL ? MAX_LEVEL : level;
+        return level < cap ? level : cap;
 }
 
 static struct skipnode *
-skiplist_insert(struct skiplist *list, int key, int value)
+skiplist_insert(struct skiplist *list, sk_key_t key, sk_value_t value)
 {
         struct skipnode *nd;
-        int rank[MAX_LEVEL];
-        struct sk_link *update[MAX_LEVEL];
-        int level = random_level();
+        sk_rank_t span, rank[MAX_LEVEL];
+        struct sk_link *next, *update[MAX_LEVEL];
+        int level = random_level(list);
         if (level > list->level) {
                 list->level = level;
         }
 
-        struct skipnode *node = skipnode_new(level, key, value);
+        struct skipnode *node = skipnode_new(list, level, key, value);
         if (node != NULL) {
                 int i = list->level - 1;
                 struct sk_link *pos = &list->head[i];
                 struct sk_link *end = &list->head[i];
 
+                skiplist_stat_call(list, SK_STAT_INSERT);
                 for (; i >= 0; i--) {
                         rank[i] = i == list->level - 1 ? 0 : rank[i + 1];
-                        pos = pos->next;
-                        skiplist_foreach_forward(pos, end) {
-                                nd = list_entry(pos, struct skipnode, link[i]);
-                                if (nd->key >= key) {
-                                        end = &nd->link[i];
+                        for (; pos->next != end; pos = pos->next) {
+                                skiplist_stat_hop(list, SK_STAT_INSERT, i);
+                                nd = list_entry(pos->next, struct skipnode, link[i]);
+                                if (SKIPLIST_KEY_CMP(nd->key, key) >= 0) {
+                                        end = pos->next;
                                         break;
                                 }
-                                rank[i] += nd->link[i].span;
+                                rank[i] += link_span(&nd->link[i], i);
                         }
 
-                        update[i] = end;
-                        pos = end->prev;
+                        update[i] = pos;
                         pos--;
                         end--;
                 }
 
                 for (i = 0; i < list->level; i++) {
+                        next = update[i]->next;
+                        sum_add(node, update, i, level);
                         if (i < level) {
-                                list_add(&node->link[i], update[i]);
-                                node->link[i].span = rank[0] - rank[i] + 1;
-                                update[i]->span -= node->link[i].span - 1;
+                                span = rank[0] - rank[i] + 1;
+                                __list_add(&node->link[i], update[i], next, i);
+                                link_span_set(&node->link[i], i, span);
+                                link_span_add(next, i, 1 - span);
                         } else {
-                                update[i]->span++;
+                                link_span_add(next, i, 1);
                         }
                 }
 
@@ -185,74 +553,221 @@ skiplist_insert(struct skiplist *list, int key, int value)
         return node;
 }
 
+/* Append pairs already sorted by key behind the tail of the list in one left
+ * to right pass. The last link of every level is found once and kept in
+ * tail[i], its rank in rank[i], so the span of each new link is known without
+ * a search.
+ * Returns the number of nodes added, or -1 if the pairs are not sorted or do
+ * not go after the current tail. */
+static int
+skiplist_bulk_load(struct skiplist *list, const struct sk_pair *pairs, int n)
+{
+        int i, j, level;
+        sk_rank_t traversed = 0, rank[MAX_LEVEL];
+        struct skipnode *node;
+        struct sk_link *pos = &list->head[list->level - 1], *tail[MAX_LEVEL];
+
+        if (n > 0 && !list_empty(&list->head[0])) {
+                node = list_entry(list->head[0].prev, struct skipnode, link[0]);
+                if (SKIPLIST_KEY_CMP(node->key, pairs[0].key) > 0) {
+                        return -1;
+                }
+        }
+        for (i = 1; i < n; i++) {
+                if (SKIPLIST_KEY_CMP(pairs[i - 1].key, pairs[i].key) > 0) {
+                        return -1;
+                }
+        }
+
+        for (i = MAX_LEVEL - 1; i >= list->level; i--) {
+                tail[i] = &list->head[i];
+                rank[i] = 0;
+        }
+        for (; i >= 0; i--) {
+                for (; pos->next != &list->head[i]; pos = pos->next) {
+                        traversed += link_span(pos->next, i);
+                }
+                tail[i] = pos;
+                rank[i] = traversed;
+                pos--;
+        }
+
+        for (i = 0; i < n; i++) {
+                level = random_level(list);
+                node = skipnode_new(list, level, pairs[i].key, pairs[i].value);
+                if (node == NULL) {
+                        break;
+                }
+                if (level > list->level) {
+                        list->level = level;
+                }
+                list->count++;
+                for (j = 0; j < level; j++) {
+                        sum_add(node, tail, j, level);
+                        __list_add(&node->link[j], tail[j], &list->head[j], j);
+                        link_span_set(&node->link[j], j, list->count - rank[j]);
+                        rank[j] = list->count;
+                }
+                for (j = 0; j < level; j++) {
+                        tail[j] = &node->link[j];
+                }
+        }
+
+        return i;
+}
+
+static int sk_pair_cmp(const void *a, const void *b)
+{
+        return SKIPLIST_KEY_CMP(((const struct sk_pair *)a)->key,
+                                ((const struct sk_pair *)b)->key);
+}
+
+/* Insert an unsorted batch. The pairs are sorted in place and then merged
+ * into the list: the predecessors found for one key, and their ranks, are
+ * the starting points for the next, so no level is walked twice. Returns the
+ * number of nodes inserted. */
+static int skiplist_insert_batch(struct skiplist *list, struct sk_pair *pairs, int n)
+{
+        int i, j, level;
+        sk_rank_t span, traversed, rank[MAX_LEVEL];
+        struct skipnode *node, *nd;
+        struct sk_link *pos, *down, *pred[MAX_LEVEL];
+
+        qsort(pairs, n, sizeof(*pairs), sk_pair_cmp);
+        for (i = 0; i < MAX_LEVEL; i++) {
+                pred[i] = &list->head[i];
+                rank[i] = 0;
+        }
+
+        for (j = 0; j < n; j++) {
+                level = random_level(list);
+                node = skipnode_new(list, level, pairs[j].key, pairs[j].value);
+                if (node == NULL) {
+                        break;
+                }
+                if (level > list->level) {
+                        list->level = level;
+                }
+
+                for (i = list->level - 1; i >= 0; i--) {
+                        /* resume from whichever of the last predecessor on
+                         * this level and the one just found above is further */
+                        pos = pred[i];
+                        traversed = rank[i];
+                        if (i < list->level - 1 && pred[i + 1] != &list->head[i + 1]) {
+                                down = pred[i + 1] - 1;
+                                if (pos == &list->head[i] ||
+                                    SKIPLIST_KEY_CMP(list_entry(down, struct skipnode, link[i])->key,
+                                                     list_entry(pos, struct skipnode, link[i])->key) > 0) {
+                                        pos = down;
+                                        traversed = rank[i + 1];
+                                }
+                        }
+                        for (; pos->next != &list->head[i]; pos = pos->next) {
+                                nd = list_entry(pos->next, struct skipnode, link[i]);
+                                if (SKIPLIST_KEY_CMP(nd->key, pairs[j].key) >= 0) {
+                                        break;
+                                }
+                                traversed += link_span(&nd->link[i], i);
+                        }
+                        pred[i] = pos;
+                        rank[i] = traversed;
+                }
+
+                for (i = 0; i < list->level; i++) {
+                        pos = pred[i]->next;
+                        sum_add(node, pred, i, level);
+                        if (i < level) {
+                                span = rank[0] - rank[i] + 1;
+                                __list_add(&node->link[i], pred[i], pos, i);
+                                link_span_set(&node->link[i], i, span);
+                                link_span_add(pos, i, 1 - span);
+                        } else {
+                                link_span_add(pos, i, 1);
+                        }
+                }
+                list->count++;
+        }
+
+        return j;
+}
+
+/* Unlink a node of the given level, pred[i] being the link before it on
+ * every level, or before where it would be above its tower. */
 static void
-__remove(struct skiplist *list, struct skipnode *node, int level, struct sk_link **update)
+__remove(struct skiplist *list, struct skipnode *node, int level, struct sk_link **pred)
 {
         int i;
-        int remain_level = list->level;
+        struct sk_link *next;
         for (i = 0; i < list->level; i++) {
                 if (i < level) {
-                        list_del(&node->link[i]);
-                        update[i] = node->link[i].next;
-                        update[i]->span += node->link[i].span - 1;
+                        next = node->link[i].next;
+                        link_span_add(next, i, link_span(&node->link[i], i) - 1);
+                        __list_del(pred[i], next, i);
                 } else {
-                        update[i]->span--;
-                }
-
-                if (list_empty(&list->head[i])) {
-                        if (remain_level == list->level) {
-                                remain_level = i + 1;
-                        }
+                        next = pred[i]->next;
+                        link_span_add(next, i, -1);
                 }
+                sum_del(node, next, i, level);
         }
 
-        skipnode_delete(node);
+        skipnode_delete(list, node);
         list->count--;
-        list->level = remain_level;
+        while (list->level > 1 && list_empty(&list->head[list->level - 1])) {
+                list->level--;
+        }
 }
 
-static void skiplist_remove(struct skiplist *list, int key)
+/* Remove the first node with the key. The descent goes down to level 0 even
+ * when the key shows up above, to collect the predecessors of every link. */
+static void skiplist_remove(struct skiplist *list, sk_key_t key)
 {
         struct skipnode *node;
         int i = list->level - 1;
         struct sk_link *pos = &list->head[i];
         struct sk_link *end = &list->head[i];
-        struct sk_link *n, *update[MAX_LEVEL];
+        struct sk_link *update[MAX_LEVEL];
 
+        skiplist_stat_call(list, SK_STAT_REMOVE);
         for (; i >= 0; i--) {
-                pos = pos->next;
-                skiplist_foreach_forward_safe(pos, n, end) {
-                        node = list_entry(pos, struct skipnode, link[i]);
-                        if (node->key > key) {
-                                end = &node->link[i];
+                for (; pos->next != end; pos = pos->next) {
+                        skiplist_stat_hop(list, SK_STAT_REMOVE, i);
+                        node = list_entry(pos->next, struct skipnode, link[i]);
+                        if (SKIPLIST_KEY_CMP(node->key, key) >= 0) {
+                                end = pos->next;
                                 break;
-                        } else if (node->key == key) {
-                                __remove(list, node, i + 1, update);
-                                return;
                         }
                 }
-                update[i] = end;
-                pos = end->prev;
+                update[i] = pos;
                 pos--;
                 end--;
         }
+
+        if (update[0]->next != &list->head[0]) {
+                node = list_entry(update[0]->next, struct skipnode, link[0]);
+                if (SKIPLIST_KEY_CMP(node->key, key) == 0) {
+                        __remove(list, node, slab_of(node)->level, update);
+                }
+        }
 }
 
-static int key_gte_min(int key, struct range_spec *range)
+static inline int key_gte_min(sk_key_t key, struct range_spec *range)
 {
-        return range->maxex ? (key > range->max) : (key >= range->max);
+        return range->minex ? (SKIPLIST_KEY_CMP(key, range->min) > 0) :
+                (SKIPLIST_KEY_CMP(key, range->min) >= 0);
 }
 
-static int key_lte_max(int key, struct range_spec *range)
+static inline int key_lte_max(sk_key_t key, struct range_spec *range)
 {
-        return range->minex ? (key < range->min) : (key <= range->min);
+        return range->maxex ? (SKIPLIST_KEY_CMP(key, range->max) < 0) :
+                (SKIPLIST_KEY_CMP(key, range->max) <= 0);
 }
 
 /* Returns if there is node key in range */
 static int key_in_range(struct skiplist *list, struct range_spec *range)
 {
-        if (range->min > range->max ||
-                (range->min == range->max && (range->minex || range->maxex))) {
+        int cmp = SKIPLIST_KEY_CMP(range->min, range->max);
+        if (cmp > 0 || (cmp == 0 && (range->minex || range->maxex))) {
                 return 0;
         }
 
@@ -281,7 +796,7 @@ static int key_in_range(struct skiplist *list, struct range_spec *range)
 static struct skipnode *
 first_in_range(struct skiplist *list, struct range_spec *range)
 {
-        struct skipnode *node;
+        struct skipnode *node = NULL, *nd;
         int i = list->level - 1;
         struct sk_link *pos = &list->head[i];
         struct sk_link *end = &list->head[i];
@@ -291,247 +806,721 @@ first_in_range(struct skiplist *list, struct range_spec *range)
         }
 
         for (; i >= 0; i--) {
-                pos = pos->next;
-                skiplist_foreach_forward(pos, end) {
-                        node = list_entry(pos, struct skipnode, link[i]);
-                        if (key_gte_min(node->key, range)) {
-                                pos = node->link[i].prev;
-                                end = node->link[i].next;
-                                goto CONTINUE;
+                for (; pos->next != end; pos = pos->next) {
+                        nd = list_entry(pos->next, struct skipnode, link[i]);
+                        if (key_gte_min(nd->key, range)) {
+                                node = nd;
+                                end = pos->next;
+                                break;
                         }
                 }
-                pos = end->prev;
-CONTINUE:
                 pos--;
                 end--;
         }
 
-        return node;
+        /* the first node not below min can still be above max */
+        return key_lte_max(node->key, range) ? node : NULL;
 }
 
 /* search the last node key that is contained in the specified range
- * where min and max are inclusive. */
+ * where min and max are inclusive. Found going forward like the first one,
+ * as the last node not above max, so the levels need no prev. */
 static struct skipnode *
 last_in_range(struct skiplist *list, struct range_spec *range)
 {
         int i = list->level - 1;
         struct sk_link *pos = &list->head[i];
         struct sk_link *end = &list->head[i];
-        struct skipnode *node = NULL;
+        struct skipnode *node = NULL, *nd;
 
         if (!key_in_range(list, range)) {
                 return NULL;
         }
 
         for (; i >= 0; i--) {
-                pos = pos->prev;
-                skiplist_foreach_backward(pos, end) {
-                        node = list_entry(pos, struct skipnode, link[i]);
-                        if (key_lte_max(node->key, range)) {
-                                pos = node->link[i].next;
-                                end = node->link[i].prev;
-                                goto CONTINUE;
+                for (; pos->next != end; pos = pos->next) {
+                        nd = list_entry(pos->next, struct skipnode, link[i]);
+                        if (!key_lte_max(nd->key, range)) {
+                                end = pos->next;
+                                break;
                         }
                 }
-                pos = end->next;
-CONTINUE:
+                if (pos != &list->head[i]) {
+                        node = list_entry(pos, struct skipnode, link[i]);
+                }
                 pos--;
                 end--;
         }
 
-        return node;
+        return key_gte_min(node->key, range) ? node : NULL;
 }
 
-/* remove all the nodes with key in range
- * where min and max are inclusive. */
-static int remove_in_range(struct skiplist *list, struct range_spec *range)
+/* Get the node key rank */
+static sk_rank_t skiplist_key_rank(struct skiplist *list, sk_key_t key)
 {
-        int removed = 0;
-        struct skipnode *node;
+        sk_rank_t rank = 0;
         int i = list->level - 1;
         struct sk_link *pos = &list->head[i];
         struct sk_link *end = &list->head[i];
-        struct sk_link *n, *update[MAX_LEVEL];
+        struct skipnode *node = NULL;
 
-        if (key_in_range(list, range)) {
-                return 0;
+        for (; i >= 0; i--) {
+                for (; pos->next != end; pos = pos->next) {
+                        skiplist_prefetch_hop(pos->next, i);
+                        node = list_entry(pos->next, struct skipnode, link[i]);
+                        if (SKIPLIST_KEY_CMP(node->key, key) >= 0) {
+                                end = pos->next;
+                                break;
+                        }
+                        rank += link_span(&node->link[i], i);
+                }
+                if (node != NULL && SKIPLIST_KEY_CMP(node->key, key) == 0) {
+                        return rank + link_span(&node->link[i], i);
+                }
+                pos--;
+                end--;
         }
 
+        return 0;
+}
+
+/* search the node with specified key. */
+static struct skipnode *skiplist_search_by_key(struct skiplist *list, sk_key_t key)
+{
+        int i = list->level - 1;
+        struct sk_link *pos = &list->head[i];
+        struct sk_link *end = &list->head[i];
+        struct skipnode *node = NULL;
+
+        skiplist_stat_call(list, SK_STAT_SEARCH);
         for (; i >= 0; i--) {
-                pos = pos->next;
-                skiplist_foreach_forward_safe(pos, n, end) {
-                        node = list_entry(pos, struct skipnode, link[i]);
-                        if (!key_lte_max(node->key, range)) {
-                                end = &node->link[i];
+                for (; pos->next != end; pos = pos->next) {
+                        skiplist_prefetch_hop(pos->next, i);
+                        skiplist_stat_hop(list, SK_STAT_SEARCH, i);
+                        node = list_entry(pos->next, struct skipnode, link[i]);
+                        if (SKIPLIST_KEY_CMP(node->key, key) >= 0) {
+                                end = pos->next;
                                 break;
-                        } else if (key_gte_min(node->key, range)) {
-                                /* we allow nodes with same key. */
-                                __remove(list, node, i + 1, update);
-                                removed++;
                         }
                 }
-                update[i] = end;
-                pos = end->prev;
+                if (node != NULL) {
+                        skiplist_stat_cmp(list, SK_STAT_SEARCH);
+                        if (SKIPLIST_KEY_CMP(node->key, key) == 0) {
+                                return node;
+                        }
+                }
                 pos--;
                 end--;
         }
 
-        return removed;
+        return NULL;
 }
 
-/* remove all the nodes with key rank in range
- * where start and stop are inclusive. */
-static int remove_in_rank(struct skiplist *list, int start, int stop)
+/* Look up n keys at once and store the node or NULL for each in nodes[].
+ * Up to SKIPLIST_GROUP descents are interleaved one hop at a time, and each
+ * hop prefetches the node the same descent will look at next, so that the
+ * memory latency of one lookup overlaps with the work on the others. */
+static void
+skiplist_search_many(struct skiplist *list, const sk_key_t *keys, int n,
+                     struct skipnode **nodes)
 {
+        struct {
+                struct sk_link *pos, *next;
+                int level, index;
+        } group[SKIPLIST_GROUP], *st;
         struct skipnode *node;
+        int j = 0, active = 0, issued = 0;
+
+        for (; active < SKIPLIST_GROUP && issued < n; active++, issued++) {
+                st = &group[active];
+                st->index = issued;
+                st->level = list->level - 1;
+                st->pos = &list->head[st->level];
+                st->next = st->pos->next;
+                __builtin_prefetch(list_entry(st->next, struct skipnode, link[st->level]));
+        }
+
+        while (active > 0) {
+                st = &group[j];
+                if (st->next != &list->head[st->level]) {
+                        int cmp;
+                        node = list_entry(st->next, struct skipnode, link[st->level]);
+                        cmp = SKIPLIST_KEY_CMP(node->key, keys[st->index]);
+                        if (cmp < 0) {
+                                st->pos = st->next;
+                                st->next = st->pos->next;
+                                goto PREFETCH;
+                        } else if (cmp == 0) {
+                                goto DONE;
+                        }
+                }
+                if (st->level > 0) {
+                        st->pos--;
+                        st->level--;
+                        st->next = st->pos->next;
+                        goto PREFETCH;
+                }
+                node = NULL;
+DONE:
+                nodes[st->index] = node;
+                if (issued < n) {
+                        st->index = issued++;
+                        st->level = list->level - 1;
+                        st->pos = &list->head[st->level];
+                        st->next = st->pos->next;
+                } else {
+                        *st = group[--active];
+                        if (j >= active) {
+                                j = 0;
+                        }
+                        continue;
+                }
+PREFETCH:
+                __builtin_prefetch(st->next);
+                __builtin_prefetch(list_entry(st->next, struct skipnode, link[st->level]));
+                if (++j >= active) {
+                        j = 0;
+                }
+        }
+}
+
+/* search the node with specified key rank. */
+static struct skipnode *skiplist_search_by_rank(struct skiplist *list, sk_rank_t rank)
+{
+        if (rank <= 0 || rank > list->count) {
+                return NULL;
+        }
+
         int i = list->level - 1;
+        sk_rank_t traversed = 0;
         struct sk_link *pos = &list->head[i];
         struct sk_link *end = &list->head[i];
-        int removed = 0, traversed = 0;
-        struct sk_link *n, *update[MAX_LEVEL] = {0};
-
-        if (start <= 0 || stop <= 0 || start > list->count) {
-                return 0;
-        }
+        struct skipnode *node;
 
         for (; i >= 0; i--) {
-                pos = pos->next;
-                skiplist_foreach_forward_safe(pos, n, end) {
-                        node = list_entry(pos, struct skipnode, link[i]);
-                        if (traversed + node->link[i].span > stop) {
-                                end = &node->link[i];
+                for (; pos->next != end; pos = pos->next) {
+                        node = list_entry(pos->next, struct skipnode, link[i]);
+                        if (traversed + link_span(&node->link[i], i) > rank) {
+                                end = pos->next;
                                 break;
-                        } else if (traversed + node->link[i].span >= start) {
-                                /* we allow nodes with same key. */
-                                __remove(list, node, i + 1, update);
-                                removed++;
                         }
-                        traversed += node->link[i].span;
+                        traversed += link_span(&node->link[i], i);
+                        if (rank == traversed) {
+                                return node;
+                        }
                 }
-                update[i] = end;
-                pos = end->prev;
                 pos--;
                 end--;
         }
 
-        return removed;
+        return NULL;
 }
 
-/* Get the node key rank */
-static int skiplist_key_rank(struct skiplist *list, int key)
+/* Rank of the last node before the range, or with last set, of the last node
+ * in it. Both are found by one descent summing spans. */
+static sk_rank_t range_rank(struct skiplist *list, struct range_spec *range, int last)
 {
-        int rank = 0;
         int i = list->level - 1;
+        sk_rank_t traversed = 0;
         struct sk_link *pos = &list->head[i];
         struct sk_link *end = &list->head[i];
         struct skipnode *node;
 
         for (; i >= 0; i--) {
-                pos = pos->next;
-                skiplist_foreach_forward(pos, end) {
-                        node = list_entry(pos, struct skipnode, link[i]);
-                        if (node->key >= key) {
-                                end = &node->link[i];
+                for (; pos->next != end; pos = pos->next) {
+                        node = list_entry(pos->next, struct skipnode, link[i]);
+                        if (last ? !key_lte_max(node->key, range) : key_gte_min(node->key, range)) {
+                                end = pos->next;
                                 break;
                         }
-                        rank += node->link[i].span;
-                }
-                if (node->key == key) {
-                        return rank + node->link[i].span;
+                        traversed += link_span(&node->link[i], i);
                 }
-                pos = end->prev;
                 pos--;
                 end--;
         }
 
-        return 0;
+        return traversed;
 }
 
-/* search the node with specified key. */
-static struct skipnode *skiplist_search_by_key(struct skiplist *list, int key)
+/* Fill path[] with the last link on every level whose node ranks no higher
+ * than rank, the head where there is none, and ranks[] with their ranks. */
+static void
+__rank_path(struct skiplist *list, sk_rank_t rank, struct sk_link **path, sk_rank_t *ranks)
 {
+        struct skipnode *node;
         int i = list->level - 1;
+        sk_rank_t traversed = 0;
         struct sk_link *pos = &list->head[i];
         struct sk_link *end = &list->head[i];
-        struct skipnode *node;
 
         for (; i >= 0; i--) {
-                pos = pos->next;
-                skiplist_foreach_forward(pos, end) {
-                        node = list_entry(pos, struct skipnode, link[i]);
-                        if (node->key >= key) {
-                                end = &node->link[i];
+                for (; pos->next != end; pos = pos->next) {
+                        node = list_entry(pos->next, struct skipnode, link[i]);
+                        if (traversed + link_span(&node->link[i], i) > rank) {
+                                end = pos->next;
                                 break;
                         }
+                        traversed += link_span(&node->link[i], i);
                 }
-                if (node->key == key) {
-                        return node;
-                }
-                pos = end->prev;
+                path[i] = pos;
+                ranks[i] = traversed;
                 pos--;
                 end--;
         }
+}
 
-        return NULL;
+/* Remove the nodes ranked start to stop, both inclusive and valid. The
+ * segment is cut out of every level with one splice between the links just
+ * outside it, and the span of the link after the cut is recomputed from the
+ * ranks on both sides. The nodes then go back to the free lists in one walk. */
+static sk_rank_t __remove_ranks(struct skiplist *list, sk_rank_t start, sk_rank_t stop)
+{
+        int i;
+        sk_rank_t j, removed = stop - start + 1;
+        sk_rank_t pred_rank[MAX_LEVEL], last_rank[MAX_LEVEL];
+        sk_sum_t removed_sum;
+        struct sk_link *pred[MAX_LEVEL], *last[MAX_LEVEL];
+        struct sk_link *pos, *n;
+
+        __rank_path(list, start - 1, pred, pred_rank);
+        __rank_path(list, stop, last, last_rank);
+
+        pos = pred[0]->next;
+        removed_sum = __sum_between(pred[0], last[0]);
+        for (i = 0; i < list->level; i++) {
+                struct sk_link *next = last[i]->next;
+                sum_cut(pred[i], last[i], removed_sum);
+                __list_del(pred[i], next, i);
+                link_span_add(next, i, last_rank[i] - pred_rank[i] - removed);
+        }
+
+        for (j = 0; j < removed; j++, pos = n) {
+                n = pos->next;
+                skipnode_delete(list, list_entry(pos, struct skipnode, link[0]));
+        }
+
+        list->count -= removed;
+        while (list->level > 1 && list_empty(&list->head[list->level - 1])) {
+                list->level--;
+        }
+
+        return removed;
 }
 
-/* search the node with specified key rank. */
-static struct skipnode *skiplist_search_by_rank(struct skiplist *list, int rank)
+/* remove all the nodes with key in range
+ * where min and max are inclusive. */
+static sk_rank_t remove_in_range(struct skiplist *list, struct range_spec *range)
 {
-        if (rank == 0 || rank > list->count) {
-                return NULL;
+        sk_rank_t start, stop;
+
+        if (!key_in_range(list, range)) {
+                return 0;
+        }
+
+        start = range_rank(list, range, 0) + 1;
+        stop = range_rank(list, range, 1);
+        if (start > stop) {
+                return 0;
         }
 
+        return __remove_ranks(list, start, stop);
+}
+
+/* remove all the nodes with key rank in range
+ * where start and stop are inclusive. */
+static sk_rank_t remove_in_rank(struct skiplist *list, sk_rank_t start, sk_rank_t stop)
+{
+        if (start <= 0 || stop <= 0 || start > list->count) {
+                return 0;
+        }
+        if (stop > list->count) {
+                stop = list->count;
+        }
+        if (start > stop) {
+                return 0;
+        }
+
+        return __remove_ranks(list, start, stop);
+}
+
+#ifdef SKIPLIST_SUM
+/* Sum of the values of the first rank nodes. */
+static sk_sum_t skiplist_sum_by_rank(struct skiplist *list, sk_rank_t rank)
+{
+        struct skipnode *node;
         int i = list->level - 1;
-        int traversed = 0;
+        sk_rank_t traversed = 0;
+        sk_sum_t sum = 0;
         struct sk_link *pos = &list->head[i];
         struct sk_link *end = &list->head[i];
-        struct skipnode *node;
 
         for (; i >= 0; i--) {
-                pos = pos->next;
-                skiplist_foreach_forward(pos, end) {
-                        node = list_entry(pos, struct skipnode, link[i]);
-                        if (traversed + node->link[i].span > rank) {
-                                end = &node->link[i];
+                for (; pos->next != end; pos = pos->next) {
+                        node = list_entry(pos->next, struct skipnode, link[i]);
+                        if (traversed + link_span(&node->link[i], i) > rank) {
+                                end = pos->next;
                                 break;
                         }
-                        traversed += node->link[i].span;
-                        if (rank == traversed) {
-                                return node;
+                        traversed += link_span(&node->link[i], i);
+                        sum += node->link[i].sum;
+                }
+                pos--;
+                end--;
+        }
+
+        return sum;
+}
+
+/* Sum of the values of the nodes with a key not greater than key. */
+static sk_sum_t skiplist_sum_by_key(struct skiplist *list, sk_key_t key)
+{
+        struct skipnode *node;
+        int i = list->level - 1;
+        sk_sum_t sum = 0;
+        struct sk_link *pos = &list->head[i];
+        struct sk_link *end = &list->head[i];
+
+        for (; i >= 0; i--) {
+                for (; pos->next != end; pos = pos->next) {
+                        node = list_entry(pos->next, struct skipnode, link[i]);
+                        if (SKIPLIST_KEY_CMP(node->key, key) > 0) {
+                                end = pos->next;
+                                break;
                         }
+                        sum += node->link[i].sum;
                 }
-                pos = end->prev;
                 pos--;
                 end--;
         }
 
-        return NULL;
+        return sum;
 }
 
+/* Sum of the values of the nodes ranked start to stop, both inclusive. */
+static sk_sum_t skiplist_sum_in_rank(struct skiplist *list, sk_rank_t start, sk_rank_t stop)
+{
+        if (start <= 0) {
+                start = 1;
+        }
+        if (stop > list->count) {
+                stop = list->count;
+        }
+        if (start > stop) {
+                return 0;
+        }
+        return skiplist_sum_by_rank(list, stop) - skiplist_sum_by_rank(list, start - 1);
+}
+
+/* Sum of the values of the nodes with key in range. */
+static sk_sum_t skiplist_sum_in_range(struct skiplist *list, struct range_spec *range)
+{
+        if (!key_in_range(list, range)) {
+                return 0;
+        }
+        return skiplist_sum_by_rank(list, range_rank(list, range, 1)) -
+               skiplist_sum_by_rank(list, range_rank(list, range, 0));
+}
+#endif
+
+/* A range iterator streams the nodes with key in range like ZRANGEBYSCORE
+ * with LIMIT offset count, or in reverse like ZREVRANGEBYSCORE. The offset is
+ * skipped through the spans in O(log n), then each batch walks level 0, so a
+ * page of k nodes costs O(log n + k). Modifying the list invalidates the
+ * iterator. */
+struct range_iter {
+        struct skiplist *list;
+        struct range_spec range;
+        struct sk_link *pos;    /* level 0 link of the next node, the head when done */
+        sk_rank_t left;         /* nodes still allowed by the limit, negative if none */
+        int reverse;
+};
+
+static void
+range_iter_init(struct range_iter *it, struct skiplist *list, struct range_spec *range,
+                sk_rank_t offset, sk_rank_t limit, int reverse)
+{
+        sk_rank_t rank;
+        struct skipnode *node;
+
+        it->list = list;
+        it->range = *range;
+        it->pos = &list->head[0];
+        it->left = limit;
+        it->reverse = reverse;
+
+        if (offset < 0 || limit == 0 || !key_in_range(list, range)) {
+                return;
+        }
+
+        if (reverse) {
+                rank = range_rank(list, range, 1) - offset;
+        } else {
+                rank = range_rank(list, range, 0) + 1 + offset;
+        }
+        node = skiplist_search_by_rank(list, rank);
+        if (node != NULL) {
+                it->pos = &node->link[0];
+        }
+}
+
+/* Copy up to n of the next pairs into out, returns how many, 0 when done. */
+static int range_iter_next(struct range_iter *it, struct sk_pair *out, int n)
+{
+        int i;
+        struct skipnode *node;
+        struct sk_link *head = &it->list->head[0];
+
+        if (it->left >= 0 && n > it->left) {
+                n = it->left;
+        }
+        for (i = 0; i < n && it->pos != head; i++) {
+                node = list_entry(it->pos, struct skipnode, link[0]);
+                if (it->reverse ? !key_gte_min(node->key, &it->range) :
+                                  !key_lte_max(node->key, &it->range)) {
+                        it->pos = head;
+                        break;
+                }
+                out[i].key = node->key;
+                out[i].value = node->value;
+                it->pos = it->reverse ? it->pos->prev : it->pos->next;
+        }
+        if (it->left >= 0) {
+                it->left -= i;
+        }
+
+        return i;
+}
+
+/* A cursor keeps the search path of the last operation made through it:
+ * pred[i] is the link at level i after which the last key would go and
+ * rank[i] is the rank of its node, 0 for the head. The next lookup climbs from
+ * level 0 only as far as the path needs to move, so nearby keys are found in
+ * O(log d) where d is their distance. Modifying the list other than through
+ * the cursor invalidates it until skiplist_cursor_init() is called again. */
+struct skipcursor {
+        struct skiplist *list;
+        struct sk_link *pred[MAX_LEVEL];
+        sk_rank_t rank[MAX_LEVEL];
+};
+
+static void skiplist_cursor_init(struct skipcursor *cur, struct skiplist *list)
+{
+        int i;
+        cur->list = list;
+        for (i = 0; i < MAX_LEVEL; i++) {
+                cur->pred[i] = &list->head[i];
+                cur->rank[i] = 0;
+        }
+}
+
+#define cursor_key(cur, i) \
+        (list_entry((cur)->pred[i], struct skipnode, link[i])->key)
+#define cursor_next_key(cur, i) \
+        (list_entry((cur)->pred[i]->next, struct skipnode, link[i])->key)
+
+/* Move the path so that pred[i] is the last node with a key less than key. */
+static void __cursor_seek(struct skipcursor *cur, sk_key_t key)
+{
+        struct skiplist *list = cur->list;
+        int i, top = list->level - 1;
+        struct sk_link *pos;
+        sk_rank_t traversed;
+
+        /* climb while the path does not bracket the key on this level */
+        for (i = 0; i < top; i++) {
+                if ((cur->pred[i] == &list->head[i] ||
+                     SKIPLIST_KEY_CMP(cursor_key(cur, i), key) < 0) &&
+                    (cur->pred[i]->next == &list->head[i] ||
+                     SKIPLIST_KEY_CMP(cursor_next_key(cur, i), key) >= 0)) {
+                        break;
+                }
+        }
+
+        /* below the top the path brackets the key, so it only ever moves
+         * forward; on the top level a key behind it starts over from the head */
+        pos = cur->pred[i];
+        traversed = cur->rank[i];
+        if (pos != &list->head[i] && SKIPLIST_KEY_CMP(cursor_key(cur, i), key) >= 0) {
+                pos = &list->head[i];
+                traversed = 0;
+        }
+        for (; i >= 0; i--) {
+                for (; pos->next != &list->head[i]; pos = pos->next) {
+                        struct skipnode *nd = list_entry(pos->next, struct skipnode, link[i]);
+                        if (SKIPLIST_KEY_CMP(nd->key, key) >= 0) {
+                                break;
+                        }
+                        traversed += link_span(&nd->link[i], i);
+                }
+                cur->pred[i] = pos;
+                cur->rank[i] = traversed;
+                pos--;
+        }
+}
+
+/* Move the path so that pred[i] is the last node with a rank less than rank. */
+static void __cursor_seek_rank(struct skipcursor *cur, sk_rank_t rank)
+{
+        struct skiplist *list = cur->list;
+        int i, top = list->level - 1;
+        struct sk_link *pos;
+        sk_rank_t traversed;
+
+        for (i = 0; i < top; i++) {
+                if (cur->rank[i] < rank &&
+                    (cur->pred[i]->next == &list->head[i] ||
+                     cur->rank[i] + link_span(cur->pred[i]->next, i) >= rank)) {
+                        break;
+                }
+        }
+
+        pos = cur->pred[i];
+        traversed = cur->rank[i];
+        if (traversed >= rank) {
+                pos = &list->head[i];
+                traversed = 0;
+        }
+        for (; i >= 0; i--) {
+                for (; pos->next != &list->head[i]; pos = pos->next) {
+                        if (traversed + link_span(pos->next, i) >= rank) {
+                                break;
+                        }
+                        traversed += link_span(pos->next, i);
+                }
+                cur->pred[i] = pos;
+                cur->rank[i] = traversed;
+                pos--;
+        }
+}
+
+static struct skipnode *skiplist_cursor_search(struct skipcursor *cur, sk_key_t key)
+{
+        struct skipnode *node;
+        __cursor_seek(cur, key);
+        if (cur->pred[0]->next == &cur->list->head[0]) {
+                return NULL;
+        }
+        node = list_entry(cur->pred[0]->next, struct skipnode, link[0]);
+        return SKIPLIST_KEY_CMP(node->key, key) == 0 ? node : NULL;
+}
+
+static struct skipnode *skiplist_cursor_search_by_rank(struct skipcursor *cur, sk_rank_t rank)
+{
+        if (rank <= 0 || rank > cur->list->count) {
+                return NULL;
+        }
+        __cursor_seek_rank(cur, rank);
+        return list_entry(cur->pred[0]->next, struct skipnode, link[0]);
+}
+
+/* Get the node key rank, 0 if absent. */
+static sk_rank_t skiplist_cursor_key_rank(struct skipcursor *cur, sk_key_t key)
+{
+        return skiplist_cursor_search(cur, key) != NULL ? cur->rank[0] + 1 : 0;
+}
+
+static struct skipnode *
+skiplist_cursor_insert(struct skipcursor *cur, sk_key_t key, sk_value_t value)
+{
+        int i;
+        sk_rank_t span;
+        struct sk_link *next;
+        struct skiplist *list = cur->list;
+        int level = random_level(list);
+        struct skipnode *node = skipnode_new(list, level, key, value);
+        if (node == NULL) {
+                return NULL;
+        }
+
+        if (level > list->level) {
+                list->level = level;
+        }
+        __cursor_seek(cur, key);
+
+        for (i = 0; i < list->level; i++) {
+                next = cur->pred[i]->next;
+                sum_add(node, cur->pred, i, level);
+                if (i < level) {
+                        span = cur->rank[0] - cur->rank[i] + 1;
+                        __list_add(&node->link[i], cur->pred[i], next, i);
+                        link_span_set(&node->link[i], i, span);
+                        link_span_add(next, i, 1 - span);
+                } else {
+                        link_span_add(next, i, 1);
+                }
+        }
+        list->count++;
+
+        return node;
+}
+
+/* Remove the first node with the key, the path before it stays valid. */
+static void skiplist_cursor_remove(struct skipcursor *cur, sk_key_t key)
+{
+        struct skipnode *node = skiplist_cursor_search(cur, key);
+        if (node != NULL) {
+                __remove(cur->list, node, slab_of(node)->level, cur->pred);
+        }
+}
+
+#if defined(SKIPLIST_KEY_FMT) && defined(SKIPLIST_VALUE_FMT)
 static void skiplist_dump(struct skiplist *list)
 {
-        int traversed = 0;
+        sk_rank_t traversed = 0;
         struct skipnode *node;
         int i = list->level - 1;
         struct sk_link *pos = &list->head[i];
         struct sk_link *end = &list->head[i];
 
-        printf("\nTotal %d nodes: \n", list->count);
+        printf("\nTotal " SKIPLIST_RANK_FMT " nodes: \n", list->count);
         for (; i >= 0; i--) {
                 traversed = 0;
                 pos = pos->next;
                 printf("level %d:\n", i + 1);
                 skiplist_foreach_forward(pos, end) {
                         node = list_entry(pos, struct skipnode, link[i]);
-                        traversed += node->link[i].span;
-                        printf("key:0x%08x value:0x%08x rank:%u\n",
-                                node->key, node->value, traversed);
+                        traversed += link_span(&node->link[i], i);
+                        printf("key:" SKIPLIST_KEY_FMT " value:" SKIPLIST_VALUE_FMT " rank:" SKIPLIST_RANK_FMT "\n",
+                                SKIPLIST_KEY_ARG(node->key), SKIPLIST_VALUE_ARG(node->value),
+                                traversed);
                 }
                 pos = &list->head[i];
                 pos--;
                 end--;
         }
 }
+#endif
+
+#ifdef SKIPLIST_STATS
+/* Print a snapshot: the tower heights next to the counts the promotion
+ * probability leads to expect, then per operation the compares and the nodes
+ * visited on each level, top down, per call. */
+static void skiplist_stats_dump(const struct skiplist_stats *stats)
+{
+        static const char *name[SK_STAT_OPS] = { "search", "insert", "remove" };
+        int i, j;
+        const struct sk_op_stats *op;
+        double expect = stats->count * (1.0 - 1.0 / (1 << SKIPLIST_P_SHIFT));
+
+        printf("\nTotal " SKIPLIST_RANK_FMT " nodes, %d levels\n", stats->count, stats->level);
+        printf("height    nodes  expected\n");
+        for (i = 0; i < stats->level; i++) {
+                printf("%6d %8lld %9.0f\n", i + 1, (long long)stats->height[i], expect);
+                expect /= 1 << SKIPLIST_P_SHIFT;
+        }
+        for (j = 0; j < SK_STAT_OPS; j++) {
+                op = &stats->op[j];
+                if (op->calls == 0) {
+                        continue;
+                }
+                printf("%s: %llu calls, %.1f compares per call, hops per call:",
+                       name[j], op->calls, (double)op->compares / op->calls);
+                for (i = stats->level - 1; i >= 0; i--) {
+                        printf(" %.2f", (double)op->hops[i] / op->calls);
+                }
+                printf("\n");
+        }
+}
+#endif
 
 #endif  /* _SKIPLIST_H */
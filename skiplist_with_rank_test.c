@@ -27,6 +27,80 @@ int clock_gettime(int clk_id, struct timespec* t) {
 #define N 1024 * 1024 * 2
 //#define SKIPLIST_DEBUG
 
+/* Every span must equal the rank distance to the previous node on its level,
+ * counted on level 0, every level must be linked in the order of level 0, and
+ * no level above list->level may hold nodes. With SKIPLIST_SUM the link sums
+ * must match the values in between as well. */
+static int check_spans(struct skiplist *list)
+{
+    int i, level;
+    sk_rank_t rank = 0, last[MAX_LEVEL] = {0};
+#ifdef SKIPLIST_SUM
+    sk_sum_t sum = 0, last_sum[MAX_LEVEL] = {0};
+#endif
+    struct sk_link *pos, *pred[MAX_LEVEL];
+
+    for (i = 0; i < MAX_LEVEL; i++) {
+        pred[i] = &list->head[i];
+    }
+    for (pos = list->head[0].next; pos != &list->head[0]; pos = pos->next) {
+        struct skipnode *node = list_entry(pos, struct skipnode, link[0]);
+        rank++;
+#ifdef SKIPLIST_SUM
+        sum += node->value;
+#endif
+        level = slab_of(node)->level;
+        if (level > list->level) {
+            printf("Node above top level at rank " SKIPLIST_RANK_FMT "\n", rank);
+            return 0;
+        }
+        for (i = 0; i < level; i++) {
+            if (link_span(&node->link[i], i) != rank - last[i] || pred[i]->next != &node->link[i] ||
+                (link_has_prev(i) && node->link[i].prev != pred[i])) {
+                printf("Bad span at rank " SKIPLIST_RANK_FMT " level %d\n", rank, i);
+                return 0;
+            }
+            pred[i] = &node->link[i];
+            last[i] = rank;
+#ifdef SKIPLIST_SUM
+            if (node->link[i].sum != sum - last_sum[i]) {
+                printf("Bad sum at rank " SKIPLIST_RANK_FMT " level %d\n", rank, i);
+                return 0;
+            }
+            last_sum[i] = sum;
+#endif
+        }
+    }
+    if (rank != list->count) {
+        printf("Count " SKIPLIST_RANK_FMT " but " SKIPLIST_RANK_FMT " nodes\n", list->count, rank);
+        return 0;
+    }
+    for (i = 0; i < list->level; i++) {
+        if (pred[i]->next != &list->head[i] || (link_has_prev(i) && list->head[i].prev != pred[i])) {
+            printf("Level %d does not end at the head\n", i);
+            return 0;
+        }
+    }
+    for (i = list->level; i < MAX_LEVEL; i++) {
+        if (!list_empty(&list->head[i])) {
+            printf("Nodes above top level %d\n", list->level);
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/* Build with -DSKIPLIST_RANK64 to compare against the 64-bit layout. */
+static size_t skiplist_memory(struct skiplist *list)
+{
+    size_t bytes = sizeof(*list);
+    struct sk_slab *slab;
+    for (slab = list->slabs; slab != NULL; slab = slab->next) {
+        bytes += SKIPLIST_SLAB_SIZE;
+    }
+    return bytes;
+}
+
 int
 main(void)
 {
@@ -43,18 +117,26 @@ main(void)
         exit(-1);
     }
 
-    printf("Test start!\n");
+    /* One seed drives both the keys and the towers, so a run can be
+     * repeated with SKIPLIST_SEED */
+    unsigned int seed = getenv("SKIPLIST_SEED") ? (unsigned int)strtoul(getenv("SKIPLIST_SEED"), NULL, 0)
+                                              : (unsigned int)time(NULL);
+    srandom(seed);
+    skiplist_seed(list, seed);
+
+    printf("Test start! seed:%u\n", seed);
     printf("Add %d nodes...\n", N);
 
     /* Insert test */
-    srandom(time(NULL));
     clock_gettime(CLOCK_MONOTONIC, &start);
     for (i = 0; i < N; i++) {
         int value = key[i] = (int)random();
         skiplist_insert(list, key[i], value);
     }
     clock_gettime(CLOCK_MONOTONIC, &end);
-    printf("time span: %ldms\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000);
+    printf("time span: %ldms, %d levels\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000, list->level);
+    printf("%d-bit ranks, %d-byte links, %.1f bytes per node\n", (int)sizeof(sk_rank_t) * 8,
+           (int)sizeof(struct sk_link), (double)skiplist_memory(list) / (N));
     #ifdef SKIPLIST_DEBUG
     skiplist_dump(list);
     #endif
@@ -72,7 +154,7 @@ main(void)
             printf("Not found:0x%08x\n", key[i]);
         }
         #ifdef SKIPLIST_DEBUG
-        printf("key rank:%d\n", skiplist_key_rank(list, key[i]));
+        printf("key rank:" SKIPLIST_RANK_FMT "\n", skiplist_key_rank(list, key[i]));
         #else
         //skiplist_key_rank(list, key[i]);
         #endif
@@ -80,6 +162,23 @@ main(void)
     clock_gettime(CLOCK_MONOTONIC, &end);
     printf("time span: %ldms\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000);
 
+    /* Batched search test */
+    printf("Now search all nodes in groups...\n");
+    struct skipnode **nodes = (struct skipnode **)malloc(N * sizeof(*nodes));
+    if (nodes == NULL) {
+        exit(-1);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    skiplist_search_many(list, key, N, nodes);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000);
+    for (i = 0; i < N; i++) {
+        if (nodes[i] == NULL || nodes[i]->key != key[i]) {
+            printf("Not found:0x%08x\n", key[i]);
+        }
+    }
+    free(nodes);
+
     /* Search test 2 */
     printf("Now search each node by rank...\n");
     clock_gettime(CLOCK_MONOTONIC, &start);
@@ -96,6 +195,20 @@ main(void)
     clock_gettime(CLOCK_MONOTONIC, &end);
     printf("time span: %ldms\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000);
 
+    #ifdef SKIPLIST_STATS
+    /* The towers counted by height must add up to the nodes */
+    struct skiplist_stats stats;
+    sk_rank_t towers = 0;
+    skiplist_stats(list, &stats);
+    skiplist_stats_dump(&stats);
+    for (i = 0; i < MAX_LEVEL; i++) {
+        towers += stats.height[i];
+    }
+    if (towers != stats.count || stats.op[SK_STAT_SEARCH].calls != N) {
+        printf("Stats counted " SKIPLIST_RANK_FMT " towers and %llu searches\n", towers, stats.op[SK_STAT_SEARCH].calls);
+    }
+    #endif
+
     /* Delete test */
     printf("Now remove all nodes...\n");
     clock_gettime(CLOCK_MONOTONIC, &start);
@@ -108,6 +221,178 @@ main(void)
     skiplist_dump(list);
     #endif
 
+    /* Batch insert test */
+    struct sk_pair *pairs = (struct sk_pair *)malloc(N * sizeof(*pairs));
+    if (pairs == NULL) {
+        exit(-1);
+    }
+    for (i = 0; i < N; i++) {
+        pairs[i].key = key[i];
+        pairs[i].value = key[i];
+    }
+    printf("Now add all nodes in one batch...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    skiplist_insert_batch(list, pairs, N);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000);
+
+    /* Bulk load test, the batch above left the pairs sorted */
+    struct skiplist *bulk = skiplist_new();
+    if (bulk == NULL) {
+        exit(-1);
+    }
+    printf("Now bulk load all sorted nodes...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    skiplist_bulk_load(bulk, pairs, N);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000);
+    for (i = 0; i < N; i++) {
+        struct skipnode *node = skiplist_search_by_rank(bulk, i + 1);
+        if (node == NULL || node->key != pairs[i].key) {
+            printf("Wrong rank:%d\n", i + 1);
+        }
+    }
+
+    /* Cursor test, sorted keys are the best case for a finger */
+    struct skipcursor cursor;
+    skiplist_cursor_init(&cursor, bulk);
+    printf("Now search each sorted node with a cursor...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i++) {
+        /* a duplicate ranks as the first of its run */
+        sk_rank_t rank = skiplist_cursor_key_rank(&cursor, pairs[i].key);
+        if (rank == 0) {
+            printf("Not found:0x%08x\n", pairs[i].key);
+        } else if ((i == 0 || pairs[i - 1].key != pairs[i].key) && rank != (sk_rank_t)i + 1) {
+            printf("Wrong cursor rank:" SKIPLIST_RANK_FMT " of %d\n", rank, i + 1);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000);
+
+    /* A key just below each sorted one goes in and out through the cursor,
+     * which must keep the spans and leave the list as it was */
+    printf("Now insert and remove a nearby key at each sorted node with a cursor...\n");
+    skiplist_cursor_init(&cursor, bulk);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i++) {
+        int near = pairs[i].key - 1;
+        struct skipnode *node = skiplist_cursor_insert(&cursor, near, near);
+        sk_rank_t rank = skiplist_cursor_key_rank(&cursor, near);
+        if (node == NULL || rank == 0 || skiplist_cursor_search_by_rank(&cursor, rank) != node) {
+            printf("Cursor insert lost:0x%08x\n", near);
+        }
+        skiplist_cursor_remove(&cursor, near);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000);
+    if (bulk->count != N || !check_spans(bulk)) {
+        printf("Spans broken by cursor insert and remove\n");
+    }
+    for (i = 0; i < N; i += N / 16) {
+        struct skipnode *node = skiplist_search_by_rank(bulk, i + 1);
+        if (node == NULL || node->key != pairs[i].key) {
+            printf("Wrong rank after cursor updates:%d\n", i + 1);
+        }
+    }
+
+#ifdef SKIPLIST_SUM
+    /* Sum test, every prefix of the sorted values by rank and by key */
+    long long *prefix = (long long *)malloc((N + 1) * sizeof(*prefix));
+    if (prefix == NULL) {
+        exit(-1);
+    }
+    prefix[0] = 0;
+    for (i = 0; i < N; i++) {
+        prefix[i + 1] = prefix[i] + pairs[i].value;
+    }
+    if (!check_spans(bulk)) {
+        printf("Sums broken by bulk load\n");
+    }
+    printf("Now sum each prefix by rank and by key...\n");
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i++) {
+        if (skiplist_sum_by_rank(bulk, i + 1) != prefix[i + 1]) {
+            printf("Wrong sum at rank:%d\n", i + 1);
+        }
+        /* duplicates are all summed by key */
+        if ((i == N - 1 || pairs[i + 1].key != pairs[i].key) &&
+            skiplist_sum_by_key(bulk, pairs[i].key) != prefix[i + 1]) {
+            printf("Wrong sum at key:0x%08x\n", pairs[i].key);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000);
+    free(prefix);
+#endif
+
+    /* Range test, pages of LIMIT pairs after OFFSET read in small batches,
+     * checked against the sorted pairs */
+    printf("Now read a page from each of %d ranges both ways...\n", N / 64);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i + 256 < N; i += 64) {
+        struct sk_pair page[8];
+        struct range_spec range;
+        struct range_iter it;
+        int lo = i + 3, hi = i + 255, offset = i % 50, reverse, j, k, n, at;
+
+        range.min = pairs[lo].key;
+        range.max = pairs[hi].key;
+        range.minex = range.maxex = 0;
+        while (lo > 0 && pairs[lo - 1].key == range.min) {
+            lo--;
+        }
+        while (hi < N - 1 && pairs[hi + 1].key == range.max) {
+            hi++;
+        }
+        for (reverse = 0; reverse < 2; reverse++) {
+            range_iter_init(&it, bulk, &range, offset, 100, reverse);
+            at = reverse ? hi - offset : lo + offset;
+            j = 0;
+            while ((n = range_iter_next(&it, page, 8)) > 0) {
+                for (k = 0; k < n; k++, j++) {
+                    if (page[k].key != pairs[at].key) {
+                        printf("Wrong range pair:0x%08x\n", page[k].key);
+                    }
+                    at += reverse ? -1 : 1;
+                }
+            }
+            if (j != 100) {
+                printf("Short range page:%d\n", j);
+            }
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000);
+
+    /* Range delete test, drop every other block of sorted keys by key and
+     * the rest by rank, then check that the spans still add up */
+    printf("Now remove all nodes in ranges of 4096...\n");
+    sk_rank_t removed = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < N; i += 2 * 4096) {
+        struct range_spec range;
+        int hi = i + 4095 < N ? i + 4095 : N - 1;
+        range.min = pairs[i].key;
+        range.max = pairs[hi].key;
+        range.minex = range.maxex = 0;
+        removed += remove_in_range(bulk, &range);
+    }
+    if (!check_spans(bulk)) {
+        printf("Spans broken by remove_in_range\n");
+    }
+    while (bulk->count > 0) {
+        removed += remove_in_rank(bulk, 1, 4096);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    printf("time span: %ldms\n", (end.tv_sec - start.tv_sec)*1000 + (end.tv_nsec - start.tv_nsec)/1000000);
+    if (removed != N || !check_spans(bulk) || bulk->level != 1) {
+        printf("Removed " SKIPLIST_RANK_FMT " of %d nodes, %d levels left\n", removed, N, bulk->level);
+    }
+
+    skiplist_delete(bulk);
+    free(pairs);
+
     printf("End of Test.\n");
     skiplist_delete(list);
 